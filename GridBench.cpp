@@ -0,0 +1,351 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridHex.h"
+#include "GridMidiScheduler.h"
+#include "GridOscillator.h"
+#include "GridStrument.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ======================================================================
+// GridBench - microbenchmarks for the note-mapping & expression kernels
+// that run for every touch sample.  Sweeps grid sizes from 40 to 400,
+// guitar mode and screen sizes up to 8K.  Prints one JSON object per
+// line with the best ns/call of a few runs, so results can be diffed.
+//
+// The GridMidiScheduler case is a real time test instead: a finger
+// sampled every 1ms arrives in bursts of 2, late by up to another 1ms,
+// and the jitter of the gaps between output messages is measured
+// sending straight away and with each scheduler delay.  It only reports;
+// GridSchedulerTest is the pass/fail check against a jitter bound.
+//
+// The GridOscillatorBank case renders GridSynth's oscillator engine in
+// blocks of 32 to 256 frames, with 1 to 16 fingers moving, and reports
+// the time per block & per voice frame.  --iterations is frames there.
+//
+// usage:
+//   GridBench [--filter <kernel substring>] [--iterations N]
+//
+
+static const int GRID_SIZES[] = { 40, 90, 160, 250, 400 };
+static const int SCREENS[][2] = {
+    { 1280, 720 }, { 1920, 1080 }, { 2736, 1824 }, { 3840, 2160 }, { 7680, 4320 }
+};
+static const int NUM_INPUTS = 4096;  // power of 2, small enough to stay in cache
+static const int NUM_RUNS = 5;
+static const int JITTER_EVENTS = 1000;
+static const int JITTER_INTERVAL_US = 1000;
+static const int JITTER_BURST = 2;
+static const int JITTER_LATE_US = 1000;
+static const int OSCILLATOR_VOICES[] = { 1, 4, 8, 16 };
+static const int OSCILLATOR_BLOCKS[] = { 32, 64, 256 };
+static const double OSCILLATOR_RATE = 44100.0;
+
+// ======================================================================
+// notes when each message was sent, in a buffer allocated up front
+//
+class TimingSink final : public GridMidiSink
+{
+    std::vector<long long> times_;
+    size_t count_;
+public:
+    explicit TimingSink(size_t size) : times_(size), count_(0) {}
+    void send(uint32_t, long long) override {
+        if (count_ < times_.size()) {
+            times_[count_++] = GridClock::now();
+        }
+    }
+    size_t count() { return count_; }
+    long long time(size_t i) { return times_[i]; }
+};
+
+class GridBench
+{
+    std::string filter_;
+    int iterations_;
+    volatile int sink_;               // keeps the compiler from dropping the work
+    std::vector<POINT> points_;
+    std::vector<RECT> rects_;
+    std::vector<POINT> locs_;         // grid x,y locations
+
+public:
+    GridBench(const std::string& filter, int iterations) : filter_(filter), iterations_(iterations), sink_(0) {}
+    void run();
+
+private:
+    // ==================================================================
+    // random points & finger sized rects across a screen.  A fixed seed
+    // keeps runs comparable.
+    //
+    void makeInputs(int width, int height)
+    {
+        uint32_t seed = 2020;
+        auto rnd = [&seed](int n) {
+            seed = seed * 1664525u + 1013904223u;
+            return static_cast<int>((seed >> 8) % static_cast<uint32_t>(n));
+        };
+        points_.resize(NUM_INPUTS);
+        rects_.resize(NUM_INPUTS);
+        for (int i = 0; i < NUM_INPUTS; i++) {
+            points_[i] = { rnd(width), rnd(height) };
+            int w = 10 + rnd(110), h = 10 + rnd(110);
+            rects_[i] = { points_[i].x - w / 2, points_[i].y - h / 2, points_[i].x + w / 2, points_[i].y + h / 2 };
+        }
+    }
+
+    // grid locations spread over an nx by ny grid
+    void makeLocs(int nx, int ny)
+    {
+        locs_.resize(NUM_INPUTS);
+        for (int i = 0; i < NUM_INPUTS; i++) {
+            locs_[i] = { (i * 7) % nx, (i * 13) % ny };
+        }
+    }
+
+    // ==================================================================
+    // best ns/call of NUM_RUNS runs of kernel(i) for i in [0,iterations)
+    //
+    template <typename Kernel>
+    void measure(const char* name, int width, int height, int grid_size, int guitar_mode, Kernel kernel)
+    {
+        if (std::string(name).find(filter_) == std::string::npos) {
+            return;
+        }
+        double best = 1e30;
+        for (int run = 0; run < NUM_RUNS; run++) {
+            int sum = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations_; i++) {
+                sum += kernel(i & (NUM_INPUTS - 1));
+            }
+            auto stop = std::chrono::steady_clock::now();
+            sink_ = sink_ + sum;
+            best = std::min(best, std::chrono::duration<double, std::nano>(stop - start).count() / iterations_);
+        }
+        char line[256];
+        std::snprintf(line, sizeof(line),
+            "{\"kernel\": \"%s\", \"width\": %d, \"height\": %d, \"grid_size\": %d, "
+            "\"guitar_mode\": %d, \"ns_per_call\": %.3f}",
+            name, width, height, grid_size, guitar_mode, best);
+        std::cout << line << std::endl;
+    }
+
+    // ==================================================================
+    // feed bursty pitch bends to the scheduler (or straight to the sink
+    // when delay_ms is 0) & report how far the output gaps stray from
+    // the sampling interval
+    //
+    void jitter(int delay_ms)
+    {
+        const char* name = "GridMidiScheduler";
+        if (std::string(name).find(filter_) == std::string::npos) {
+            return;
+        }
+        long long ticks_per_us = GridClock::ticksPerSecond() / 1000000;
+        TimingSink timing(JITTER_EVENTS);
+        GridMidiScheduler scheduler(&timing, delay_ms * 1000 * ticks_per_us);
+        GridMidiSink* output = &timing;
+        if (delay_ms > 0) {
+            scheduler.start();
+            output = &scheduler;
+        }
+        uint32_t seed = 2020;
+        long long start = GridClock::now() + 10000 * ticks_per_us;
+        for (int i = 0; i < JITTER_EVENTS; i += JITTER_BURST) {
+            // the OS hands over the burst a little after its last sample
+            seed = seed * 1664525u + 1013904223u;
+            long long last_sample = start + (i + JITTER_BURST - 1) * JITTER_INTERVAL_US * ticks_per_us;
+            long long arrival = last_sample + ((seed >> 8) % JITTER_LATE_US) * ticks_per_us;
+            std::this_thread::sleep_for(std::chrono::nanoseconds(
+                GridClock::ticksToNanoseconds(arrival - GridClock::now())));
+            for (int j = i; j < std::min(i + JITTER_BURST, JITTER_EVENTS); j++) {
+                long long event_time = start + j * JITTER_INTERVAL_US * ticks_per_us;
+                output->send(MidiMessage(MIDI::PITCH_BEND, j & 0x7f, 64).data(), event_time);
+            }
+        }
+        scheduler.stop();
+
+        double sum_squares = 0, max_error = 0;
+        size_t count = timing.count();
+        for (size_t i = 1; i < count; i++) {
+            double gap_us = GridClock::ticksToNanoseconds(timing.time(i) - timing.time(i - 1)) / 1000.0;
+            double error = std::fabs(gap_us - JITTER_INTERVAL_US);
+            sum_squares += error * error;
+            max_error = std::max(max_error, error);
+        }
+        double rms = (count > 1) ? std::sqrt(sum_squares / (count - 1)) : 0;
+        char line[256];
+        std::snprintf(line, sizeof(line),
+            "{\"kernel\": \"%s\", \"delay_ms\": %d, \"events\": %zu, \"interval_us\": %d, "
+            "\"jitter_rms_us\": %.1f, \"jitter_max_us\": %.1f, \"late\": %llu}",
+            name, delay_ms, count, JITTER_INTERVAL_US, rms, max_error,
+            static_cast<unsigned long long>(scheduler.late()));
+        std::cout << line << std::endl;
+    }
+
+    // ==================================================================
+    // render the oscillators in blocks with each finger bending,
+    // brightening & pressing in turn, one message per block
+    //
+    void oscillators(int voices, int block_frames)
+    {
+        const char* name = "GridOscillatorBank";
+        if (std::string(name).find(filter_) == std::string::npos) {
+            return;
+        }
+        GridOscillatorBank bank(OSCILLATOR_RATE);
+        bank.pitchBendRange(12);
+        for (int v = 0; v < voices; v++) {
+            bank.noteOn(v, 48 + 3 * v, 100);
+        }
+        std::vector<float> left(block_frames), right(block_frames);
+        int blocks = std::max(1, iterations_ / block_frames);
+        double best = 1e30;
+        for (int run = 0; run < NUM_RUNS; run++) {
+            float sum = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int b = 0; b < blocks; b++) {
+                int v = b % voices;
+                switch ((b / voices) % 3) {
+                case 0: bank.pitchBend(v, 0x2000 + (b & 0xff) * 8); break;
+                case 1: bank.controlChange(v, 1, b & 0x7f); break;
+                default: bank.polyKeyPressure(v, 48 + 3 * v, 64 + (b & 0x3f)); break;
+                }
+                bank.render(left.data(), right.data(), block_frames);
+                sum += left[b % block_frames];
+            }
+            auto stop = std::chrono::steady_clock::now();
+            sink_ = sink_ + static_cast<int>(sum);
+            best = std::min(best, std::chrono::duration<double, std::nano>(stop - start).count() / blocks);
+        }
+        char line[256];
+        std::snprintf(line, sizeof(line),
+            "{\"kernel\": \"%s\", \"simd\": \"%s\", \"voices\": %d, \"block_frames\": %d, "
+            "\"ns_per_block\": %.1f, \"ns_per_voice_frame\": %.3f, \"realtime_factor\": %.1f}",
+            name, GridOscillatorBank::simd(), voices, block_frames, best, best / (voices * block_frames),
+            1e9 * block_frames / OSCILLATOR_RATE / best);
+        std::cout << line << std::endl;
+    }
+};
+
+void GridBench::run()
+{
+    for (auto& screen : SCREENS) {
+        int width = screen[0], height = screen[1];
+        makeInputs(width, height);
+        for (int grid_size : GRID_SIZES) {
+            // free hex functions.  grid_size is the hex radius for these.
+            int hex_x = 0, hex_y = 0;
+            hexGetNumGrids(width, height, grid_size / 2, hex_x, hex_y);
+            hex_x = std::max(hex_x, 1);
+            hex_y = std::max(hex_y, 1);
+            makeLocs(hex_x, hex_y);
+            measure("hexGetNumGrids", width, height, grid_size, -1, [&](int i) {
+                int nx, ny;
+                hexGetNumGrids(width - (i & 7), height, grid_size / 2, nx, ny);  // vary the input a little
+                return nx + ny;
+            });
+            measure("pointToHexGridLoc", width, height, grid_size, -1, [&](int i) {
+                int x, y;
+                pointToHexGridLoc(points_[i], grid_size / 2, x, y);
+                return x + y;
+            });
+            measure("hexGridLocToMidiNote", width, height, grid_size, -1, [&](int i) {
+                return hexGridLocToMidiNote(hex_y, locs_[i].x, locs_[i].y);
+            });
+
+            for (int guitar_mode = 0; guitar_mode <= 1; guitar_mode++) {
+                GridStrument grid(nullptr);
+                grid.prefGridSize(grid_size);
+                grid.prefGuitarMode(guitar_mode != 0);
+                grid.prefHexGridMode(false);
+                grid.resize(width, height);
+                makeLocs(std::max(grid.num_grids_x_, 1), std::max(grid.num_grids_y_, 1));
+                measure("gridLocToMidiNote", width, height, grid_size, guitar_mode, [&](int i) {
+                    return grid.gridLocToMidiNote(locs_[i].x, locs_[i].y);
+                });
+                measure("pointToMidiNote/square", width, height, grid_size, guitar_mode, [&](int i) {
+                    return grid.pointToMidiNote(points_[i]);
+                });
+                grid.prefHexGridMode(true);
+                measure("pointToMidiNote/hex", width, height, grid_size, guitar_mode, [&](int i) {
+                    return grid.pointToMidiNote(points_[i]);
+                });
+            }
+        }
+    }
+
+    // the expression kernels only depend on the grid size
+    for (int grid_size : GRID_SIZES) {
+        GridStrument grid(nullptr);
+        grid.prefGridSize(grid_size);
+        grid.prefPitchBendRange(12);
+        measure("rectToMidiPressure", 0, 0, grid_size, -1, [&](int i) {
+            return grid.rectToMidiPressure(rects_[i]);
+        });
+        measure("pointChangeToPitchBend", 0, 0, grid_size, -1, [&](int i) {
+            POINT delta = { points_[i].x - points_[i ^ 1].x, 0 };
+            return grid.pointChangeToPitchBend(delta);
+        });
+        measure("pointChangeToMidiModulation", 0, 0, grid_size, -1, [&](int i) {
+            POINT delta = { 0, (points_[i].y - points_[i ^ 1].y) / 8 };
+            return grid.pointChangeToMidiModulation(delta);
+        });
+    }
+
+    for (int delay_ms = 0; delay_ms <= 3; delay_ms++) {
+        jitter(delay_ms);
+    }
+
+    for (int voices : OSCILLATOR_VOICES) {
+        for (int block_frames : OSCILLATOR_BLOCKS) {
+            oscillators(voices, block_frames);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string filter;
+    int iterations = 1 << 18;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--filter" && has_value) filter = argv[++i];
+        else if (arg == "--iterations" && has_value) iterations = std::max(1, std::atoi(argv[++i]));
+        else {
+            std::cerr << "usage: GridBench [--filter <kernel substring>] [--iterations N]" << std::endl;
+            return 2;
+        }
+    }
+    // the instrument logs unusual events; keep that out of the timing
+    std::wcout.setstate(std::ios::failbit);
+
+    GridBench bench(filter, iterations);
+    bench.run();
+    return 0;
+}
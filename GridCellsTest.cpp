@@ -0,0 +1,157 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridHex.h"
+#include "GridStrument.h"
+
+#include <cmath>
+#include <iostream>
+
+// ======================================================================
+// GridCellsTest - checks the cells_ table GridStrument builds on resize
+// against gridLocToMidiNote & hexGridLocToMidiNote, for every grid size
+// from 40 to 400, square & hex, with & without guitar mode.  Points
+// across the whole window, including the partial cells along the right
+// & bottom edges that aren't in the table, must map to the same note as
+// the direct calculation.  Exits non-zero on any mismatch.
+//
+// Hex points are checked against referenceHexLoc(), a textbook cube
+// round written here apart from GridHex.cpp, so a rounding bug shared
+// by pointToHexGridLoc() & the table can't pass.
+//
+
+static const int SCREENS[][2] = { { 1366, 768 }, { 1920, 1080 } };
+static const int POINT_STEP = 7;    // pixels between the points checked
+
+// the odd-q offset hex holding a point, for flat topped hexes of radius
+// size with hex 0,0 centred at size, sqrt(3) * size / 2.  Rounds the
+// fractional cube coordinates & fixes up the one furthest from round.
+static void referenceHexLoc(POINT point, int size, int& x, int& y)
+{
+    double px = (point.x - static_cast<double>(size)) / size;
+    double py = (point.y - std::sqrt(3.0) * size / 2) / size;
+    double fq = 2.0 / 3.0 * px;
+    double fr = -1.0 / 3.0 * px + std::sqrt(3.0) / 3.0 * py;
+    double fs = -fq - fr;
+    double q = std::round(fq);
+    double r = std::round(fr);
+    double s = std::round(fs);
+    double dq = std::fabs(q - fq);
+    double dr = std::fabs(r - fr);
+    double ds = std::fabs(s - fs);
+    if (dq > dr && dq > ds) {
+        q = -r - s;
+    }
+    else if (dr > ds) {
+        r = -q - s;
+    }
+    int qi = static_cast<int>(q);
+    x = qi;
+    y = static_cast<int>(r) + (qi - (qi & 1)) / 2;
+}
+
+class GridTest
+{
+    GridStrument& grid_;
+    long long checks_;
+    long long failures_;
+
+    void check(bool ok, const char* what, int size, int x, int y, int got, int want)
+    {
+        checks_++;
+        if (!ok && failures_++ < 20) {
+            std::cerr << what << " mismatch: grid size " << size << (grid_.pref_hex_grid_mode_ ? " hex" : " square")
+                << (grid_.pref_guitar_mode_ ? " guitar" : "") << " at " << x << "," << y
+                << " got " << got << " want " << want << std::endl;
+        }
+    }
+
+    // the note for a point without the table, as before it existed
+    int directNote(POINT point)
+    {
+        int x, y;
+        if (!grid_.pref_hex_grid_mode_) {
+            x = grid_.pointToGridColumn(point);
+            y = grid_.pointToGridRow(point);
+            if (x < 0 || y < 0) {
+                return -1;
+            }
+            return grid_.gridLocToMidiNote(x, y);
+        }
+        referenceHexLoc(point, grid_.pref_grid_size_ / 2, x, y);
+        return hexGridLocToMidiNote(grid_.num_grids_y_, x, y);
+    }
+
+public:
+    explicit GridTest(GridStrument& grid) : grid_(grid), checks_(0), failures_(0) {}
+
+    void checkGrid(int width, int height, int size)
+    {
+        grid_.prefGridSize(size);
+        grid_.resize(width, height);
+        int nx = grid_.num_grids_x_, ny = grid_.num_grids_y_;
+        check(grid_.cells_.size() == static_cast<size_t>(nx) * ny, "table size", size, nx, ny,
+            static_cast<int>(grid_.cells_.size()), nx * ny);
+        for (int y = 0; y < ny; y++) {
+            for (int x = 0; x < nx; x++) {
+                int want = grid_.pref_hex_grid_mode_ ? hexGridLocToMidiNote(ny, x, y) : grid_.gridLocToMidiNote(x, y);
+                int got = grid_.cells_[static_cast<size_t>(y) * nx + x].note;
+                check(got == want, "cell", size, x, y, got, want);
+            }
+        }
+        for (int py = 0; py < height; py += POINT_STEP) {
+            for (int px = 0; px < width; px += POINT_STEP) {
+                POINT point = { px, py };
+                int got = grid_.pointToMidiNote(point);
+                int want = directNote(point);
+                check(got == want, "point", size, px, py, got, want);
+                if (grid_.pref_hex_grid_mode_) {
+                    int x, y, ref_x, ref_y;
+                    pointToHexGridLoc(point, size / 2, x, y);
+                    referenceHexLoc(point, size / 2, ref_x, ref_y);
+                    check(x == ref_x && y == ref_y, "hex", size, px, py, x * 1000 + y, ref_x * 1000 + ref_y);
+                }
+            }
+        }
+    }
+
+    int run()
+    {
+        for (bool hex : { false, true }) {
+            for (bool guitar : { false, true }) {
+                grid_.prefHexGridMode(hex);
+                grid_.prefGuitarMode(guitar);
+                for (const auto& screen : SCREENS) {
+                    for (int size = 40; size <= 400; size++) {
+                        checkGrid(screen[0], screen[1], size);
+                    }
+                }
+            }
+        }
+        std::cout << "GridCellsTest: " << checks_ << " checks, " << failures_ << " failures" << std::endl;
+        return failures_ == 0 ? 0 : 1;
+    }
+};
+
+int main()
+{
+    // the instrument logs sizes & notes on resize; keep the output short
+    std::wcout.setstate(std::ios::failbit);
+    GridStrument grid(nullptr);
+    GridTest test(grid);
+    return test.run();
+}
@@ -0,0 +1,127 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridChannels.h"
+
+#include <algorithm>
+#include <iostream>
+
+// ======================================================================
+GridChannels::GridChannels() :
+    first_(0), count_(0), held_(0), fingers_{}, next_{}, prev_{},
+    free_head_(-1), free_tail_(-1), held_head_(-1), held_tail_(-1),
+    takes_(0), shares_(0), in_use_(0), in_use_max_(0)
+{
+    range(0, 15);
+}
+
+void GridChannels::range(int min, int max)
+{
+    min = std::clamp(min, 0, MAX_CHANNELS - 1);
+    max = std::clamp(max, min, MAX_CHANNELS - 1);
+    if (min == first_ && max - min + 1 == count_) {
+        return;
+    }
+    int old_first = first_;
+    int old_last = last();
+    first_ = min;
+    count_ = max - min + 1;
+    // held channels still in range keep their turn, those coming back
+    // into it go after them
+    int channel = held_head_;
+    free_head_ = free_tail_ = held_head_ = held_tail_ = -1;
+    while (channel >= 0) {
+        int next = next_[channel];
+        if (inRange(channel)) {
+            append(held_head_, held_tail_, channel);
+        }
+        channel = next;
+    }
+    for (channel = first_; channel <= last(); channel++) {
+        if ((held_ & (uint64_t(1) << channel)) == 0) {
+            append(free_head_, free_tail_, channel);
+        }
+        else if (channel < old_first || channel > old_last) {
+            append(held_head_, held_tail_, channel);
+        }
+    }
+}
+
+// ======================================================================
+int GridChannels::take()
+{
+    takes_.fetch_add(1, std::memory_order_relaxed);
+    int channel = free_head_;
+    if (channel >= 0) {
+        unlink(free_head_, free_tail_, channel);
+        held_ |= uint64_t(1) << channel;
+        int in_use = in_use_.load(std::memory_order_relaxed) + 1;
+        in_use_.store(in_use, std::memory_order_relaxed);
+        if (in_use > in_use_max_.load(std::memory_order_relaxed)) {
+            in_use_max_.store(in_use, std::memory_order_relaxed);
+        }
+    }
+    else {
+        // all held: share the one held longest, now the newest taken
+        channel = held_head_;
+        unlink(held_head_, held_tail_, channel);
+        shares_.fetch_add(1, std::memory_order_relaxed);
+    }
+    append(held_head_, held_tail_, channel);
+    fingers_[channel]++;
+    return channel;
+}
+
+// a channel outside the range is on neither list, so just stops being held
+void GridChannels::release(int channel)
+{
+    if (channel < 0 || channel >= MAX_CHANNELS || (held_ & (uint64_t(1) << channel)) == 0) {
+        return;
+    }
+    if (--fingers_[channel] > 0) {
+        return;
+    }
+    held_ &= ~(uint64_t(1) << channel);
+    in_use_.store(in_use_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    if (inRange(channel)) {
+        unlink(held_head_, held_tail_, channel);
+        append(free_head_, free_tail_, channel);
+    }
+}
+
+// ======================================================================
+void GridChannels::unlink(int& head, int& tail, int channel)
+{
+    int prev = prev_[channel];
+    int next = next_[channel];
+    (prev >= 0 ? next_[prev] : head) = next;
+    (next >= 0 ? prev_[next] : tail) = prev;
+}
+
+void GridChannels::append(int& head, int& tail, int channel)
+{
+    prev_[channel] = tail;
+    next_[channel] = -1;
+    (tail >= 0 ? next_[tail] : head) = channel;
+    tail = channel;
+}
+
+void GridChannels::dump()
+{
+    std::wcout << "midi channels " << first_ << " to " << last() << ": " << inUse() << " in use (max "
+        << inUseMax() << "), " << takes() << " taken, " << shares() << " shared while all were held" << std::endl;
+}
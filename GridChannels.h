@@ -0,0 +1,79 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// ======================================================================
+// Hands each new finger a midi channel of its own, so its pitch bend &
+// modulation don't move another finger's note.  It takes the free
+// channel released longest ago, giving that channel's release tail the
+// most time to die away.  When every channel is held it shares the one
+// held longest, whose note is least likely to still be moving.
+//
+// Free channels are a list in release order and held ones a list in the
+// order taken, linked through next_ & prev_, with a bit per channel
+// saying which list it is on.  take() & release() are O(1).  The lists
+// are indexed by channel, so changing the range keeps what fingers hold.
+//
+// Not thread safe, but for the stats; the pointer thread calls the rest.
+//
+class GridChannels
+{
+public:
+    static const int MAX_CHANNELS = 64;
+private:
+    int first_;                 // lowest channel taken
+    int count_;
+    uint64_t held_;             // bit per channel, set while fingers hold it
+    int fingers_[MAX_CHANNELS]; // on each held channel
+    int next_[MAX_CHANNELS];    // -1 ends a list
+    int prev_[MAX_CHANNELS];
+    int free_head_, free_tail_; // released longest ago first
+    int held_head_, held_tail_; // taken longest ago first
+    std::atomic<long long> takes_;
+    std::atomic<long long> shares_;
+    std::atomic<int> in_use_;
+    std::atomic<int> in_use_max_;
+
+    void unlink(int& head, int& tail, int channel);
+    void append(int& head, int& tail, int channel);
+    bool inRange(int channel) { return channel >= first_ && channel < first_ + count_; }
+public:
+    GridChannels();
+
+    // channels min to max, the free ones low first.  Unchanged if the
+    // same.  Channels fingers hold stay held until release()d.  Those
+    // outside the new range are never taken or shared again, so a finger
+    // from before keeps its channel to itself.
+    void range(int min, int max);
+    int first() { return first_; }
+    int last() { return first_ + count_ - 1; }
+
+    // a channel for a new finger
+    int take();
+    // the finger is done with it.  Channels not held are ignored.
+    void release(int channel);
+
+    long long takes() { return takes_.load(std::memory_order_relaxed); }
+    // takes that found every channel held
+    long long shares() { return shares_.load(std::memory_order_relaxed); }
+    int inUse() { return in_use_.load(std::memory_order_relaxed); }
+    int inUseMax() { return in_use_max_.load(std::memory_order_relaxed); }
+    void dump();
+};
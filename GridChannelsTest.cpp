@@ -0,0 +1,267 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridChannels.h"
+#include "GridMidi.h"
+#include "GridRecorder.h"
+#include "GridStrument.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// ======================================================================
+// GridChannelsTest - checks that fingers keep their channels when the
+// channel range changes under them, and that channels past midi's 16
+// only reach the synth, beside the message rather than in it.  Exits
+// non-zero on a failure.
+//
+// The range goes from the synth's 64 channels to midi's 16 and back
+// while 40 fingers hold channels.  No channel may be handed out while a
+// finger holds it, unless all are held, and none outside the range.
+// Then per row channel mode is switched while fingers are down: each
+// finger must release its channel by how it got it, not by the mode.
+//
+
+static const int FINGERS = 40;
+
+// ======================================================================
+class ChannelCheck
+{
+    GridChannels& channels_;
+    std::vector<int> fingers_;      // per channel
+public:
+    std::vector<int> held;          // in the order taken
+    long long failures = 0;
+
+    explicit ChannelCheck(GridChannels& channels) : channels_(channels), fingers_(GridChannels::MAX_CHANNELS) {}
+    void take(bool share) {
+        int channel = channels_.take();
+        bool ok = channel >= channels_.first() && channel <= channels_.last();
+        ok = ok && (fingers_[channel] > 0) == share;
+        if (!ok && failures++ < 10) {
+            std::cerr << "GridChannels: took channel " << channel << (share ? ", want a held one" : ", want a free one")
+                << " in " << channels_.first() << " to " << channels_.last() << std::endl;
+        }
+        if (channel >= 0 && channel < GridChannels::MAX_CHANNELS) {
+            fingers_[channel]++;
+            held.push_back(channel);
+        }
+    }
+    void release(size_t i) {
+        fingers_[held[i]]--;
+        channels_.release(held[i]);
+        held.erase(held.begin() + static_cast<long>(i));
+    }
+};
+
+static int testRange()
+{
+    GridChannels channels;
+    ChannelCheck check(channels);
+    channels.range(0, 63);
+    for (int i = 0; i < FINGERS; i++) {
+        check.take(false);
+    }
+    // 0 to 15 are all held, so new fingers share them
+    channels.range(0, 15);
+    for (int i = 0; i < 4; i++) {
+        check.take(true);
+    }
+    // a finger lifts from a channel now outside the range
+    check.release(20);
+    // back to 64: 20 & 40 up are free, the rest still held
+    channels.range(0, 63);
+    for (int i = FINGERS - 1; i < 64; i++) {
+        check.take(false);
+    }
+    check.take(true);
+    while (!check.held.empty()) {
+        check.release(0);
+    }
+    if (channels.inUse() != 0) {
+        std::cerr << "GridChannels: " << channels.inUse() << " in use after all released" << std::endl;
+        check.failures++;
+    }
+    channels.range(0, 15);
+    for (int i = 0; i < 16; i++) {
+        check.take(false);
+    }
+    std::cout << "GridChannels: " << channels.takes() << " takes, " << check.failures << " failures" << std::endl;
+    return check.failures == 0 ? 0 : 1;
+}
+
+// ======================================================================
+// an immediate sink keeping what it gets, with the channel
+//
+class ChannelSink final : public GridMidiSink
+{
+public:
+    std::vector<uint32_t> messages;
+    std::vector<int> channels;
+    void send(uint32_t message, long long) override {
+        messages.push_back(message);
+        channels.push_back(message & 0x0f);
+    }
+    void sendWide(uint32_t message, int channel, long long) override {
+        messages.push_back(message);
+        channels.push_back(channel);
+    }
+};
+
+static bool isMidi(uint32_t message, int channel)
+{
+    return (message & 0x808000) == 0 && (message & 0x0f) == (channel & 0x0f);
+}
+
+static int testWide()
+{
+    const int WIDE = 37;
+    const char* path = "GridChannelsTest.grec";
+    GridRecorder recorder;
+    GridMidi midi(&recorder);
+    ChannelSink synth;
+    uint32_t captured[16];
+    GridCaptureSink capture(captured, 16);
+    midi.addSink(&synth, true);
+    midi.addSink(&capture);
+    midi.noteOn(WIDE, 60, 127);
+    midi.pitchBend(WIDE, 0x3fff, 60);
+    midi.controlChange(WIDE, 74, 127, 60);
+    midi.polyKeyPressure(WIDE, 60, 127);
+    midi.noteOn(WIDE, 60, 0);
+    midi.noteOn(5, 60, 127);
+
+    long long failures = 0;
+    if (capture.count() != 1 || (captured[0] & 0xff) != MIDI::NOTE_ON + 5) {
+        std::cerr << "GridMidi: " << capture.count() << " messages to midi, want only channel 5's" << std::endl;
+        failures++;
+    }
+    for (size_t i = 0; i < synth.messages.size(); i++) {
+        int want = (i + 1 < synth.messages.size()) ? WIDE : 5;
+        if ((synth.channels[i] != want || !isMidi(synth.messages[i], want)) && failures++ < 10) {
+            std::cerr << "GridMidi: synth got " << std::hex << synth.messages[i] << std::dec
+                << " on channel " << synth.channels[i] << ", want channel " << want << std::endl;
+        }
+    }
+
+    // the flight recorder keeps the channel, for GridRender
+    std::string header;
+    std::vector<GridRecord> records;
+    if (!recorder.dump(path, "") || !GridRecorder::load(path, header, records) || records.size() != 6) {
+        std::cerr << "GridRecorder: " << records.size() << " records back, want 6" << std::endl;
+        failures++;
+    }
+    for (size_t i = 0; i < records.size(); i++) {
+        int want = (i + 1 < records.size()) ? WIDE : 5;
+        if ((records[i].channel != want || !isMidi(records[i].message, want)) && failures++ < 10) {
+            std::cerr << "GridRecorder: record " << i << " on channel " << records[i].channel
+                << ", want " << want << std::endl;
+        }
+    }
+    std::remove(path);
+    std::cout << "GridMidi: " << synth.messages.size() << " messages to the synth, " << failures << " failures" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
+
+// ======================================================================
+class Fingers
+{
+    GridStrument& grid_;
+public:
+    explicit Fingers(GridStrument& grid) : grid_(grid) {}
+    // finger id, in column id % 16 & row id % 4
+    void down(int id) {
+        POINT point = { 50 + 100 * (id % 16), 50 + 100 * (id % 4) };
+        RECT rect = { point.x - 10, point.y - 10, point.x + 10, point.y + 10 };
+        grid_.pointerDown(id, rect, point, 512);
+    }
+    void down(int first, int last) {
+        for (int id = first; id <= last; id++) {
+            down(id);
+        }
+    }
+    void up(int first, int last) {
+        for (int id = first; id <= last; id++) {
+            grid_.pointerUp(id);
+        }
+    }
+};
+
+static void setUp(GridStrument& grid)
+{
+    grid.prefHexGridMode(false);
+    grid.prefGridSize(100);
+    grid.prefMidiChannelRange(0, 15);
+    grid.resize(1920, 1080);
+}
+
+static int expectInUse(GridStrument& grid, int in_use, const char* when)
+{
+    if (grid.channels().inUse() == in_use) {
+        return 0;
+    }
+    std::cerr << "GridStrument: " << grid.channels().inUse() << " channels in use " << when
+        << ", want " << in_use << std::endl;
+    return 1;
+}
+
+static int testModeSwitch()
+{
+    int failures = 0;
+    {
+        // taken channels lifted in per row mode still go back
+        GridStrument grid(nullptr);
+        setUp(grid);
+        Fingers fingers(grid);
+        fingers.down(0, 3);
+        grid.prefChannelPerRowMode(true);
+        fingers.down(4, 7);
+        fingers.up(0, 3);
+        failures += expectInUse(grid, 0, "after lifting taken fingers in per row mode");
+        fingers.up(4, 7);
+    }
+    {
+        // per row channels lifted after leaving the mode don't free taken ones
+        GridStrument grid(nullptr);
+        setUp(grid);
+        Fingers fingers(grid);
+        grid.prefChannelPerRowMode(true);
+        fingers.down(0, 3);
+        grid.prefChannelPerRowMode(false);
+        fingers.down(4, 19);
+        failures += expectInUse(grid, 16, "with every channel taken");
+        fingers.up(0, 3);
+        failures += expectInUse(grid, 16, "after lifting per row fingers");
+        fingers.up(4, 19);
+        failures += expectInUse(grid, 0, "after lifting all");
+    }
+    std::cout << "GridStrument: per row mode switches, " << failures << " failures" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
+
+int main()
+{
+    // the instrument logs sizes & notes on resize; keep the output short
+    std::wcout.setstate(std::ios::failbit);
+    int failed = testRange();
+    failed |= testModeSwitch();
+    failed |= testWide();
+    return failed;
+}
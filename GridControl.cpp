@@ -0,0 +1,136 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridControl.h"
+#include "GridLatency.h"
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#endif
+#include <chrono>
+
+// ======================================================================
+// Constructor does not start the thread.  Call start() once the
+// GridStrument has its initial preferences.
+//
+GridControl::GridControl(GridStrument* gridStrument)
+{
+    grid_strument_ = gridStrument;
+    running_ = false;
+}
+
+GridControl::~GridControl()
+{
+    stop();
+}
+
+// ======================================================================
+// start the control thread
+//
+void GridControl::start()
+{
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    thread_ = std::thread(&GridControl::run, this);
+#ifdef _WIN32
+    SetThreadPriority(thread_.native_handle(), THREAD_PRIORITY_TIME_CRITICAL);
+    // 1ms timer resolution so coalesced midi is flushed on time
+    timeBeginPeriod(1);
+#endif
+}
+
+// ======================================================================
+// stop the control thread after it has handled any queued samples
+//
+void GridControl::stop()
+{
+    if (!running_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(wake_mutex_);
+        running_ = false;
+    }
+    wake_.notify_one();
+    thread_.join();
+#ifdef _WIN32
+    timeEndPeriod(1);
+#endif
+}
+
+// ======================================================================
+// called by the UI thread to hand a frame of touch samples to the control
+// thread.  We never drop a sample.  If the queue is full, wait for room.
+//
+void GridControl::push(const TouchSample* samples, int count)
+{
+    for (int i = 0; i < count; i++) {
+        while (!queue_.push(samples[i])) {
+            std::this_thread::yield();
+        }
+    }
+    {
+        // empty lock so we cannot notify between the thread's check
+        // of the queue and its wait.
+        std::lock_guard<std::mutex> lk(wake_mutex_);
+    }
+    wake_.notify_one();
+}
+
+// ======================================================================
+// control thread main loop.  Sleep until samples arrive, then hand all
+// that are queued to the GridStrument as one batch while holding the
+// state lock.  While coalesced midi is pending, wake up when it is due.
+//
+void GridControl::run()
+{
+    TouchSample batch[BATCH_SIZE];
+    for (;;) {
+        int count = 0;
+        while (count < BATCH_SIZE && queue_.pop(batch[count])) {
+            count++;
+        }
+        if (count == 0) {
+            long long flush_time;
+            {
+                std::lock_guard<std::mutex> state_lock(state_mutex_);
+                grid_strument_->midiTick(GridClock::now());
+                flush_time = grid_strument_->midiFlushTime();
+            }
+            std::unique_lock<std::mutex> lk(wake_mutex_);
+            if (!running_ && queue_.empty()) {
+                break;
+            }
+            auto ready = [this] { return !running_ || !queue_.empty(); };
+            if (flush_time == 0) {
+                wake_.wait(lk, ready);
+            }
+            else {
+                long long ns = GridClock::ticksToNanoseconds(flush_time - GridClock::now());
+                wake_.wait_for(lk, std::chrono::nanoseconds(ns), ready);
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> state_lock(state_mutex_);
+        grid_strument_->pointerFrame(batch, count);
+        grid_strument_->publishPointers();
+    }
+    std::lock_guard<std::mutex> state_lock(state_mutex_);
+    grid_strument_->midiFlush();
+}
@@ -0,0 +1,57 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#pragma once
+#include "GridQueue.h"
+#include "GridStrument.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// ======================================================================
+// Real-time control thread.  The window procedure push()es frames of raw
+// touch samples and this thread owns the GridStrument note & MIDI state,
+// turning samples into MIDI output.  This keeps a slow repaint on the
+// UI thread from delaying notes.
+//
+// Anything else that changes GridStrument state (resize, preferences,
+// midi device) must hold lock() while it does so.
+//
+class GridControl
+{
+    static const size_t QUEUE_SIZE = 1024;
+    static const int BATCH_SIZE = 256;
+    GridStrument* grid_strument_;
+    GridQueue<TouchSample, QUEUE_SIZE> queue_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+    std::mutex state_mutex_;          // held while GridStrument is being changed
+    std::mutex wake_mutex_;           // only used to sleep/wake the thread
+    std::condition_variable wake_;
+
+    void run();
+public:
+    GridControl(GridStrument* gridStrument);
+    ~GridControl();
+
+    void start();
+    void stop();
+    void push(const TouchSample* samples, int count);
+    std::unique_lock<std::mutex> lock() { return std::unique_lock<std::mutex>(state_mutex_); }
+};
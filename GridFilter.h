@@ -0,0 +1,65 @@
+#pragma once
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include <cmath>
+
+// ======================================================================
+// One Euro filter (Casiez, Roussel & Vogel, CHI 2012).  A low-pass
+// filter whose cutoff rises with the speed of the signal, so a slow
+// vibrato is smoothed of touch jitter while a fast slide stays
+// responsive.  Cutoffs are in Hz, beta in Hz per unit/second.  The
+// speed estimate uses the paper's fixed 1Hz cutoff.
+//
+struct GridFilterParams
+{
+    float min_cutoff;   // cutoff when still
+    float beta;         // cutoff increase with speed
+};
+
+class GridFilter
+{
+    float value_;       // filtered value
+    float deriv_;       // filtered speed
+public:
+    // per-sample terms shared by all the values filtered for one sample,
+    // so the filter itself only needs one divide.
+    struct Step
+    {
+        float dt;       // seconds since the previous sample
+        float inv_dt;
+        float alpha_d;  // smoothing for the speed estimate
+        explicit Step(float dt_) : dt(dt_), inv_dt(1.0f / dt_), alpha_d(alpha(1.0f, dt_)) {}
+    };
+
+    // smoothing factor for a cutoff, 1 / (1 + tau/dt) with one divide
+    static float alpha(float cutoff, float dt) {
+        const float TWO_PI = 6.2831853f;
+        float r = TWO_PI * cutoff * dt;
+        return r / (r + 1.0f);
+    }
+
+    void reset(float value) { value_ = value; deriv_ = 0.0f; }
+    float value() { return value_; }
+    float filter(float x, const Step& step, const GridFilterParams& params) {
+        float deriv = (x - value_) * step.inv_dt;
+        deriv_ += step.alpha_d * (deriv - deriv_);
+        float cutoff = params.min_cutoff + params.beta * std::fabs(deriv_);
+        value_ += alpha(cutoff, step.dt) * (x - value_);
+        return value_;
+    }
+};
@@ -0,0 +1,180 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridMidi.h"
+#include "GridStrument.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+// ======================================================================
+// GridFrameTest - checks that a frame of touch samples with history, N
+// fingers by M samples each, through pointerFrame() makes the same midi
+// as the same samples given one at a time, in time order, to
+// pointerDown/Update/Up.  Frames list each finger's history newest
+// first, as Windows does, so pointerFrame() has to sort them.
+//
+// Both instruments get the same event times, which the expression
+// filter uses.  Every message to an immediate sink must match exactly.
+// The coalesced output sends fewer expression messages from a frame, so
+// only its note ons & offs are compared.  Exits non-zero on a mismatch.
+//
+
+static const int MAX_FINGERS = 10;
+static const int MAX_HISTORY = 8;
+static const int FRAMES = 20;
+static const long long FRAME_TICKS = 1000;
+
+class GridTest
+{
+    GridStrument& grid_;
+public:
+    explicit GridTest(GridStrument& grid) : grid_(grid) {}
+    // what pointerFrame() does per sample, without the frame
+    void sample(const TouchSample& sample) {
+        grid_.event_time_ = sample.time;
+        grid_.midi_device_->eventTime(sample.time);
+        switch (sample.type) {
+        case TouchType::DOWN:
+            grid_.pointerDown(sample.id, sample.rect, sample.point, sample.pressure);
+            break;
+        case TouchType::UPDATE:
+            grid_.pointerUpdate(sample.id, sample.rect, sample.point, sample.pressure);
+            break;
+        case TouchType::UP:
+            grid_.pointerUp(sample.id);
+            break;
+        }
+    }
+};
+
+// ======================================================================
+// the frames of a session: all fingers down, FRAMES of history, all up
+//
+static std::vector<std::vector<TouchSample>> makeFrames(int fingers, int history)
+{
+    uint32_t seed = 2020;
+    auto rnd = [&seed](int n) {
+        seed = seed * 1664525u + 1013904223u;
+        return static_cast<int>((seed >> 8) % static_cast<uint32_t>(n));
+    };
+    POINT points[MAX_FINGERS];
+    std::vector<std::vector<TouchSample>> frames;
+    for (int frame = 0; frame < FRAMES + 2; frame++) {
+        std::vector<TouchSample> samples;
+        long long frame_time = (frame + 1) * FRAME_TICKS;
+        int count = (frame == 0 || frame == FRAMES + 1) ? 1 : history;
+        for (int f = 0; f < fingers; f++) {
+            for (int k = count - 1; k >= 0; k--) {
+                TouchType type = (frame == 0) ? TouchType::DOWN : (frame == FRAMES + 1) ? TouchType::UP : TouchType::UPDATE;
+                if (frame == 0) {
+                    points[f] = { 100 + rnd(1700), 100 + rnd(880) };
+                }
+                POINT point = { points[f].x + k * (rnd(21) - 10), points[f].y + k * (rnd(21) - 10) };
+                int size = 15 + rnd(30);
+                RECT rect = { point.x - size, point.y - size, point.x + size, point.y + size };
+                long long time = frame_time + static_cast<long long>(k) * fingers + f;
+                samples.push_back({ type, time, 100 + f, rect, point, 512 });
+            }
+            points[f].x += (rnd(41) - 20) * count;
+            points[f].y += (rnd(41) - 20) * count;
+        }
+        frames.push_back(samples);
+    }
+    return frames;
+}
+
+static bool isNote(uint32_t message)
+{
+    return (message & 0xf0) == MIDI::NOTE_ON;
+}
+
+// ======================================================================
+static int compare(int fingers, int history, bool filter)
+{
+    std::vector<std::vector<TouchSample>> frames = makeFrames(fingers, history);
+    size_t num_samples = 0;
+    for (const auto& frame : frames) {
+        num_samples += frame.size();
+    }
+    GridStrument framed(nullptr), single(nullptr);
+    std::vector<uint32_t> framed_now(4 * num_samples), single_now(4 * num_samples);
+    std::vector<uint32_t> framed_out(4 * num_samples), single_out(4 * num_samples);
+    GridCaptureSink framed_now_sink(framed_now.data(), framed_now.size());
+    GridCaptureSink single_now_sink(single_now.data(), single_now.size());
+    GridCaptureSink framed_out_sink(framed_out.data(), framed_out.size());
+    GridCaptureSink single_out_sink(single_out.data(), single_out.size());
+    for (GridStrument* grid : { &framed, &single }) {
+        grid->prefExpressionFilter(filter);
+        grid->resize(1920, 1080);
+    }
+    framed.midiOutput()->addSink(&framed_now_sink, true);
+    framed.midiOutput()->addSink(&framed_out_sink);
+    single.midiOutput()->addSink(&single_now_sink, true);
+    single.midiOutput()->addSink(&single_out_sink);
+
+    GridTest test(single);
+    for (auto& frame : frames) {
+        std::vector<TouchSample> sorted = frame;
+        std::stable_sort(sorted.begin(), sorted.end(),
+            [](const TouchSample& a, const TouchSample& b) { return a.time < b.time; });
+        for (const TouchSample& sample : sorted) {
+            test.sample(sample);
+        }
+        framed.pointerFrame(frame.data(), static_cast<int>(frame.size()));
+    }
+    single.midiFlush();
+
+    int failures = 0;
+    if (framed_now_sink.size() != single_now_sink.size() ||
+        !std::equal(framed_now.begin(), framed_now.begin() + framed_now_sink.size(), single_now.begin())) {
+        std::cerr << fingers << " fingers x " << history << " samples, filter " << filter << ": "
+            << framed_now_sink.size() << " immediate messages from frames, " << single_now_sink.size()
+            << " from single samples, or they differ" << std::endl;
+        failures++;
+    }
+    std::vector<uint32_t> framed_notes, single_notes;
+    std::copy_if(framed_out.begin(), framed_out.begin() + framed_out_sink.size(), std::back_inserter(framed_notes), isNote);
+    std::copy_if(single_out.begin(), single_out.begin() + single_out_sink.size(), std::back_inserter(single_notes), isNote);
+    if (framed_notes != single_notes || framed_notes.size() != 2 * static_cast<size_t>(fingers)) {
+        std::cerr << fingers << " fingers x " << history << " samples, filter " << filter << ": "
+            << framed_notes.size() << " notes from frames, " << single_notes.size()
+            << " from single samples, or they differ" << std::endl;
+        failures++;
+    }
+    return failures;
+}
+
+int main()
+{
+    std::wcout.setstate(std::ios::failbit);
+    int failures = 0;
+    int cases = 0;
+    for (bool filter : { false, true }) {
+        for (int fingers = 1; fingers <= MAX_FINGERS; fingers++) {
+            for (int history = 1; history <= MAX_HISTORY; history++) {
+                failures += compare(fingers, history, filter);
+                cases++;
+            }
+        }
+    }
+    std::cout << "GridFrameTest: " << cases << " cases, " << failures << " failures" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
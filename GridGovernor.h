@@ -0,0 +1,110 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#pragma once
+#include <algorithm>
+
+// ======================================================================
+// How far the synth has cut back to keep up.  Each level keeps the cuts
+// of the ones before it.
+//
+enum class GovernorLevel {
+    FULL = 0,       // nothing cut
+    POLYPHONY,      // fewer voices, note ons past the lower limit refused
+    RELEASED,       // also cut short the quietest released voices
+    NO_EFFECTS,     // also bypass reverb & chorus
+    MAXIMUM
+};
+
+// ======================================================================
+// Picks the level from the load of each rendered block, the time it took
+// to render over the time it plays for.  The load rises at once and
+// falls with a quarter second time constant.  Above high it steps down a
+// level, at most every down_seconds, and once it has stayed below low
+// for up_seconds it steps back up one.  The gap between high & low and
+// the longer wait to step up keep it from flapping, and a step up that
+// has to be undone within up_seconds doubles the wait for the next, up
+// to MAX_UP_SECONDS, until it is back to FULL.
+//
+class GridGovernor
+{
+public:
+    static constexpr double FALL_SECONDS = 0.25;
+    static constexpr double MAX_UP_SECONDS = 32.0;
+private:
+    double high_;
+    double low_;
+    double down_seconds_;
+    double up_seconds_;
+    double up_wait_;        // seconds, up_seconds_ or more after undone steps
+    double load_;           // smoothed
+    double since_step_;     // seconds
+    double calm_;           // seconds below low_
+    bool stepped_up_;       // the last step
+    GovernorLevel level_;
+    long long steps_down_;
+    long long steps_up_;
+public:
+    explicit GridGovernor(double high = 0.8, double low = 0.5, double down_seconds = 0.1, double up_seconds = 2.0) :
+        high_(high), low_(low), down_seconds_(down_seconds), up_seconds_(up_seconds), up_wait_(up_seconds),
+        load_(0.0), since_step_(0.0), calm_(0.0), stepped_up_(false), level_(GovernorLevel::FULL),
+        steps_down_(0), steps_up_(0)
+    {}
+
+    // a block of this many seconds took load of them to render.  True if
+    // the level changed.
+    bool update(double load, double seconds) {
+        if (load > load_) {
+            load_ = load;
+        }
+        else {
+            load_ += (load - load_) * std::min(1.0, seconds / FALL_SECONDS);
+        }
+        since_step_ += seconds;
+        calm_ = (load_ < low_) ? calm_ + seconds : 0.0;
+
+        int level = static_cast<int>(level_);
+        if (load_ > high_ && since_step_ >= down_seconds_ && level_ != GovernorLevel::NO_EFFECTS) {
+            if (stepped_up_ && since_step_ < up_seconds_) {
+                up_wait_ = std::min(2.0 * up_wait_, MAX_UP_SECONDS);
+            }
+            level_ = static_cast<GovernorLevel>(level + 1);
+            stepped_up_ = false;
+            steps_down_++;
+        }
+        else if (calm_ >= up_wait_ && level_ != GovernorLevel::FULL) {
+            level_ = static_cast<GovernorLevel>(level - 1);
+            stepped_up_ = true;
+            steps_up_++;
+            calm_ = 0.0;
+        }
+        else {
+            if (level_ == GovernorLevel::FULL && calm_ >= up_wait_) {
+                up_wait_ = up_seconds_;
+            }
+            return false;
+        }
+        since_step_ = 0.0;
+        return true;
+    }
+
+    GovernorLevel level() { return level_; }
+    double load() { return load_; }
+    double high() { return high_; }
+    long long stepsDown() { return steps_down_; }
+    long long stepsUp() { return steps_up_; }
+};
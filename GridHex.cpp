@@ -0,0 +1,294 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridHex.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// ======================================================================
+// hex notes
+// https://www.redblobgames.com/grids/hexagons/
+// https://www.redblobgames.com/grids/hexagons/implementation.html
+// q (flat top, instead of r pointy top) orientation matches
+//    https://en.wikipedia.org/wiki/Harmonic_table_note_layout
+// odd-q puts 0,0 in upper left corner.  let's use that
+// 
+
+// Code below based on 
+// Generated code -- CC0 -- No Rights Reserved -- http://www.redblobgames.com/grids/hexagons/
+//
+
+struct Point
+{
+    const double x;
+    const double y;
+    Point(double x_, double y_) : x(x_), y(y_) {}
+};
+
+// These are cube coords, our native is offset coords (see below)
+// we need to convert from Offset to Hex 
+struct Hex
+{
+    const int q;
+    const int r;
+    const int s;
+    Hex(int q_, int r_, int s_) : q(q_), r(r_), s(s_) {
+        if (q + r + s != 0) throw "q + r + s must be 0";
+    }
+};
+
+struct FractionalHex
+{
+    const double q;
+    const double r;
+    const double s;
+    FractionalHex(double q_, double r_, double s_) : q(q_), r(r_), s(s_) {
+        if (round(q + r + s) != 0) throw "q + r + s must be 0";
+    }
+};
+
+struct OffsetCoord
+{
+    const int col;
+    const int row;
+    OffsetCoord(int col_, int row_) : col(col_), row(row_) {}
+};
+
+struct FractionalOffsetCoord
+{
+    const double col;
+    const double row;
+    FractionalOffsetCoord(double col_, double row_) : col(col_), row(row_) {}
+};
+
+struct Orientation
+{
+    const double f0;
+    const double f1;
+    const double f2;
+    const double f3;
+    const double b0;
+    const double b1;
+    const double b2;
+    const double b3;
+    const double start_angle;
+    Orientation(double f0_, double f1_, double f2_, double f3_, double b0_, double b1_, double b2_, double b3_, double start_angle_) : f0(f0_), f1(f1_), f2(f2_), f3(f3_), b0(b0_), b1(b1_), b2(b2_), b3(b3_), start_angle(start_angle_) {}
+};
+
+struct Layout
+{
+    const Orientation orientation;
+    const Point size;
+    const Point origin;
+    Layout(Orientation orientation_, Point size_, Point origin_) : orientation(orientation_), size(size_), origin(origin_) {}
+};
+
+const Orientation flat_orientation = Orientation(3.0 / 2.0, 0.0, sqrt(3.0) / 2.0, sqrt(3.0), 2.0 / 3.0, 0.0, -1.0 / 3.0, sqrt(3.0) / 3.0, 0.0);
+
+Point hex_to_pixel(Layout layout, Hex h)
+{
+    Orientation M = layout.orientation;
+    Point size = layout.size;
+    Point origin = layout.origin;
+    double x = (M.f0 * h.q + M.f1 * h.r) * size.x;
+    double y = (M.f2 * h.q + M.f3 * h.r) * size.y;
+    return Point(x + origin.x, y + origin.y);
+}
+
+FractionalHex pixel_to_hex(Layout layout, Point p)
+{
+    Orientation M = layout.orientation;
+    Point size = layout.size;
+    Point origin = layout.origin;
+    Point pt = Point((p.x - origin.x) / size.x, (p.y - origin.y) / size.y);
+    double q = M.b0 * pt.x + M.b1 * pt.y;
+    double r = M.b2 * pt.x + M.b3 * pt.y;
+    return FractionalHex(q, r, -q - r);
+}
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+Point hex_corner_offset(Layout layout, int corner) {
+    Point size = layout.size;
+    double angle = 2.0 * M_PI *
+        (layout.orientation.start_angle + corner) / 6;
+    return Point(size.x * cos(angle), size.y * sin(angle));
+}
+
+std::vector<Point> polygon_corners(Layout layout, Hex h) {
+    std::vector<Point> corners = {};
+    Point center = hex_to_pixel(layout, h);
+    for (int i = 0; i < 6; i++) {
+        Point offset = hex_corner_offset(layout, i);
+        corners.push_back(Point(center.x + offset.x,
+            center.y + offset.y));
+    }
+    return corners;
+}
+
+const double EVEN = 1;
+const double ODD = -1;
+OffsetCoord qoffset_from_cube(int offset, Hex h)
+{
+    int col = h.q;
+    int row = h.r + int((h.q + offset * (h.q & 1)) / 2);
+    if (offset != EVEN && offset != ODD)
+    {
+        throw "offset must be EVEN (+1) or ODD (-1)";
+    }
+    return OffsetCoord(col, row);
+}
+FractionalOffsetCoord qoffset_from_cube(double offset, FractionalHex h)
+{
+    double col = h.q;
+    double odd_q = static_cast<int>(h.q) & 1 ? 1 : 0;
+    double row = h.r + int((h.q + offset * odd_q) / 2);
+    if (offset != EVEN && offset != ODD)
+    {
+        throw "offset must be EVEN (+1) or ODD (-1)";
+    }
+    return FractionalOffsetCoord(col, row);
+}
+
+Hex qoffset_to_cube(int offset, OffsetCoord h)
+{
+    int q = h.col;
+    int r = h.row - int((h.col + offset * (h.col & 1)) / 2);
+    int s = -q - r;
+    if (offset != EVEN && offset != ODD)
+    {
+        throw "offset must be EVEN (+1) or ODD (-1)";
+    }
+    return Hex(q, r, s);
+}
+
+Hex hex_round(FractionalHex h)
+{
+    int qi = int(round(h.q));
+    int ri = int(round(h.r));
+    int si = int(round(h.s));
+    double q_diff = std::fabs(qi - h.q);
+    double r_diff = std::fabs(ri - h.r);
+    double s_diff = std::fabs(si - h.s);
+    if (q_diff > r_diff && q_diff > s_diff)
+    {
+        qi = -ri - si;
+    }
+    else
+        if (r_diff > s_diff)
+        {
+            ri = -qi - si;
+        }
+        else
+        {
+            si = -qi - ri;
+        }
+    return Hex(qi, ri, si);
+}
+
+// ======================================================================
+// "public" methods for dealing with hex grids, see GridHex.h
+// FIXME - refactor this to be more object-oriented instead of functional
+void hexGetNumGrids(int screen_width, int screen_height, int grid_size, int& num_grids_x, int& num_grids_y)
+{
+    Layout l = Layout(flat_orientation, Point(grid_size, grid_size), Point(grid_size, sqrt(3) * grid_size / 2));
+    FractionalHex fh = pixel_to_hex(l, Point(screen_width, screen_height));
+    FractionalOffsetCoord oc = qoffset_from_cube(ODD, fh);
+    num_grids_x = static_cast<int>(oc.col);
+    num_grids_y = static_cast<int>(oc.row);
+}
+
+int hexGridLocToMidiNote(int num_grids_y, int x, int y)
+{
+    // Y-Delta is like the X row size in normal array index math
+    // It is fixed at 7 to match going up by musical *fifths*
+    int Y_DELTA = 7;
+    // Y-invert so up is higher note.  Grid Y ranges from 0..(num-1)
+    y = num_grids_y - 1 - y;
+    int center_y = num_grids_y / 2;
+    int note;
+    if ((x & 1) == 0) {
+        // EVEN: put 55 or guitar's 4th string open G on left in middle
+        int offset = 55 - (0 + center_y * Y_DELTA);
+        x = x / 2;
+        note = offset + x + y * Y_DELTA;
+    }
+    else {
+        // ODD: put E-below-G as left-middle offset for odd strings
+        // (so E + minor third = G)
+        // g f# f e = 55 54 53 52
+        int offset = 52 - (0 + center_y * Y_DELTA);
+        x = (x - 1) / 2;
+        note = offset + x + y * Y_DELTA;
+    }
+    note = std::clamp(note, 0, 127);
+    return note;
+
+}
+
+void hexGridLocToPoint(int grid_size, int x, int y, float& point_x, float& point_y)
+{
+    OffsetCoord oc = OffsetCoord(x, y);
+    Hex h = qoffset_to_cube((int)ODD, oc);
+    Layout l = Layout(flat_orientation, Point(grid_size, grid_size), Point(grid_size, sqrt(3) * grid_size / 2));
+    Point center = hex_to_pixel(l, h);
+    point_x = static_cast<float>(center.x);
+    point_y = static_cast<float>(center.y);
+}
+
+void hexGridLocCorners(int grid_size, int x, int y, float corners_x[6], float corners_y[6])
+{
+    OffsetCoord oc = OffsetCoord(x, y);
+    Hex h = qoffset_to_cube((int)ODD, oc);
+    Layout l = Layout(flat_orientation, Point(grid_size, grid_size), Point(grid_size, sqrt(3) * grid_size / 2));
+    std::vector<Point> points = polygon_corners(l, h);
+    for (int i = 0; i < 6; i++) {
+        corners_x[i] = static_cast<float>(points[i].x);
+        corners_y[i] = static_cast<float>(points[i].y);
+    }
+}
+
+void pointToHexGridLoc(POINT point, int grid_size, int& x, int& y)
+{
+    // This is pixel_to_hex, hex_round & qoffset_from_cube unrolled so we
+    // don't construct a Layout & validate Hex objects on every touch.
+    static const double SQRT3 = sqrt(3.0);
+    const Orientation& M = flat_orientation;
+    double px = (point.x - static_cast<double>(grid_size)) / grid_size;
+    double py = (point.y - SQRT3 * grid_size / 2) / grid_size;
+    double fq = M.b0 * px + M.b1 * py;
+    double fr = M.b2 * px + M.b3 * py;
+    double fs = -fq - fr;
+    int q = int(round(fq));
+    int r = int(round(fr));
+    int s = int(round(fs));
+    double q_diff = std::fabs(q - fq);
+    double r_diff = std::fabs(r - fr);
+    double s_diff = std::fabs(s - fs);
+    if (q_diff > r_diff && q_diff > s_diff) {
+        q = -r - s;
+    }
+    else if (r_diff > s_diff) {
+        r = -q - s;
+    }
+    // odd-q offset coords
+    x = q;
+    y = r + int((q + (int)ODD * (q & 1)) / 2);
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#pragma once
+#include "GridPlatform.h"
+
+// ======================================================================
+// "public" methods for dealing with hex grids.  grid_size is the hex
+// radius (half of the preference grid size).  Grid locations are odd-q
+// offset coordinates with 0,0 in the upper left corner.
+// FIXME - refactor this to be more object-oriented instead of functional
+//
+void hexGetNumGrids(int screen_width, int screen_height, int grid_size, int& num_grids_x, int& num_grids_y);
+int hexGridLocToMidiNote(int num_grids_y, int x, int y);
+void hexGridLocToPoint(int grid_size, int x, int y, float& point_x, float& point_y);
+void hexGridLocCorners(int grid_size, int x, int y, float corners_x[6], float corners_y[6]);
+void pointToHexGridLoc(POINT point, int grid_size, int& x, int& y);
@@ -0,0 +1,187 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridLatency.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <chrono>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <iomanip>
+#include <iostream>
+
+// ======================================================================
+// clock
+//
+#ifdef _WIN32
+long long GridClock::now()
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+long long GridClock::ticksPerSecond()
+{
+    static long long frequency = 0;
+    if (frequency == 0) {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        frequency = f.QuadPart;
+    }
+    return frequency;
+}
+#else
+long long GridClock::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long long GridClock::ticksPerSecond()
+{
+    return 1000000000LL;
+}
+#endif
+
+long long GridClock::ticksToNanoseconds(long long ticks)
+{
+    static const double ns_per_tick = 1.0e9 / ticksPerSecond();
+    return static_cast<long long>(ticks * ns_per_tick);
+}
+
+// ======================================================================
+// index of highest set bit.  value must be > 0
+//
+static int highestBit(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return static_cast<int>(index);
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+// ======================================================================
+// histogram
+//
+GridHistogram::GridHistogram()
+{
+    reset();
+}
+
+void GridHistogram::reset()
+{
+    for (auto& b : buckets_) {
+        b.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+// values below SUB_COUNT get their own bucket.  Above that, each power
+// of 2 is split into HALF_COUNT linear buckets.
+int GridHistogram::bucketIndex(uint64_t value)
+{
+    if (value < SUB_COUNT) {
+        return static_cast<int>(value);
+    }
+    int shift = highestBit(value) - SUB_BITS + 1;   // >= 1
+    if (shift > MAX_SHIFT) {
+        return NUM_BUCKETS - 1;
+    }
+    int mantissa = static_cast<int>(value >> shift); // HALF_COUNT..SUB_COUNT-1
+    return SUB_COUNT + (shift - 1) * HALF_COUNT + (mantissa - HALF_COUNT);
+}
+
+// highest value that lands in this bucket
+uint64_t GridHistogram::bucketValue(int index)
+{
+    if (index < SUB_COUNT) {
+        return static_cast<uint64_t>(index);
+    }
+    int k = index - SUB_COUNT;
+    int shift = k / HALF_COUNT + 1;
+    uint64_t mantissa = static_cast<uint64_t>(k % HALF_COUNT + HALF_COUNT);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void GridHistogram::record(long long nanoseconds)
+{
+    uint64_t value = nanoseconds > 0 ? static_cast<uint64_t>(nanoseconds) : 0;
+    buckets_[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    uint64_t cur_max = max_.load(std::memory_order_relaxed);
+    while (value > cur_max && !max_.compare_exchange_weak(cur_max, value, std::memory_order_relaxed)) {
+    }
+}
+
+// value at or below which percent (0..100) of the recorded values fall.
+// Only approximate while other threads are recording.
+uint64_t GridHistogram::percentile(double percent)
+{
+    uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t target = static_cast<uint64_t>(percent / 100.0 * total + 0.5);
+    if (target < 1) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            uint64_t value = bucketValue(i);
+            uint64_t cur_max = max();
+            return value < cur_max ? value : cur_max;
+        }
+    }
+    return max();
+}
+
+// ======================================================================
+// write p50/p99/p999/max for every stage to the log in microseconds
+//
+void GridLatency::dump()
+{
+    static const wchar_t* names[] = { L"ingest", L"note mapping", L"midi send", L"synth enqueue" };
+    std::wcout << "latency (us)      count      p50      p99     p999      max" << std::endl;
+    for (int i = 0; i < static_cast<int>(LatencyStage::MAXIMUM); i++) {
+        GridHistogram& h = stages_[i];
+        std::wcout << std::left << std::setw(14) << names[i] << std::right
+            << std::setw(10) << h.count()
+            << std::fixed << std::setprecision(1)
+            << std::setw(9) << h.percentile(50.0) / 1000.0
+            << std::setw(9) << h.percentile(99.0) / 1000.0
+            << std::setw(9) << h.percentile(99.9) / 1000.0
+            << std::setw(9) << h.max() / 1000.0
+            << std::defaultfloat << std::endl;
+    }
+}
+
+void GridLatency::reset()
+{
+    for (auto& h : stages_) {
+        h.reset();
+    }
+}
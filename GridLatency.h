@@ -0,0 +1,83 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// ======================================================================
+// Timestamps in the same units as the OS touch timestamps.  On Windows
+// that is the QueryPerformanceCounter used for pointerInfo.PerformanceCount,
+// elsewhere a monotonic clock in nanoseconds.
+//
+namespace GridClock {
+    long long now();
+    long long ticksPerSecond();
+    long long ticksToNanoseconds(long long ticks);
+};
+
+// ======================================================================
+// Lock-free HDR-style latency histogram.  Values are nanoseconds, kept
+// in log-linear buckets with about 3% resolution up to ~18 minutes.
+// record() only does relaxed atomic adds, so it is safe from any thread,
+// never allocates and is cheap enough to leave on in release builds.
+//
+class GridHistogram
+{
+public:
+    static const int SUB_BITS = 6;
+    static const int SUB_COUNT = 1 << SUB_BITS;          // linear buckets below 64ns
+    static const int HALF_COUNT = SUB_COUNT / 2;         // buckets per power of 2 above that
+    static const int MAX_SHIFT = 34;
+    static const int NUM_BUCKETS = SUB_COUNT + MAX_SHIFT * HALF_COUNT;
+private:
+    std::atomic<uint64_t> buckets_[NUM_BUCKETS];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> max_;
+    static int bucketIndex(uint64_t value);
+    static uint64_t bucketValue(int index);
+public:
+    GridHistogram();
+    void record(long long nanoseconds);
+    void reset();
+    uint64_t count() { return count_.load(std::memory_order_relaxed); }
+    uint64_t max() { return max_.load(std::memory_order_relaxed); }
+    uint64_t percentile(double percent);
+};
+
+// ======================================================================
+// touch-to-sound latency, from the OS timestamp of a touch sample to the
+// end of each stage of handling it.
+//
+enum class LatencyStage { INGEST = 0, NOTE_MAPPING, MIDI_SEND, SYNTH_ENQUEUE, MAXIMUM };
+
+class GridLatency
+{
+    GridHistogram stages_[static_cast<int>(LatencyStage::MAXIMUM)];
+public:
+    // record the time from event_time (GridClock ticks) until now.
+    // event_time of 0 means the sample had no timestamp & is skipped.
+    void record(LatencyStage stage, long long event_time) {
+        if (event_time != 0) {
+            long long ns = GridClock::ticksToNanoseconds(GridClock::now() - event_time);
+            stages_[static_cast<int>(stage)].record(ns);
+        }
+    }
+    GridHistogram& stage(LatencyStage stage) { return stages_[static_cast<int>(stage)]; }
+    void dump();
+    void reset();
+};
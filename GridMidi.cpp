@@ -16,73 +16,148 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 // ======================================================================
 #include "GridMidi.h"
-#include "GridUtils.h"
-#include <iostream>
 
-// Not just a midi device any longer.  A Midi or Synth output
-GridMidi::GridMidi(HMIDIOUT midiDevice, GridSynth *gridSynth)
+#include <algorithm>
+
+// ======================================================================
+// Starts with no sinks, so messages only go to the flight recorder.
+//
+GridMidi::GridMidi(GridRecorder *recorder)
 {
-    midi_device_ = midiDevice;
-    grid_synth_ = gridSynth;
-    play_midi_ = false;
-    play_synth_ = false;
+    num_sinks_ = 0;
+    num_immediate_sinks_ = 0;
+    recorder_ = recorder;
+    event_time_ = 0;
+    in_frame_ = false;
+    flush_interval_ = 0;
+    pending_since_ = 0;
+    pending_count_ = 0;
+    for (int i = 0; i < NUM_PENDING_KEYS; i++) {
+        pending_slots_[i] = -1;
+    }
 }
 
-void checkAlertExit(MMRESULT rc) {
-    if (rc != MMSYSERR_NOERROR) {
-        wchar_t* error = new wchar_t[MAXERRORLENGTH]();
-        midiOutGetErrorText(rc, error, MAXERRORLENGTH);
-        std::wostringstream text;
-        text << "Unable to midiOutShortMsg: " << error;
-        delete[] error;
-        AlertExit(NULL, text.str().c_str());
+// ======================================================================
+bool GridMidi::addSink(GridMidiSink* sink, bool immediate)
+{
+    GridMidiSink** sinks = immediate ? immediate_sinks_ : sinks_;
+    int& num_sinks = immediate ? num_immediate_sinks_ : num_sinks_;
+    if (std::find(sinks, sinks + num_sinks, sink) != sinks + num_sinks) {
+        return true;
+    }
+    if (num_sinks == MAX_SINKS) {
+        return false;
     }
+    sinks[num_sinks++] = sink;
+    return true;
 }
 
-void GridMidi::noteOn(int channel, int note, int midi_pressure)
+void GridMidi::removeSink(GridMidiSink* sink)
+{
+    num_sinks_ = static_cast<int>(std::remove(sinks_, sinks_ + num_sinks_, sink) - sinks_);
+    num_immediate_sinks_ = static_cast<int>(
+        std::remove(immediate_sinks_, immediate_sinks_ + num_immediate_sinks_, sink) - immediate_sinks_);
+}
+
+// ======================================================================
+// send one message to the flight recorder & the sinks, which only take
+// midi's channels
+//
+void GridMidi::send(MidiMessage message, int channel)
 {
-    if (play_synth_) {
-        grid_synth_->noteOn(channel, note, midi_pressure); // FIXME
+    recorder_->midi(event_time_, message.data(), channel);
+    if (channel >= MIDI::CHANNELS) {
+        return;
     }
-    if (play_midi_) {
-        MidiMessage message(MIDI::NOTE_ON + channel, note, midi_pressure);
-        MMRESULT rc = midiOutShortMsg(midi_device_, message.data());
-        checkAlertExit(rc);
+    for (int i = 0; i < num_sinks_; i++) {
+        sinks_[i]->send(message.data(), event_time_);
     }
 }
 
-void GridMidi::pitchBend(int channel, int mod_pitch)
+// send one message to the immediate sinks
+void GridMidi::sendNow(MidiMessage message, int channel)
 {
-    if (play_synth_) {
-        grid_synth_->pitchBend(channel, mod_pitch); // FIXME
-    }
-    if (play_midi_) {
-        MidiMessage message(MIDI::PITCH_BEND + channel, mod_pitch & 0x7f, (mod_pitch >> 7) & 0x7f);
-        MMRESULT rc = midiOutShortMsg(midi_device_, message.data());
-        checkAlertExit(rc);
+    for (int i = 0; i < num_immediate_sinks_; i++) {
+        if (channel < MIDI::CHANNELS) {
+            immediate_sinks_[i]->send(message.data(), event_time_);
+        }
+        else {
+            immediate_sinks_[i]->sendWide(message.data(), channel, event_time_);
+        }
     }
 }
 
-void GridMidi::controlChange(int channel, int controller, int mod_modulation)
+// ======================================================================
+// hold a continuous controller message for the next flush(), replacing
+// any pending value for the same key.
+//
+void GridMidi::queue(int key, MidiMessage message, int channel)
 {
-    if (play_synth_) {
-        grid_synth_->controlChange(channel, controller, mod_modulation); // FIXME
+    if (!in_frame_ && flush_interval_ == 0) {
+        flush();
+        send(message, channel);
+        return;
+    }
+    if (event_time_ != 0 && flush_interval_ > 0) {
+        tick(event_time_);
     }
-    if (play_midi_) {
-        MidiMessage message(MIDI::CONTROL_CHANGE + channel, controller, mod_modulation);
-        MMRESULT rc = midiOutShortMsg(midi_device_, message.data());
-        checkAlertExit(rc);
+    int slot = pending_slots_[key];
+    if (slot < 0) {
+        if (pending_count_ == MAX_PENDING) {
+            flush();
+        }
+        if (pending_count_ == 0) {
+            pending_since_ = (event_time_ != 0) ? event_time_ : GridClock::now();
+        }
+        slot = pending_count_++;
+        pending_keys_[slot] = static_cast<short>(key);
+        pending_slots_[key] = static_cast<short>(slot);
     }
+    pending_messages_[slot] = message.data();
+    pending_channels_[slot] = channel;
+    pending_times_[slot] = event_time_;
 }
 
-void GridMidi::polyKeyPressure(int channel, int key, int pressure)
+// ======================================================================
+// send all pending messages, each timed from the touch that set it
+//
+void GridMidi::flush()
 {
-    if (play_synth_) {
-        grid_synth_->polyKeyPressure(channel, key, pressure); // FIXME
+    long long event_time = event_time_;
+    for (int i = 0; i < pending_count_; i++) {
+        event_time_ = pending_times_[i];
+        send(MidiMessage(pending_messages_[i]), pending_channels_[i]);
+        pending_slots_[pending_keys_[i]] = -1;
     }
-    if (play_midi_) {
-        MidiMessage message(MIDI::POLY_KEY_PRESSURE + channel, key, pressure);
-        MMRESULT rc = midiOutShortMsg(midi_device_, message.data());
-        checkAlertExit(rc);
-    }
-}
\ No newline at end of file
+    pending_count_ = 0;
+    event_time_ = event_time;
+}
+
+void GridMidi::noteOn(int channel, int note, int midi_pressure)
+{
+    MidiMessage message(MIDI::NOTE_ON + (channel & 0x0f), note, midi_pressure);
+    sendNow(message, channel);
+    flush();
+    send(message, channel);
+}
+
+void GridMidi::pitchBend(int channel, int mod_pitch, int note)
+{
+    MidiMessage message(MIDI::PITCH_BEND + (channel & 0x0f), mod_pitch & 0x7f, (mod_pitch >> 7) & 0x7f);
+    sendNow(message.forNote(note), channel);
+    queue(channel * 128, message, channel);
+}
+
+void GridMidi::controlChange(int channel, int controller, int mod_modulation, int note)
+{
+    MidiMessage message(MIDI::CONTROL_CHANGE + (channel & 0x0f), controller, mod_modulation);
+    sendNow(message.forNote(note), channel);
+    queue((MIDI::SYNTH_CHANNELS + channel) * 128 + (controller & 0x7f), message, channel);
+}
+
+void GridMidi::polyKeyPressure(int channel, int key, int pressure)
+{
+    MidiMessage message(MIDI::POLY_KEY_PRESSURE + (channel & 0x0f), key, pressure);
+    sendNow(message, channel);
+    queue((2 * MIDI::SYNTH_CHANNELS + channel) * 128 + (key & 0x7f), message, channel);
+}
@@ -16,24 +16,35 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 // ======================================================================
-#include "GridSynth.h"
+#include "GridMidiSink.h"
+#include "GridRecorder.h"
 
-#include <windows.h>
-#include <mmsystem.h>
+#include <cstddef>
+#include <cstdint>
 
 // type which is both an integer and an array of characters:
 // typedef union midimessage { unsigned long word; unsigned char data[4]; } MidiMessage;
 class MidiMessage
 {
-    union { unsigned long word; unsigned char data[4]; } msg;
+    union { uint32_t word; unsigned char data[4]; } msg;
 public:
+    explicit MidiMessage(uint32_t word) { msg.word = word; }
     MidiMessage(int d0, int d1, int d2) {
         msg.data[0] = static_cast<unsigned char>(d0);
         msg.data[1] = static_cast<unsigned char>(d1);
         msg.data[2] = static_cast<unsigned char>(d2);
         msg.data[3] = 0;
     };
-    unsigned long data() { return msg.word; }
+    uint32_t data() { return msg.word; }
+    // For the synth, a pitch bend or control change can name the note it
+    // is for in the unused top byte, as note + 1, so it only changes that
+    // note's voices.  Plain midi has 0 there.
+    MidiMessage forNote(int note) {
+        MidiMessage message(msg.word);
+        message.msg.data[3] = static_cast<unsigned char>(note + 1);
+        return message;
+    }
+    static int note(uint32_t word) { return static_cast<int>(word >> 24) - 1; }
 };
 
 // https://www.midi.org/specifications-old/item/table-1-summary-of-midi-message
@@ -46,24 +57,85 @@ namespace MIDI {
         PROGRAM_CHANGE = 0xc0,
         CHANNEL_PRESSURE = 0xd0,
         PITCH_BEND = 0xe0,
-        SYS_EX = 0xf0;
+        SYS_EX = 0xf0,
+        CHANNELS = 16,
+        SYNTH_CHANNELS = 64;    // GridSynth's
 };
 
+// ======================================================================
+// Midi output to any number of GridMidiSinks.  Continuous controller
+// messages (pitch bend, control change, poly key pressure) sent during
+// a frame of touch samples are coalesced: only the latest value per
+// channel & controller (or key) is kept and they are sent at the end of
+// the frame.  With a flushInterval() they are held across frames until
+// the oldest has waited that many ticks.  Any note message sends them
+// first, so order relative to notes is kept.  Immediate sinks (the
+// synth) get every value as it happens, with the note it is for when
+// the caller gives one.
+//
+// Channels from MIDI::CHANNELS up are the synth's alone.  Their messages
+// carry the channel's low 4 bits & go to the immediate sinks' sendWide()
+// with the whole channel, and to the flight recorder, but never to the
+// coalesced sinks.
+//
 class GridMidi
 {
-    HMIDIOUT midi_device_;
-    GridSynth *grid_synth_;
-    bool play_midi_;
-    bool play_synth_;
+    static const int MAX_SINKS = 4;
+    static const int MAX_PENDING = 64;
+    static const int NUM_PENDING_KEYS = 3 * MIDI::SYNTH_CHANNELS * 128;  // type, channel, controller/key
+
+    GridMidiSink* sinks_[MAX_SINKS];            // get coalesced messages
+    int num_sinks_;
+    GridMidiSink* immediate_sinks_[MAX_SINKS];  // get every message at once
+    int num_immediate_sinks_;
+    GridRecorder* recorder_;
+    long long event_time_;   // OS timestamp of the touch causing these messages
+    // coalesced messages waiting for flush(), in the order first queued
+    bool in_frame_;                             // between beginFrame() & endFrame()
+    long long flush_interval_;                  // GridClock ticks to hold messages
+    long long pending_since_;                   // when the oldest was queued
+    int pending_count_;
+    uint32_t pending_messages_[MAX_PENDING];
+    int pending_channels_[MAX_PENDING];
+    long long pending_times_[MAX_PENDING];      // event time of each latest value
+    short pending_keys_[MAX_PENDING];
+    short pending_slots_[NUM_PENDING_KEYS];     // key to pending index, -1 if none
+
+    void send(MidiMessage message, int channel);
+    void sendNow(MidiMessage message, int channel);
+    void queue(int key, MidiMessage message, int channel);
 public:
-    GridMidi(HMIDIOUT midiDevice, GridSynth *gridSynth);
+    explicit GridMidi(GridRecorder *recorder);
+
+    // the caller owns the sinks.  false if there are too many already.
+    bool addSink(GridMidiSink* sink, bool immediate = false);
+    void removeSink(GridMidiSink* sink);
+    void eventTime(long long eventTime) { event_time_ = eventTime; }
 
-    void playMidi(bool playMidi) { play_midi_ = playMidi; }
-    void playSynth(bool playSynth) { play_synth_ = playSynth; }
+    void flushInterval(long long ticks) { flush_interval_ = ticks; }
+    long long flushInterval() { return flush_interval_; }
+    void beginFrame() { in_frame_ = true; }
+    void endFrame(long long time) {
+        in_frame_ = false;
+        if (flush_interval_ == 0) {
+            flush();
+        }
+        tick(time);
+    }
+    void flush();
+    // flush if the oldest pending message has waited long enough by now
+    void tick(long long now) {
+        if (pending_count_ > 0 && now - pending_since_ >= flush_interval_) {
+            flush();
+        }
+    }
+    // GridClock time the pending messages are due, 0 if none
+    long long flushTime() { return (pending_count_ > 0) ? pending_since_ + flush_interval_ : 0; }
 
     void noteOn(int channel, int note, int midi_pressure);
-    void pitchBend(int channel, int mod_pitch);
-    void controlChange(int channel, int controller, int mod_modulation);
+    // note is the one the expression is for, or -1 for the whole channel
+    void pitchBend(int channel, int mod_pitch, int note = -1);
+    void controlChange(int channel, int controller, int mod_modulation, int note = -1);
     void polyKeyPressure(int channel, int key, int pressure);
 };
 
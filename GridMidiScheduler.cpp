@@ -0,0 +1,129 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridMidiScheduler.h"
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <algorithm>
+#include <chrono>
+
+// ======================================================================
+// Sleeping is only good to about a timer tick, so the thread sleeps
+// until this long before a message is due and then spins.
+//
+#ifdef _WIN32
+static const long long SPIN_NS = 1200000;
+#else
+static const long long SPIN_NS = 200000;
+#endif
+
+// ======================================================================
+// Constructor does not start the thread.
+//
+GridMidiScheduler::GridMidiScheduler(GridMidiSink* output, long long delay) :
+    output_(output), delay_(delay), last_due_(0), late_(0), running_(false)
+{
+}
+
+GridMidiScheduler::~GridMidiScheduler()
+{
+    stop();
+}
+
+void GridMidiScheduler::start()
+{
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    thread_ = std::thread(&GridMidiScheduler::run, this);
+#ifdef _WIN32
+    SetThreadPriority(thread_.native_handle(), THREAD_PRIORITY_TIME_CRITICAL);
+#endif
+}
+
+void GridMidiScheduler::stop()
+{
+    if (!running_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(wake_mutex_);
+        running_ = false;
+    }
+    wake_.notify_one();
+    thread_.join();
+}
+
+// ======================================================================
+void GridMidiScheduler::send(uint32_t message, long long event_time)
+{
+    long long now = GridClock::now();
+    long long due = ((event_time != 0) ? event_time : now) + delay_.load(std::memory_order_relaxed);
+    last_due_ = std::max(due, last_due_);
+    bool was_empty = queue_.empty();
+    while (!queue_.push({ last_due_, event_time, message })) {
+        std::this_thread::yield();
+    }
+    // the thread only sleeps without a timeout when it has nothing
+    if (was_empty) {
+        {
+            std::lock_guard<std::mutex> lk(wake_mutex_);
+        }
+        wake_.notify_one();
+    }
+}
+
+void GridMidiScheduler::sendDue(const Event& event)
+{
+    if (GridClock::now() > event.due + GridClock::ticksPerSecond() / 10000) {
+        late_.fetch_add(1, std::memory_order_relaxed);
+    }
+    output_->send(event.message, event.event_time);
+}
+
+// ======================================================================
+// timer thread.  Take the next message, sleep & then spin until it is
+// due, send it.  On stop, send whatever is left straight away.
+//
+void GridMidiScheduler::run()
+{
+    Event event;
+    while (running_) {
+        if (!queue_.pop(event)) {
+            std::unique_lock<std::mutex> lk(wake_mutex_);
+            wake_.wait(lk, [this] { return !running_ || !queue_.empty(); });
+            continue;
+        }
+        long long wait_ns;
+        while ((wait_ns = GridClock::ticksToNanoseconds(event.due - GridClock::now())) > SPIN_NS) {
+            std::unique_lock<std::mutex> lk(wake_mutex_);
+            if (!running_) {
+                break;
+            }
+            wake_.wait_for(lk, std::chrono::nanoseconds(wait_ns - SPIN_NS));
+        }
+        while (running_ && GridClock::now() < event.due) {
+            std::this_thread::yield();
+        }
+        sendDue(event);
+    }
+    while (queue_.pop(event)) {
+        output_->send(event.message, event.event_time);
+    }
+}
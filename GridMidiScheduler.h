@@ -0,0 +1,73 @@
+#pragma once
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridMidiSink.h"
+#include "GridQueue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// ======================================================================
+// Sends each message at the time of the touch that caused it plus a
+// fixed delay, from its own timer thread, rather than when the frame of
+// touches holding it happened to be handled.  Touches arrive in bursts
+// (several samples per frame), so without this the gaps between pitch
+// bends follow the OS input batching instead of the finger.  A delay a
+// little longer than the batching jitter (1-3ms) evens them out.
+//
+// Messages keep their order; one that is already late goes out at
+// once.  send() may only be called from one thread & only blocks if
+// QUEUE_SIZE messages are waiting.  The output sink is only called from
+// the timer thread while it runs.
+//
+class GridMidiScheduler final : public GridMidiSink
+{
+    static const size_t QUEUE_SIZE = 4096;
+    struct Event
+    {
+        long long due;          // GridClock time to send
+        long long event_time;
+        uint32_t message;
+    };
+    GridMidiSink* output_;
+    std::atomic<long long> delay_;  // GridClock ticks
+    long long last_due_;            // due times never go backwards
+    GridQueue<Event, QUEUE_SIZE> queue_;
+    std::atomic<uint64_t> late_;    // sent after their due time
+    std::thread thread_;
+    std::atomic<bool> running_;
+    std::mutex wake_mutex_;         // only used to sleep/wake the thread
+    std::condition_variable wake_;
+
+    void run();
+    void sendDue(const Event& event);
+public:
+    GridMidiScheduler(GridMidiSink* output, long long delay);
+    ~GridMidiScheduler();
+
+    void start();
+    // send everything still waiting & stop the thread
+    void stop();
+    bool running() { return running_.load(); }
+    void delay(long long ticks) { delay_.store(ticks); }
+    long long delay() { return delay_.load(); }
+    uint64_t late() { return late_.load(std::memory_order_relaxed); }
+    void send(uint32_t message, long long event_time) override;
+};
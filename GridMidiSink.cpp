@@ -0,0 +1,167 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridMidiSink.h"
+#include "GridMidi.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+// ======================================================================
+GridMidiErrors::GridMidiErrors() :
+    errors_(0), dropped_(0), recoveries_(0), failed_recoveries_(0), next_(0), ring_{}
+{
+}
+
+void GridMidiErrors::dump()
+{
+    uint64_t num_errors = errors();
+    std::wcout << "midi errors " << num_errors << " dropped " << droppedCount()
+        << " recoveries " << recoveries() << " failed recoveries " << failedRecoveries() << std::endl;
+    uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(num_errors, RING_SIZE));
+    uint32_t next = next_.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < count; i++) {
+        const GridMidiError& error = ring_[(next - count + i) % RING_SIZE];
+        std::wcout << "  error " << error.code << " at " << error.time << " sending "
+            << std::hex << std::setfill(L'0') << std::setw(6) << error.message
+            << std::dec << std::setfill(L' ') << std::endl;
+    }
+}
+
+#ifdef _WIN32
+// ======================================================================
+// The recovery thread runs from construction, sleeping until a send
+// fails.
+//
+GridMidiOutSink::GridMidiOutSink(GridLatency* latency, GridMidiErrors* errors) :
+    device_(nullptr), failed_(true), sending_(0), device_index_(0), open_(false),
+    latency_(latency), errors_(errors), running_(true)
+{
+    recovery_ = std::thread(&GridMidiOutSink::recover, this);
+}
+
+GridMidiOutSink::~GridMidiOutSink()
+{
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        running_ = false;
+    }
+    wake_.notify_one();
+    recovery_.join();
+    close();
+}
+
+// ======================================================================
+// close any device & open device_index_ if open_, leaving the sink
+// failed.  The caller must hold mutex_.  Once failed_ is set no new send
+// uses the handle, so this waits out any send already in midiOutShortMsg
+// before closing it.
+//
+MMRESULT GridMidiOutSink::reopen()
+{
+    failed_.store(true);
+    while (sending_.load() != 0) {
+        std::this_thread::yield();
+    }
+    HMIDIOUT device = device_.exchange(nullptr);
+    if (device != nullptr) {
+        // turn off any MIDI notes and close down.  Errors don't matter
+        // here, the handle is going away either way.
+        midiOutReset(device);
+        midiOutClose(device);
+    }
+    if (!open_) {
+        return MMSYSERR_NOERROR;
+    }
+    MMRESULT rc = midiOutOpen(&device, device_index_, 0, 0, CALLBACK_NULL);
+    if (rc != MMSYSERR_NOERROR) {
+        return rc;
+    }
+    device_.store(device);
+    return rc;
+}
+
+MMRESULT GridMidiOutSink::open(UINT device_index)
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    device_index_ = device_index;
+    open_ = true;
+    MMRESULT rc = reopen();
+    if (rc == MMSYSERR_NOERROR) {
+        failed_.store(false, std::memory_order_release);
+    }
+    return rc;
+}
+
+void GridMidiOutSink::close()
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    open_ = false;
+    reopen();
+}
+
+// ======================================================================
+// recovery thread.  After a failed send, reopen the device (backing
+// off up to 2s between tries) & send all notes off, so nothing is left
+// hanging from before the failure.  A closed sink is left closed.
+//
+void GridMidiOutSink::recover()
+{
+    std::unique_lock<std::mutex> lk(mutex_);
+    auto failed = [this] { return open_ && failed_.load(std::memory_order_acquire); };
+    while (running_) {
+        // send() doesn't take the lock to notify, so a wake up can be
+        // missed.  Look again every second.
+        wake_.wait_for(lk, std::chrono::seconds(1), [&] { return !running_ || failed(); });
+        int backoff_ms = 50;
+        while (running_ && failed()) {
+            wchar_t text[MAXERRORLENGTH] = {};
+            midiOutGetErrorText(errors_->last().code, text, MAXERRORLENGTH);
+            std::wcout << "midi output failed (" << text << "), reopening device " << device_index_ << std::endl;
+            MMRESULT rc = reopen();
+            if (rc == MMSYSERR_NOERROR) {
+                HMIDIOUT device = device_.load();
+                for (int channel = 0; channel < 16; channel++) {
+                    midiOutShortMsg(device, MidiMessage(MIDI::CONTROL_CHANGE + channel, 123, 0).data());
+                }
+                failed_.store(false, std::memory_order_release);
+                errors_->recovered();
+                std::wcout << "midi output recovered" << std::endl;
+                break;
+            }
+            errors_->recoveryFailed();
+            wake_.wait_for(lk, std::chrono::milliseconds(backoff_ms), [this] { return !running_; });
+            backoff_ms = std::min(2 * backoff_ms, 2000);
+        }
+    }
+}
+#endif
+
+// ======================================================================
+void GridSynthSink::send(uint32_t message, long long event_time)
+{
+    synth_->send(message, event_time);
+    latency_->record(LatencyStage::SYNTH_ENQUEUE, event_time);
+}
+
+void GridSynthSink::sendWide(uint32_t message, int channel, long long event_time)
+{
+    synth_->send(message, event_time, channel);
+    latency_->record(LatencyStage::SYNTH_ENQUEUE, event_time);
+}
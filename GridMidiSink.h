@@ -0,0 +1,183 @@
+#pragma once
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridLatency.h"
+#include "GridPlatform.h"
+#include "GridSynth.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#ifdef _WIN32
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+// ======================================================================
+// Somewhere GridMidi sends its messages.  A message is the 32-bit short
+// message word (status in the low byte) and event_time the GridClock
+// time of the touch that caused it, 0 if none.  GridMidi fans each
+// message out to all of its sinks, so adding an output is adding a
+// sink rather than another play flag.  The sinks here are final so
+// direct calls to them need no virtual dispatch.
+//
+class GridMidiSink
+{
+public:
+    virtual ~GridMidiSink() {}
+    virtual void send(uint32_t message, long long event_time) = 0;
+    // a message for a channel past midi's 16, which only the synth has.
+    // message has the channel's low 4 bits.  Midi sinks ignore these.
+    virtual void sendWide(uint32_t, int, long long) {}
+};
+
+// ======================================================================
+// midi output errors, counted without locks or allocation so the touch
+// handling thread can record them & carry on.  The last RING_SIZE
+// errors are kept for the stats dump.
+//
+struct GridMidiError
+{
+    long long time;          // event time of the failed message
+    uint32_t code;           // MMRESULT or other device error code
+    uint32_t message;
+};
+
+class GridMidiErrors
+{
+    static const uint32_t RING_SIZE = 32;
+    std::atomic<uint64_t> errors_;
+    std::atomic<uint64_t> dropped_;            // not sent while recovering
+    std::atomic<uint64_t> recoveries_;
+    std::atomic<uint64_t> failed_recoveries_;
+    std::atomic<uint32_t> next_;               // next ring slot to write
+    GridMidiError ring_[RING_SIZE];
+public:
+    GridMidiErrors();
+    void error(uint32_t code, uint32_t message, long long time) {
+        uint32_t slot = next_.fetch_add(1, std::memory_order_relaxed) % RING_SIZE;
+        ring_[slot] = { time, code, message };
+        errors_.fetch_add(1, std::memory_order_release);
+    }
+    void dropped() { dropped_.fetch_add(1, std::memory_order_relaxed); }
+    void recovered() { recoveries_.fetch_add(1, std::memory_order_relaxed); }
+    void recoveryFailed() { failed_recoveries_.fetch_add(1, std::memory_order_relaxed); }
+    uint64_t errors() { return errors_.load(std::memory_order_acquire); }
+    uint64_t droppedCount() { return dropped_.load(std::memory_order_relaxed); }
+    uint64_t recoveries() { return recoveries_.load(std::memory_order_relaxed); }
+    uint64_t failedRecoveries() { return failed_recoveries_.load(std::memory_order_relaxed); }
+    GridMidiError last() { return ring_[(next_.load(std::memory_order_relaxed) + RING_SIZE - 1) % RING_SIZE]; }
+    // counters & recent errors to std::wcout.  An error being recorded
+    // while this runs may show half written.
+    void dump();
+};
+
+#ifdef _WIN32
+// ======================================================================
+// a WinMM midi output device, owned by the sink once open()ed.  A
+// failed send never blocks or alerts: it is counted in the errors, the
+// port is marked failed & messages are dropped until the recovery
+// thread has reopened it and sent all notes off.  Other sinks (like the
+// synth) keep playing meanwhile.  Only one thread may send.
+//
+// send() counts itself in sending_ before it looks at failed_, and
+// reopen() sets failed_ before waiting for sending_ to reach 0, so the
+// device is never reset or closed while a send is using its handle.
+//
+class GridMidiOutSink final : public GridMidiSink
+{
+    std::atomic<HMIDIOUT> device_;
+    std::atomic<bool> failed_;      // set by send(), cleared by recovery
+    std::atomic<int> sending_;      // send()s that may be using device_
+    UINT device_index_;
+    bool open_;                     // open() called & not close()d since
+    GridLatency* latency_;
+    GridMidiErrors* errors_;
+    std::mutex mutex_;              // all but the atomics, opening/closing device_
+    std::condition_variable wake_;
+    bool running_;
+    std::thread recovery_;
+
+    MMRESULT reopen();
+    void recover();
+public:
+    GridMidiOutSink(GridLatency* latency, GridMidiErrors* errors);
+    ~GridMidiOutSink();
+    // close any current device & open this one
+    MMRESULT open(UINT device_index);
+    void close();
+    void send(uint32_t message, long long event_time) override {
+        sending_.fetch_add(1);
+        if (failed_.load()) {
+            sending_.fetch_sub(1, std::memory_order_release);
+            errors_->dropped();
+            return;
+        }
+        MMRESULT rc = midiOutShortMsg(device_.load(std::memory_order_relaxed), message);
+        sending_.fetch_sub(1, std::memory_order_release);
+        if (rc != MMSYSERR_NOERROR) {
+            errors_->error(rc, message, event_time);
+            failed_.store(true, std::memory_order_release);
+            wake_.notify_one();
+            return;
+        }
+        latency_->record(LatencyStage::MIDI_SEND, event_time);
+    }
+};
+#endif
+
+// ======================================================================
+// the FluidSynth soft synth.  Messages are queued for its audio thread,
+// which plays the channel voice messages (note on, pitch bend, control
+// change & poly pressure) & ignores the rest.
+//
+class GridSynthSink final : public GridMidiSink
+{
+    GridSynth* synth_;
+    GridLatency* latency_;
+public:
+    GridSynthSink(GridSynth* synth, GridLatency* latency) : synth_(synth), latency_(latency) {}
+    GridSynth* synth() { return synth_; }
+    void send(uint32_t message, long long event_time) override;
+    void sendWide(uint32_t message, int channel, long long event_time) override;
+};
+
+// ======================================================================
+// keeps the messages in a buffer the caller allocated up front, for
+// headless testing & benchmarks.  Counts every message, even those
+// beyond the end of the buffer (which may be nullptr to only count).
+//
+class GridCaptureSink final : public GridMidiSink
+{
+    uint32_t* buffer_;
+    size_t size_;
+    size_t count_;
+public:
+    GridCaptureSink(uint32_t* buffer, size_t size) : buffer_(buffer), size_(size), count_(0) {}
+    void reset() { count_ = 0; }
+    size_t count() { return count_; }
+    // messages kept in the buffer
+    size_t size() { return (count_ < size_) ? count_ : size_; }
+    void send(uint32_t message, long long) override {
+        if (count_ < size_) {
+            buffer_[count_] = message;
+        }
+        count_++;
+    }
+};
@@ -0,0 +1,169 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridMidiStream.h"
+
+// ======================================================================
+// Status bytes 0x80-0xef are channel messages, 0xf0-0xf7 system common
+// (which cancel running status) & 0xf8-0xff realtime (which don't).
+//
+int midiMessageLength(uint8_t status)
+{
+    if (status < 0x80) {
+        return 0;
+    }
+    if (status < 0xf0) {
+        int type = status & 0xf0;
+        return (type == 0xc0 || type == 0xd0) ? 2 : 3;
+    }
+    switch (status) {
+    case 0xf1:  // MTC quarter frame
+    case 0xf3:  // song select
+        return 2;
+    case 0xf2:  // song position
+        return 3;
+    case 0xf0:  // sysex start
+    case 0xf7:  // sysex end
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+// ======================================================================
+size_t GridMidiEncoder::encode(uint32_t message, uint8_t* buffer, size_t size)
+{
+    uint8_t status = static_cast<uint8_t>(message);
+    int length = midiMessageLength(status);
+    if (length == 0) {
+        return 0;
+    }
+    bool send_status = true;
+    if (status < 0xf0) {
+        send_status = (status != running_status_);
+    }
+    size_t num_bytes = length - (send_status ? 0 : 1);
+    if (num_bytes > size) {
+        return 0;
+    }
+    uint8_t* p = buffer;
+    if (send_status) {
+        *p++ = status;
+    }
+    for (int i = 1; i < length; i++) {
+        *p++ = static_cast<uint8_t>(message >> (8 * i)) & 0x7f;
+    }
+    if (status < 0xf0) {
+        running_status_ = status;
+    }
+    else if (status < 0xf8) {
+        running_status_ = 0;
+    }
+    return num_bytes;
+}
+
+size_t GridMidiEncoder::encode(const uint32_t* messages, size_t& count, uint8_t* buffer, size_t size)
+{
+    size_t used = 0;
+    size_t i = 0;
+    for (; i < count; i++) {
+        size_t num_bytes = encode(messages[i], buffer + used, size - used);
+        if (num_bytes == 0 && midiMessageLength(static_cast<uint8_t>(messages[i])) != 0) {
+            break;  // full
+        }
+        used += num_bytes;
+    }
+    count = i;
+    return used;
+}
+
+// ======================================================================
+size_t GridMidiDecoder::decode(const uint8_t* bytes, size_t& size, uint32_t* messages, size_t max_messages)
+{
+    size_t num_messages = 0;
+    size_t i = 0;
+    for (; i < size && num_messages < max_messages; i++) {
+        uint8_t byte = bytes[i];
+        if (byte >= 0xf8) {
+            // realtime, may come between the bytes of another message
+            messages[num_messages++] = byte;
+            continue;
+        }
+        if (byte >= 0x80) {
+            num_data_ = 0;
+            int length = midiMessageLength(byte);
+            if (byte < 0xf0) {
+                running_status_ = byte;
+            }
+            else {
+                running_status_ = 0;
+                if (length == 1) {
+                    messages[num_messages++] = byte;
+                }
+                else if (length > 1) {
+                    running_status_ = byte;  // until its data is complete
+                }
+            }
+            continue;
+        }
+        if (running_status_ == 0) {
+            continue;  // sysex data or no status yet
+        }
+        data_[num_data_++] = byte;
+        if (num_data_ + 1 == midiMessageLength(running_status_)) {
+            uint32_t message = running_status_ | (data_[0] << 8);
+            if (num_data_ == 2) {
+                message |= data_[1] << 16;
+            }
+            messages[num_messages++] = message;
+            num_data_ = 0;
+            if (running_status_ >= 0xf0) {
+                running_status_ = 0;
+            }
+        }
+    }
+    size = i;
+    return num_messages;
+}
+
+// ======================================================================
+void GridMidiStreamSink::send(uint32_t message, long long)
+{
+    size_t num_bytes = encoder_.encode(message, buffer_ + used_, BUFFER_SIZE - used_);
+    if (num_bytes == 0 && midiMessageLength(static_cast<uint8_t>(message)) != 0) {
+        flush();
+        num_bytes = encoder_.encode(message, buffer_, BUFFER_SIZE);
+    }
+    used_ += num_bytes;
+}
+
+void GridMidiStreamSink::sysex(const uint8_t* bytes, size_t size)
+{
+    flush();
+    write(bytes, size);
+    bytes_ += size;
+    encoder_.reset();
+}
+
+void GridMidiStreamSink::flush()
+{
+    if (used_ > 0) {
+        write(buffer_, used_);
+        bytes_ += used_;
+        used_ = 0;
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridMidiSink.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// ======================================================================
+// MIDI 1.0 byte stream encoding of the 32-bit short messages GridMidi
+// sends (status in the low byte), for byte oriented outputs like a
+// serial port, a raw .mid track body or a network packet.
+//
+// The encoder uses running status: a channel message with the same
+// status byte as the one before it is sent without it.  The long runs
+// of pitch bend on one channel during a slide, and NOTE_ON with
+// velocity 0 for note off, then cost 2 bytes instead of 3.  Neither
+// class allocates; all output goes to buffers the caller provides.
+//
+
+// bytes in a message with this status byte, including the status.
+// 0 for data bytes & sysex, which aren't short messages.
+int midiMessageLength(uint8_t status);
+
+class GridMidiEncoder
+{
+    uint8_t running_status_;    // 0 when the next message needs its status
+public:
+    GridMidiEncoder() : running_status_(0) {}
+    // send the status with the next message, e.g. when a receiver may
+    // have missed or dropped earlier bytes
+    void reset() { running_status_ = 0; }
+    // write one message, returns the bytes written.  0 if it doesn't
+    // fit in size (nothing written) or isn't a short message.
+    size_t encode(uint32_t message, uint8_t* buffer, size_t size);
+    // write as many whole messages as fit.  Returns the bytes written
+    // & sets count to the number of messages taken.
+    size_t encode(const uint32_t* messages, size_t& count, uint8_t* buffer, size_t size);
+};
+
+class GridMidiDecoder
+{
+    uint8_t running_status_;    // 0 until a channel status byte arrives
+    uint8_t data_[2];
+    int num_data_;              // data bytes of the current message so far
+public:
+    GridMidiDecoder() : running_status_(0), data_{ 0, 0 }, num_data_(0) {}
+    void reset() { running_status_ = 0; num_data_ = 0; }
+    // read bytes, writing complete messages as 32-bit words.  A message
+    // may be split across calls.  Returns the messages written & sets
+    // size to the bytes taken, which is less than given only when
+    // max_messages is reached.  Stray data bytes & sysex are skipped.
+    size_t decode(const uint8_t* bytes, size_t& size, uint32_t* messages, size_t max_messages);
+};
+
+// ======================================================================
+// A GridMidiSink for a byte oriented output.  Messages are encoded into
+// a buffer, which goes to write() when the next message doesn't fit and
+// at flush(), so a burst of messages is one write.  The owner flushes
+// after each frame, or as often as the output needs.  Sysex goes out at
+// once, after what is buffered, and the next message sends its status.
+// Only one thread may send, sysex or flush.
+//
+class GridMidiStreamSink : public GridMidiSink
+{
+public:
+    static const size_t BUFFER_SIZE = 256;
+private:
+    GridMidiEncoder encoder_;
+    uint8_t buffer_[BUFFER_SIZE];
+    size_t used_;
+    uint64_t bytes_;
+protected:
+    // the next bytes for the output
+    virtual void write(const uint8_t* bytes, size_t size) = 0;
+public:
+    GridMidiStreamSink() : buffer_{}, used_(0), bytes_(0) {}
+    void send(uint32_t message, long long event_time) override;
+    // a whole sysex message, 0xf0 to 0xf7
+    void sysex(const uint8_t* bytes, size_t size);
+    void flush();
+    // bytes given to write() so far
+    uint64_t bytesWritten() { return bytes_; }
+};
+
+// ======================================================================
+// raw midi bytes to an open file: a serial device, or the body of a
+// .mid track.  The caller owns the file.
+//
+class GridMidiFileSink final : public GridMidiStreamSink
+{
+    FILE* file_;
+protected:
+    void write(const uint8_t* bytes, size_t size) override { fwrite(bytes, 1, size, file_); }
+public:
+    explicit GridMidiFileSink(FILE* file) : file_(file) {}
+    ~GridMidiFileSink() { flush(); }
+};
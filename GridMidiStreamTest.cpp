@@ -0,0 +1,253 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridMidiStream.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// ======================================================================
+// GridMidiStreamTest - checks that GridMidiDecoder gives back what
+// GridMidiEncoder wrote.  Exits non-zero on any difference.
+//
+// Random channel, system common & realtime messages go through the
+// encoder & back through the decoder in odd sized pieces, with realtime
+// bytes dropped between the bytes of other messages as a device may.
+// A pitch bend run must cost 2 bytes a message after the first, and
+// sysex written by GridMidiStreamSink must be skipped by the decoder,
+// with the message after it sending its status again.
+//
+
+static const int ROUND_TRIP_MESSAGES = 200000;
+
+// a random message the encoder takes, data bytes 7 bits
+static uint32_t randomMessage(std::mt19937& rng)
+{
+    static const uint8_t SYSTEM[] = { 0xf1, 0xf2, 0xf3, 0xf6, 0xf8, 0xfa, 0xfb, 0xfc, 0xfe, 0xff };
+    uint8_t status;
+    if (rng() % 8 == 0) {
+        status = SYSTEM[rng() % sizeof(SYSTEM)];
+    }
+    else {
+        // few types & channels, so running status gets used
+        status = static_cast<uint8_t>(0x80 + 0x10 * (rng() % 7) + rng() % 2);
+    }
+    uint32_t message = status;
+    for (int i = 1; i < midiMessageLength(status); i++) {
+        message |= (rng() & 0x7f) << (8 * i);
+    }
+    return message;
+}
+
+// decode bytes in pieces of 1 to 7 bytes, at most 3 messages a call
+static std::vector<uint32_t> decodeAll(const std::vector<uint8_t>& bytes, std::mt19937& rng)
+{
+    GridMidiDecoder decoder;
+    std::vector<uint32_t> messages;
+    uint32_t out[3];
+    size_t pos = 0;
+    while (pos < bytes.size()) {
+        size_t size = std::min<size_t>(1 + rng() % 7, bytes.size() - pos);
+        size_t count = decoder.decode(bytes.data() + pos, size, out, 1 + rng() % 3);
+        messages.insert(messages.end(), out, out + count);
+        pos += size;
+    }
+    return messages;
+}
+
+static int expectMessages(const char* test, const std::vector<uint32_t>& got, const std::vector<uint32_t>& want)
+{
+    if (got == want) {
+        return 0;
+    }
+    size_t i = 0;
+    while (i < got.size() && i < want.size() && got[i] == want[i]) {
+        i++;
+    }
+    std::cout << test << ": FAILED, " << got.size() << " messages, expected " << want.size()
+        << ", first difference at " << i << std::endl;
+    return 1;
+}
+
+// ======================================================================
+// the messages encoded one at a time into a buffer of random sizes,
+// full buffers retried, must decode to themselves
+static int testRoundTrip()
+{
+    std::mt19937 rng(11);
+    std::vector<uint32_t> sent;
+    for (int i = 0; i < ROUND_TRIP_MESSAGES; i++) {
+        sent.push_back(randomMessage(rng));
+    }
+    GridMidiEncoder encoder;
+    std::vector<uint8_t> bytes;
+    size_t next = 0;
+    while (next < sent.size()) {
+        uint8_t buffer[16];
+        size_t count = sent.size() - next;
+        size_t size = rng() % 8;
+        size_t used = encoder.encode(sent.data() + next, count, buffer, size);
+        bytes.insert(bytes.end(), buffer, buffer + used);
+        next += count;
+    }
+    int failed = expectMessages("round trip", decodeAll(bytes, rng), sent);
+    if (bytes.size() >= 3 * sent.size()) {
+        std::cout << "round trip: FAILED, running status saved nothing" << std::endl;
+        failed = 1;
+    }
+    return failed;
+}
+
+// ======================================================================
+// a slide is a run of pitch bends on one channel: the status once, then
+// 2 data bytes each
+static int testRunningStatus()
+{
+    GridMidiEncoder encoder;
+    std::vector<uint8_t> bytes;
+    std::vector<uint32_t> sent;
+    const int BENDS = 50;
+    for (int i = 0; i < BENDS; i++) {
+        uint32_t message = 0xe3 | ((i & 0x7f) << 8) | (0x40 << 16);
+        uint8_t buffer[3];
+        size_t used = encoder.encode(message, buffer, sizeof(buffer));
+        bytes.insert(bytes.end(), buffer, buffer + used);
+        sent.push_back(message);
+    }
+    int failed = 0;
+    if (bytes.size() != 1 + 2 * BENDS) {
+        std::cout << "running status: FAILED, " << bytes.size() << " bytes for " << BENDS
+            << " pitch bends, expected " << 1 + 2 * BENDS << std::endl;
+        failed = 1;
+    }
+    std::mt19937 rng(14);
+    failed |= expectMessages("running status", decodeAll(bytes, rng), sent);
+    return failed;
+}
+
+// ======================================================================
+// realtime bytes may come between any two bytes.  They are decoded at
+// once, before the message they interrupt, which keeps its running
+// status.
+static int testRealtimeInterleave()
+{
+    std::mt19937 rng(22);
+    GridMidiEncoder encoder;
+    std::vector<uint8_t> bytes;
+    std::vector<uint32_t> want;
+    for (int i = 0; i < 10000; i++) {
+        uint32_t message;
+        do {
+            message = randomMessage(rng);
+        } while (static_cast<uint8_t>(message) >= 0xf8);
+        uint8_t buffer[3];
+        size_t used = encoder.encode(message, buffer, sizeof(buffer));
+        std::vector<uint32_t> clocks;
+        for (size_t b = 0; b < used; b++) {
+            bytes.push_back(buffer[b]);
+            if (b + 1 < used && rng() % 3 == 0) {
+                uint8_t realtime = (rng() % 2) ? 0xf8 : 0xfe;
+                bytes.push_back(realtime);
+                clocks.push_back(realtime);
+            }
+        }
+        want.insert(want.end(), clocks.begin(), clocks.end());
+        want.push_back(message);
+    }
+    return expectMessages("realtime interleave", decodeAll(bytes, rng), want);
+}
+
+// ======================================================================
+class VectorSink final : public GridMidiStreamSink
+{
+public:
+    std::vector<uint8_t> bytes;
+    std::vector<size_t> writes;     // size of each write()
+protected:
+    void write(const uint8_t* data, size_t size) override
+    {
+        bytes.insert(bytes.end(), data, data + size);
+        writes.push_back(size);
+    }
+};
+
+// sysex goes out between the messages around it & is skipped by the
+// decoder.  The message after it sends its status, as sysex ends any
+// running status.
+static int testSysex()
+{
+    static const uint8_t SYSEX[] = { 0xf0, 0x7e, 0x7f, 0x09, 0x01, 0xf7 };  // GM on
+    VectorSink sink;
+    std::vector<uint32_t> want = { 0x403c90, 0x403e90 };
+    sink.send(want[0], 0);
+    sink.sysex(SYSEX, sizeof(SYSEX));
+    sink.send(want[1], 0);
+    sink.flush();
+    std::vector<uint8_t> expected = { 0x90, 0x3c, 0x40, 0xf0, 0x7e, 0x7f, 0x09, 0x01, 0xf7, 0x90, 0x3e, 0x40 };
+    int failed = 0;
+    if (sink.bytes != expected) {
+        std::cout << "sysex: FAILED, wrong bytes written" << std::endl;
+        failed = 1;
+    }
+    std::mt19937 rng(33);
+    failed |= expectMessages("sysex", decodeAll(sink.bytes, rng), want);
+    return failed;
+}
+
+// ======================================================================
+// the sink writes only when the next message doesn't fit its buffer or
+// at flush(), so every write but the last is within a message of full
+static int testStreamSink()
+{
+    std::mt19937 rng(44);
+    VectorSink sink;
+    std::vector<uint32_t> sent;
+    for (int i = 0; i < 5000; i++) {
+        sent.push_back(randomMessage(rng));
+        sink.send(sent.back(), 0);
+    }
+    sink.flush();
+    sink.flush();   // nothing more
+    int failed = 0;
+    for (size_t i = 0; i + 1 < sink.writes.size(); i++) {
+        if (sink.writes[i] + 2 < GridMidiStreamSink::BUFFER_SIZE) {
+            std::cout << "stream sink: FAILED, write " << i << " of " << sink.writes[i] << " bytes" << std::endl;
+            failed = 1;
+            break;
+        }
+    }
+    if (sink.bytesWritten() != sink.bytes.size()) {
+        std::cout << "stream sink: FAILED, bytesWritten " << sink.bytesWritten() << ", wrote " << sink.bytes.size() << std::endl;
+        failed = 1;
+    }
+    failed |= expectMessages("stream sink", decodeAll(sink.bytes, rng), sent);
+    return failed;
+}
+
+// ======================================================================
+int main()
+{
+    int failed = testRoundTrip();
+    failed |= testRunningStatus();
+    failed |= testRealtimeInterleave();
+    failed |= testSysex();
+    failed |= testStreamSink();
+    return failed;
+}
@@ -0,0 +1,365 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridOscillator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+// ======================================================================
+// the lanes of the widest SIMD the build targets, with the handful of
+// operations the voices need.  MSVC defines no __SSE__, but every x64
+// & /arch:SSE build has it.
+//
+#if defined(__AVX__)
+#include <immintrin.h>
+typedef __m256 Lanes;
+static const int LANES = 8;
+static const char* const SIMD = "avx";
+static inline Lanes load(const float* p) { return _mm256_load_ps(p); }
+static inline void store(float* p, Lanes a) { _mm256_store_ps(p, a); }
+static inline Lanes splat(float x) { return _mm256_set1_ps(x); }
+static inline Lanes add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+static inline Lanes sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+static inline Lanes mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+typedef __m128 Lanes;
+static const int LANES = 4;
+static const char* const SIMD = "sse";
+static inline Lanes load(const float* p) { return _mm_load_ps(p); }
+static inline void store(float* p, Lanes a) { _mm_store_ps(p, a); }
+static inline Lanes splat(float x) { return _mm_set1_ps(x); }
+static inline Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+static inline Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+typedef float32x4_t Lanes;
+static const int LANES = 4;
+static const char* const SIMD = "neon";
+static inline Lanes load(const float* p) { return vld1q_f32(p); }
+static inline void store(float* p, Lanes a) { vst1q_f32(p, a); }
+static inline Lanes splat(float x) { return vdupq_n_f32(x); }
+static inline Lanes add(Lanes a, Lanes b) { return vaddq_f32(a, b); }
+static inline Lanes sub(Lanes a, Lanes b) { return vsubq_f32(a, b); }
+static inline Lanes mul(Lanes a, Lanes b) { return vmulq_f32(a, b); }
+#else
+// plain floats, which the compiler may still vectorize
+struct Lanes { float v[4]; };
+static const int LANES = 4;
+static const char* const SIMD = "scalar";
+static inline Lanes load(const float* p) { Lanes r; for (int l = 0; l < LANES; l++) r.v[l] = p[l]; return r; }
+static inline void store(float* p, Lanes a) { for (int l = 0; l < LANES; l++) p[l] = a.v[l]; }
+static inline Lanes splat(float x) { Lanes r; for (int l = 0; l < LANES; l++) r.v[l] = x; return r; }
+static inline Lanes add(Lanes a, Lanes b) { for (int l = 0; l < LANES; l++) a.v[l] += b.v[l]; return a; }
+static inline Lanes sub(Lanes a, Lanes b) { for (int l = 0; l < LANES; l++) a.v[l] -= b.v[l]; return a; }
+static inline Lanes mul(Lanes a, Lanes b) { for (int l = 0; l < LANES; l++) a.v[l] *= b.v[l]; return a; }
+#endif
+
+static_assert(GridOscillatorBank::VOICES % LANES == 0, "whole lane groups of voices");
+static_assert(LANES <= GridOscillatorBank::MAX_LANES, "room in mix_ for the lanes");
+
+static const double PI = 3.14159265358979323846;
+// a voice's gain at full loudness, so a few fingers together don't clip
+static const float VOICE_GAIN = 0.2f;
+// time constants of the loudness, rising, falling while held & released
+static const double ATTACK_SECONDS = 0.003;
+static const double PRESSURE_SECONDS = 0.02;
+static const double RELEASE_SECONDS = 0.08;
+// released voices stop once this quiet, -80 dB
+static const float SILENT_GAIN = 1e-4f;
+// the brightness from modulation 0 & 127: the falloff of each partial
+// from the one below
+static const float BRIGHTNESS_MIN = 0.1f;
+static const float BRIGHTNESS_MAX = 0.85f;
+static const double BRIGHTNESS_SECONDS = 0.01;
+// partials stop short of Nyquist so they don't alias
+static const double MAX_PARTIAL = 0.45;
+
+// ======================================================================
+GridOscillatorBank::GridOscillatorBank(double sample_rate) :
+    sample_rate_(sample_rate), pitch_bend_range_(2), brightness_controller_(1),
+    note_ons_(0), voices_stolen_(0), active_(0)
+{
+    reset();
+}
+
+void GridOscillatorBank::reset()
+{
+    std::fill(std::begin(bend_), std::end(bend_), 0.0f);
+    std::fill(std::begin(brightness_), std::end(brightness_), 0.0f);
+    for (int v = 0; v < VOICES; v++) {
+        voices_[v] = { 0, -1, false, 0.0f, 0.0f, 0.0f, 0 };
+        cos_[v] = 1.0f;
+        sin_[v] = 0.0f;
+        step_cos_[v] = 1.0f;
+        step_sin_[v] = 0.0f;
+        gain_[v] = 0.0f;
+        gain_step_[v] = 0.0f;
+        bright_[v] = 0.0f;
+        for (int k = 0; k < HARMONICS; k++) {
+            weights_[k][v] = 0.0f;
+        }
+    }
+    active_ = 0;
+}
+
+// ======================================================================
+// the voice playing this note, held or released, else -1
+//
+int GridOscillatorBank::findVoice(int channel, int note)
+{
+    for (int v = 0; v < VOICES; v++) {
+        if (voices_[v].note == note && voices_[v].channel == channel) {
+            return v;
+        }
+    }
+    return -1;
+}
+
+// a free voice, else -1
+int GridOscillatorBank::freeVoice()
+{
+    for (int v = 0; v < VOICES; v++) {
+        if (voices_[v].note < 0) {
+            return v;
+        }
+    }
+    return -1;
+}
+
+// ======================================================================
+// A note already sounding on the channel keeps its voice & phase.  A new
+// voice starts at phase 0, where its partials are all 0, so it doesn't
+// click.  A stolen one ramps from where it was over the next control
+// block.
+//
+bool GridOscillatorBank::noteOn(int channel, int note, int velocity)
+{
+    channel &= CHANNELS - 1;
+    int v = findVoice(channel, note);
+    if (velocity == 0) {
+        if (v >= 0) {
+            voices_[v].held = false;
+        }
+        return false;
+    }
+    bool stolen = false;
+    if (v < 0) {
+        v = freeVoice();
+    }
+    if (v < 0) {
+        v = 0;
+        for (int i = 1; i < VOICES; i++) {
+            const Voice& a = voices_[i];
+            const Voice& b = voices_[v];
+            if (a.held != b.held ? !a.held : a.started < b.started) {
+                v = i;
+            }
+        }
+        stolen = true;
+        voices_stolen_++;
+    }
+    if (voices_[v].note < 0) {
+        cos_[v] = 1.0f;
+        sin_[v] = 0.0f;
+        bright_[v] = brightness_[channel];
+    }
+    voices_[v] = { channel, note, true, velocity / 127.0f, bend_[channel], brightness_[channel], note_ons_++ };
+    return stolen;
+}
+
+void GridOscillatorBank::pitchBend(int channel, int value, int note)
+{
+    channel &= CHANNELS - 1;
+    float bend = (value - 0x2000) / 8192.0f * pitch_bend_range_;
+    if (note < 0) {
+        bend_[channel] = bend;
+    }
+    for (Voice& voice : voices_) {
+        if (voice.channel == channel && voice.note >= 0 && (note < 0 || voice.note == note)) {
+            voice.bend = bend;
+        }
+    }
+}
+
+void GridOscillatorBank::controlChange(int channel, int controller, int value, int note)
+{
+    if (controller != brightness_controller_) {
+        return;
+    }
+    channel &= CHANNELS - 1;
+    float brightness = value / 127.0f;
+    if (note < 0) {
+        brightness_[channel] = brightness;
+    }
+    for (Voice& voice : voices_) {
+        if (voice.channel == channel && voice.note >= 0 && (note < 0 || voice.note == note)) {
+            voice.brightness = brightness;
+        }
+    }
+}
+
+void GridOscillatorBank::polyKeyPressure(int channel, int note, int pressure)
+{
+    int v = findVoice(channel & (CHANNELS - 1), note);
+    if (v >= 0 && voices_[v].held) {
+        voices_[v].loudness = pressure / 127.0f;
+    }
+}
+
+// ======================================================================
+void GridOscillatorBank::render(float* left, float* right, int frames)
+{
+    int done = 0;
+    while (done < frames) {
+        int n = std::min(frames - done, CONTROL_FRAMES);
+        control(n);
+        renderVoices(left + done, n);
+        std::copy(left + done, left + done + n, right + done);
+        done += n;
+    }
+}
+
+// ======================================================================
+// each voice's rotation, partial weights & gain ramp for the next frames.
+// The weights fall off as brightness^(k-1)/k, scaled to keep the voice's
+// power the same as the brightness changes, or all 0 when even the
+// fundamental is too high to play.  Released voices that have faded out
+// are freed, as is any voice once its gain is 0.
+//
+void GridOscillatorBank::control(int frames)
+{
+    double block_seconds = frames / sample_rate_;
+    float bright_mix = static_cast<float>(1.0 - std::exp(-block_seconds / BRIGHTNESS_SECONDS));
+    active_ = 0;
+    for (int v = 0; v < VOICES; v++) {
+        Voice& voice = voices_[v];
+        if (voice.note < 0) {
+            gain_step_[v] = 0.0f;
+            continue;
+        }
+        float target = voice.held ? VOICE_GAIN * voice.loudness : 0.0f;
+        double seconds = (target > gain_[v]) ? ATTACK_SECONDS : (voice.held ? PRESSURE_SECONDS : RELEASE_SECONDS);
+        float next_gain = target + (gain_[v] - target) * static_cast<float>(std::exp(-block_seconds / seconds));
+        if (!voice.held && next_gain < SILENT_GAIN) {
+            // fades to 0 over this block, then is free
+            next_gain = 0.0f;
+            voice.note = -1;
+        }
+        else {
+            active_++;
+        }
+        gain_step_[v] = (next_gain - gain_[v]) / frames;
+
+        double frequency = 440.0 * std::pow(2.0, (voice.note - 69 + voice.bend) / 12.0);
+        frequency = std::min(frequency, MAX_PARTIAL * sample_rate_);
+        double omega = 2.0 * PI * frequency / sample_rate_;
+        step_cos_[v] = static_cast<float>(std::cos(omega));
+        step_sin_[v] = static_cast<float>(std::sin(omega));
+        // float rounding slowly grows or shrinks the rotation
+        float norm = 1.5f - 0.5f * (cos_[v] * cos_[v] + sin_[v] * sin_[v]);
+        cos_[v] *= norm;
+        sin_[v] *= norm;
+
+        bright_[v] += (voice.brightness - bright_[v]) * bright_mix;
+        float falloff = BRIGHTNESS_MIN + (BRIGHTNESS_MAX - BRIGHTNESS_MIN) * bright_[v];
+        float power = 0.0f;
+        float weight = 1.0f;
+        for (int k = 0; k < HARMONICS; k++) {
+            bool audible = (k + 1) * frequency < MAX_PARTIAL * sample_rate_;
+            weights_[k][v] = audible ? weight / (k + 1) : 0.0f;
+            power += weights_[k][v] * weights_[k][v];
+            weight *= falloff;
+        }
+        // a fundamental bent up past MAX_PARTIAL has nothing audible left
+        float scale = (power > 0.0f) ? 1.0f / std::sqrt(power) : 0.0f;
+        for (int k = 0; k < HARMONICS; k++) {
+            weights_[k][v] *= scale;
+        }
+    }
+}
+
+// ======================================================================
+// every lane group with a sounding voice, summed into out.  Each frame
+// rotates the phase, then sin(k p) for the partials follows from
+// sin((k+1)p) = 2 cos(p) sin(k p) - sin((k-1)p).
+//
+void GridOscillatorBank::renderVoices(float* out, int frames)
+{
+    std::fill(mix_, mix_ + frames * LANES, 0.0f);
+    for (int group = 0; group < VOICES; group += LANES) {
+        bool sounding = false;
+        for (int v = group; v < group + LANES; v++) {
+            sounding = sounding || gain_[v] != 0.0f || gain_step_[v] != 0.0f;
+        }
+        if (!sounding) {
+            continue;
+        }
+        Lanes c = load(cos_ + group);
+        Lanes s = load(sin_ + group);
+        Lanes step_c = load(step_cos_ + group);
+        Lanes step_s = load(step_sin_ + group);
+        Lanes gain = load(gain_ + group);
+        Lanes gain_step = load(gain_step_ + group);
+        Lanes weights[HARMONICS];
+        for (int k = 0; k < HARMONICS; k++) {
+            weights[k] = load(weights_[k] + group);
+        }
+        for (int i = 0; i < frames; i++) {
+            Lanes next_c = sub(mul(c, step_c), mul(s, step_s));
+            s = add(mul(s, step_c), mul(c, step_s));
+            c = next_c;
+            Lanes two_c = add(c, c);
+            Lanes below = splat(0.0f);
+            Lanes partial = s;
+            Lanes sum = mul(weights[0], partial);
+            for (int k = 1; k < HARMONICS; k++) {
+                Lanes above = sub(mul(two_c, partial), below);
+                below = partial;
+                partial = above;
+                sum = add(sum, mul(weights[k], partial));
+            }
+            float* mix = mix_ + i * LANES;
+            store(mix, add(load(mix), mul(sum, gain)));
+            gain = add(gain, gain_step);
+        }
+        store(cos_ + group, c);
+        store(sin_ + group, s);
+        store(gain_ + group, gain);
+        for (int v = group; v < group + LANES; v++) {
+            // the ramp lands on 0 give or take rounding
+            if (voices_[v].note < 0) {
+                gain_[v] = 0.0f;
+            }
+        }
+    }
+    for (int i = 0; i < frames; i++) {
+        float sum = 0.0f;
+        for (int l = 0; l < LANES; l++) {
+            sum += mix_[i * LANES + l];
+        }
+        out[i] = sum;
+    }
+}
+
+const char* GridOscillatorBank::simd()
+{
+    return SIMD;
+}
@@ -0,0 +1,111 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#pragma once
+
+// ======================================================================
+// A small bank of additive voices, one per finger, for when FluidSynth's
+// SF2 voices are more than a patch needs.  Each voice is HARMONICS sine
+// partials of its note, played straight from the finger's midi:
+//   X - pitch bend, over pitchBendRange() semitones
+//   Y - the modulation controller, the brightness: how strong the upper
+//       partials are
+//   Z - velocity, then poly key pressure, the loudness
+// X & Y sent for a note change just its voice, sent for the channel
+// change all of the channel's.  Pitch, brightness & loudness are set
+// every CONTROL_FRAMES, the loudness ramping across them so it doesn't
+// click.
+//
+// The voices are kept as arrays, a voice per SIMD lane (AVX, SSE or
+// NEON, whatever the build targets), and render a lane group at a time.
+// Each holds its phase as a rotating cos,sin pair & makes the upper
+// partials from it with the Chebyshev recurrence, so there is no table
+// lookup or sin() per sample.  Groups with no sounding voice are
+// skipped.
+//
+// Not thread safe; the thread rendering calls everything.
+//
+class GridOscillatorBank
+{
+public:
+    static const int VOICES = 16;
+    static const int HARMONICS = 8;
+    static const int CONTROL_FRAMES = 32;
+    static const int CHANNELS = 64;     // the synth's
+    static const int MAX_LANES = 8;
+
+private:
+    struct Voice {
+        int channel;
+        int note;           // -1 when free
+        bool held;
+        float loudness;     // 0 to 1, from velocity & pressure
+        float bend;         // semitones
+        float brightness;   // 0 to 1
+        long long started;  // note ons before this one, for stealing
+    };
+
+    double sample_rate_;
+    int pitch_bend_range_;          // semitones
+    int brightness_controller_;
+    float bend_[CHANNELS];          // for new notes on the channel
+    float brightness_[CHANNELS];
+    Voice voices_[VOICES];
+    long long note_ons_;
+    long long voices_stolen_;
+    int active_;
+
+    // lane per voice, for the SIMD loop
+    alignas(32) float cos_[VOICES];
+    alignas(32) float sin_[VOICES];
+    alignas(32) float step_cos_[VOICES];     // rotation per frame
+    alignas(32) float step_sin_[VOICES];
+    alignas(32) float gain_[VOICES];
+    alignas(32) float gain_step_[VOICES];    // per frame, to the next control block's gain
+    alignas(32) float weights_[HARMONICS][VOICES];
+    alignas(32) float mix_[CONTROL_FRAMES * MAX_LANES];
+    float bright_[VOICES];          // smoothed brightness
+
+    int findVoice(int channel, int note);
+    int freeVoice();
+    void control(int frames);
+    void renderVoices(float* out, int frames);
+
+public:
+    explicit GridOscillatorBank(double sample_rate);
+
+    // silence every voice at once
+    void reset();
+    void pitchBendRange(int semitones) { pitch_bend_range_ = semitones; }
+    void brightnessController(int controller) { brightness_controller_ = controller; }
+
+    // a velocity of 0 releases the note.  True if a voice was stolen for
+    // it: the oldest released, else the oldest held.
+    bool noteOn(int channel, int note, int velocity);
+    // note -1 for the whole channel
+    void pitchBend(int channel, int value, int note = -1);
+    void controlChange(int channel, int controller, int value, int note = -1);
+    void polyKeyPressure(int channel, int note, int pressure);
+
+    // the next frames, mono in left & right
+    void render(float* left, float* right, int frames);
+
+    int activeVoices() { return active_; }
+    long long voicesStolen() { return voices_stolen_; }
+    // the instruction set the voices render with
+    static const char* simd();
+};
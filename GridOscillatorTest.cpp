@@ -0,0 +1,88 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridOscillator.h"
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// ======================================================================
+// GridOscillatorTest - plays the oscillator bank at the top & bottom of
+// the note range, bent fully up & down, at the sample rates the synth
+// runs at.  Notes whose partials are all past the top of the band must
+// go quiet, not fill the output with NaN.  Every sample must be finite
+// & within full scale, and a middle note must be heard.  Exits non-zero
+// on a failure.
+//
+
+static const double SAMPLE_RATES[] = { 22050.0, 44100.0, 48000.0, 96000.0 };
+static const int BEND_RANGE = 12;       // semitones, the most the prefs allow
+static const int BLOCK_FRAMES = 256;
+static const int BLOCKS = 20;
+
+// peak of the bank's output over BLOCKS, or -1 if a sample wasn't finite
+static float play(GridOscillatorBank& bank)
+{
+    std::vector<float> left(BLOCK_FRAMES), right(BLOCK_FRAMES);
+    float peak = 0.0f;
+    for (int b = 0; b < BLOCKS; b++) {
+        bank.render(left.data(), right.data(), BLOCK_FRAMES);
+        for (int i = 0; i < BLOCK_FRAMES; i++) {
+            if (!std::isfinite(left[i]) || !std::isfinite(right[i])) {
+                return -1.0f;
+            }
+            peak = std::max(peak, std::fabs(left[i]));
+        }
+    }
+    return peak;
+}
+
+int main()
+{
+    long long checks = 0;
+    long long failures = 0;
+    for (double sample_rate : SAMPLE_RATES) {
+        for (int note : { 0, 60, 100, 123, 127 }) {
+            for (int bend : { 0, 0x2000, 0x3fff }) {
+                GridOscillatorBank bank(sample_rate);
+                bank.pitchBendRange(BEND_RANGE);
+                // a chord, so the voices that are still audible share lanes
+                // with those that aren't
+                for (int channel = 0; channel < 4; channel++) {
+                    bank.pitchBend(channel, bend);
+                    bank.noteOn(channel, note - channel, 127);
+                }
+                float peak = play(bank);
+                bool heard = (note != 60 || bend != 0x2000 || peak > 0.0f);
+                checks++;
+                if ((peak < 0.0f || peak > 1.0f || !heard) && failures++ < 10) {
+                    std::cerr << "GridOscillatorBank: note " << note << " bend " << bend << " at "
+                        << sample_rate << " Hz peaked at " << peak << std::endl;
+                }
+                bank.noteOn(0, note, 0);
+                checks++;
+                if (play(bank) < 0.0f && failures++ < 10) {
+                    std::cerr << "GridOscillatorBank: note " << note << " bend " << bend << " at "
+                        << sample_rate << " Hz not finite after release" << std::endl;
+                }
+            }
+        }
+    }
+    std::cout << "GridOscillatorTest: " << checks << " checks, " << failures << " failures" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#pragma once
+
+// ======================================================================
+// The few Windows types used by the portable instrument core.  On
+// Windows they come from the SDK.  Elsewhere (the headless CMake build)
+// we define compatible ones.
+//
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#else
+typedef long LONG;
+typedef struct tagPOINT { LONG x; LONG y; } POINT;
+typedef struct tagRECT { LONG left; LONG top; LONG right; LONG bottom; } RECT;
+typedef struct HMIDIOUT__* HMIDIOUT;
+#endif
@@ -16,52 +16,132 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 // ======================================================================
 #include "GridPointer.h"
+#include <cmath>
 
 // ======================================================================
-// Default contstructor.  FIXME would like to know why I need this.
+// Start with no pointers.
 //
-GridPointer::GridPointer()
+GridPointers::GridPointers()
 {
-    id_ = -1;
-    rect_ = RECT{ 0,0,0,0 };
-    point_ = POINT{ 0,0 };
-    pressure_ = 0;
-    starting_point_ = POINT{ 0,0 };
-    note_ = 0;
-    channel_ = 0;
-    modulation_x_ = modulation_y_ = modulation_z_ = 0;
+    count_ = 0;
+    overflows_ = 0;
 }
 
 // ======================================================================
-// Standard Constructor.  Used when we get a finger down touch event.
+// linear size of a touch, the side of a square with the same area
 //
-GridPointer::GridPointer(int id, RECT rect, POINT point, int pressure) :
-    id_(id), rect_(rect), point_(point), pressure_(pressure)
+static float rectSize(RECT rect)
 {
-    starting_point_ = point;
+    float area = static_cast<float>(rect.right - rect.left) * static_cast<float>(rect.bottom - rect.top);
+    return sqrtf(area);
+}
+
+// ======================================================================
+// Add a pointer when we get a finger down touch event.  Returns the slot
+// or -1 if the table is full and the touch was dropped.
+//
+int GridPointers::add(int id, RECT rect, POINT point, int pressure)
+{
+    if (count_ == MAX_POINTERS) {
+        overflows_++;
+        return -1;
+    }
+    int slot = count_++;
+    ids_[slot] = id;
+    rects_[slot] = rect;
+    points_[slot] = point;
+    pressures_[slot] = pressure;
+    starting_points_[slot] = point;
     // setters will update these values
-    note_ = 0;
-    channel_ = 0;
-    modulation_x_ = modulation_y_ = modulation_z_ = 0;
+    notes_[slot] = 0;
+    channels_[slot] = 0;
+    channels_taken_[slot] = false;
+    modulation_x_[slot] = modulation_y_[slot] = modulation_z_[slot] = 0;
+    filter_x_[slot].reset(static_cast<float>(point.x));
+    filter_y_[slot].reset(static_cast<float>(point.y));
+    filter_size_[slot].reset(rectSize(rect));
+    times_[slot] = 0;
+    return slot;
+}
+
+// ======================================================================
+// return the slot holding this id or -1 if not found.
+//
+int GridPointers::find(int id)
+{
+    for (int slot = 0; slot < count_; slot++) {
+        if (ids_[slot] == id) {
+            return slot;
+        }
+    }
+    return -1;
 }
 
 // ======================================================================
 // update the pointer values on touch update event
 // 
-void GridPointer::update(RECT rect, POINT point, int pressure)
+void GridPointers::update(int slot, RECT rect, POINT point, int pressure)
 {
-    rect_ = rect;
-    point_ = point;
-    pressure_ = pressure;
+    rects_[slot] = rect;
+    points_[slot] = point;
+    pressures_[slot] = pressure;
+}
+
+// ======================================================================
+// remove a pointer by moving the last active slot into its place.
+//
+void GridPointers::remove(int slot)
+{
+    int last = --count_;
+    if (slot != last) {
+        ids_[slot] = ids_[last];
+        rects_[slot] = rects_[last];
+        points_[slot] = points_[last];
+        pressures_[slot] = pressures_[last];
+        starting_points_[slot] = starting_points_[last];
+        notes_[slot] = notes_[last];
+        channels_[slot] = channels_[last];
+        channels_taken_[slot] = channels_taken_[last];
+        modulation_x_[slot] = modulation_x_[last];
+        modulation_y_[slot] = modulation_y_[last];
+        modulation_z_[slot] = modulation_z_[last];
+        filter_x_[slot] = filter_x_[last];
+        filter_y_[slot] = filter_y_[last];
+        filter_size_[slot] = filter_size_[last];
+        times_[slot] = times_[last];
+    }
 }
 
 // ======================================================================
 // return the dx,dy between the current point and starting point.
 //
-POINT GridPointer::pointChange()
+POINT GridPointers::pointChange(int slot)
+{
+    POINT delta;
+    delta.x = points_[slot].x - starting_points_[slot].x;
+    delta.y = points_[slot].y - starting_points_[slot].y;
+    return delta;
+}
+
+// ======================================================================
+// run the current point & rect through the expression filters.  dt is
+// the time in seconds since the previous sample.
+//
+void GridPointers::filter(int slot, float dt, const GridFilterParams& point_params, const GridFilterParams& size_params)
+{
+    GridFilter::Step step(dt);
+    filter_x_[slot].filter(static_cast<float>(points_[slot].x), step, point_params);
+    filter_y_[slot].filter(static_cast<float>(points_[slot].y), step, point_params);
+    filter_size_[slot].filter(rectSize(rects_[slot]), step, size_params);
+}
+
+// ======================================================================
+// like pointChange(), but from the filtered point.
+//
+POINT GridPointers::filteredPointChange(int slot)
 {
     POINT delta;
-    delta.x = point_.x - starting_point_.x;
-    delta.y = point_.y - starting_point_.y;
+    delta.x = static_cast<LONG>(std::floor(filter_x_[slot].value() + 0.5f)) - starting_points_[slot].x;
+    delta.y = static_cast<LONG>(std::floor(filter_y_[slot].value() + 0.5f)) - starting_points_[slot].y;
     return delta;
 }
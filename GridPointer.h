@@ -16,41 +16,91 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 // ======================================================================
 #pragma once
-#include <wtypes.h>
-class GridPointer
+#include "GridFilter.h"
+#include "GridPlatform.h"
+
+// ======================================================================
+// one raw touch event from the OS, as passed from the UI thread to the
+// control thread.  A frame of these (all contacts plus any coalesced
+// history) is handled by GridStrument::pointerFrame.
+//
+enum class TouchType { DOWN, UPDATE, UP };
+struct TouchSample
+{
+    TouchType type;
+    long long time;  // OS timestamp (pointerInfo.PerformanceCount)
+    int   id;        // unique ID for each touch on screen
+    RECT  rect;      // size of finger touch area (client coords)
+    POINT point;     // center x,y of touch (client coords)
+    int   pressure;
+};
+
+// ======================================================================
+// Fixed-capacity table of all the current finger touches.  Stored as a
+// structure-of-arrays with the active entries packed at the front, so
+// finding an id is a short scan of ids_ and touch handling never
+// allocates.  Entries are addressed by slot index, which is only valid
+// until the next add() or remove().
+//
+// Overflow policy: when all MAX_POINTERS slots are in use, add() drops
+// the new touch & returns -1.  Later updates for that id are not found
+// and are ignored.  Dropped touches are counted in overflows().
+//
+class GridPointers
 {
+public:
+    static const int MAX_POINTERS = 32;
+private:
+    int   count_;                              // number of active slots
+    int   overflows_;                          // touches dropped when full
     // data from OS
-    int   id_;             // unique ID for each touch on screen
-    RECT  rect_;           // size of finger touch area, used for pressure
-    POINT point_;          // center x,y of touch
-    int   pressure_;       // unfortunately, a fixed value and not useful
-    POINT starting_point_; // keep track of initial x,y location
+    int   ids_[MAX_POINTERS];                  // unique ID for each touch on screen
+    RECT  rects_[MAX_POINTERS];                // size of finger touch area, used for pressure
+    POINT points_[MAX_POINTERS];               // center x,y of touch
+    int   pressures_[MAX_POINTERS];            // unfortunately, a fixed value and not useful
+    POINT starting_points_[MAX_POINTERS];      // keep track of initial x,y location
     // higher-level associated data
-    int note_;             // midi note of initial x,y
-    int channel_;          // midi channel selected for this pointer  
-    int modulation_x_;     // midi modulation in +/- X direction
-    int modulation_y_;     // midi modulation in +/- Y direction
-    int modulation_z_;     // midi modulation in +/- Z direction (pressure)
+    int   notes_[MAX_POINTERS];                // midi note of initial x,y
+    int   channels_[MAX_POINTERS];             // midi channel selected for this pointer
+    bool  channels_taken_[MAX_POINTERS];       // from GridChannels::take(), so to release
+    int   modulation_x_[MAX_POINTERS];         // midi modulation in +/- X direction
+    int   modulation_y_[MAX_POINTERS];         // midi modulation in +/- Y direction
+    int   modulation_z_[MAX_POINTERS];         // midi modulation in +/- Z direction (pressure)
+    // smoothed x,y & touch size (sqrt of rect area) for expression
+    GridFilter filter_x_[MAX_POINTERS];
+    GridFilter filter_y_[MAX_POINTERS];
+    GridFilter filter_size_[MAX_POINTERS];
+    long long  times_[MAX_POINTERS];           // OS timestamp of last sample, 0 if none
 public:
-    GridPointer();
-    GridPointer(int id, RECT rect, POINT point, int pressure);
-    void update(RECT rect, POINT point, int pressure);
-    POINT pointChange();
+    GridPointers();
+    int add(int id, RECT rect, POINT point, int pressure);
+    int find(int id);
+    void update(int slot, RECT rect, POINT point, int pressure);
+    void remove(int slot);
+    POINT pointChange(int slot);
+    void filter(int slot, float dt, const GridFilterParams& point_params, const GridFilterParams& size_params);
+    POINT filteredPointChange(int slot);
+    float filteredSize(int slot) { return filter_size_[slot].value(); }
+    int size() { return count_; }
+    int overflows() { return overflows_; }
     // getters
-    int id() { return id_; };
-    RECT rect() { return rect_; };
-    POINT point() { return point_; };
-    int pressure() { return pressure_; }; // NOTE: does not change!
+    int id(int slot) { return ids_[slot]; }
+    RECT rect(int slot) { return rects_[slot]; }
+    POINT point(int slot) { return points_[slot]; }
+    int pressure(int slot) { return pressures_[slot]; } // NOTE: does not change!
     // getters/setters
-    void note(int note) { note_ = note; }
-    int note() { return note_; }
-    void channel(int channel) { channel_ = channel; }
-    int channel() { return channel_; }
-    void modulationX(int modulation_x) { modulation_x_ = modulation_x; }
-    int modulationX() { return modulation_x_; }
-    void modulationY(int modulation_y) { modulation_y_ = modulation_y; }
-    int modulationY() { return modulation_y_; }
-    void modulationZ(int modulation_z) { modulation_z_ = modulation_z; }
-    int modulationZ() { return modulation_z_; }
+    void note(int slot, int note) { notes_[slot] = note; }
+    int note(int slot) { return notes_[slot]; }
+    void channel(int slot, int channel) { channels_[slot] = channel; }
+    int channel(int slot) { return channels_[slot]; }
+    void channelTaken(int slot, bool taken) { channels_taken_[slot] = taken; }
+    bool channelTaken(int slot) { return channels_taken_[slot]; }
+    void modulationX(int slot, int modulation_x) { modulation_x_[slot] = modulation_x; }
+    int modulationX(int slot) { return modulation_x_[slot]; }
+    void modulationY(int slot, int modulation_y) { modulation_y_[slot] = modulation_y; }
+    int modulationY(int slot) { return modulation_y_[slot]; }
+    void modulationZ(int slot, int modulation_z) { modulation_z_[slot] = modulation_z; }
+    int modulationZ(int slot) { return modulation_z_[slot]; }
+    void time(int slot, long long time) { times_[slot] = time; }
+    long long time(int slot) { return times_[slot]; }
 };
-
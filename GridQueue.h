@@ -0,0 +1,66 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+// ======================================================================
+// Lock-free single-producer/single-consumer ring buffer.  One thread may
+// push() and one other thread may pop().  Neither call blocks or
+// allocates; push() returns false when full & pop() returns false when
+// empty.  N must be a power of 2.
+//
+template <class T, size_t N>
+class GridQueue
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "GridQueue size must be a power of 2");
+    T buffer_[N];
+    alignas(64) std::atomic<size_t> head_;  // next slot to write, owned by producer
+    alignas(64) std::atomic<size_t> tail_;  // next slot to read, owned by consumer
+public:
+    GridQueue() : head_(0), tail_(0) {}
+
+    bool push(const T& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        buffer_[head & (N - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (head_.load(std::memory_order_acquire) == tail) {
+            return false;
+        }
+        item = buffer_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    // free slots, for the producer.  The consumer may free more meanwhile.
+    size_t space() {
+        return N - (head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_acquire));
+    }
+};
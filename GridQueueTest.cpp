@@ -0,0 +1,178 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridControl.h"
+#include "GridMidi.h"
+#include "GridQueue.h"
+#include "GridStrument.h"
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// ======================================================================
+// GridQueueTest - stress tests the SPSC queue between the UI & control
+// threads.  Exits non-zero on any lost, repeated or reordered item.
+//
+// First a producer thread pushes sequence numbered TouchSamples through
+// a small GridQueue as fast as it can while this thread pops them, so
+// the queue runs full & empty over and over.  Every field carries the
+// sequence number, so a torn copy shows up too.
+//
+// Then the same through GridControl itself: a thread push()es a finger
+// down & up per sequence number, each in the next grid column, and the
+// note ons the GridStrument sends must be those columns' notes, in
+// order, one each.
+//
+
+static const long long QUEUE_ITEMS = 10000000;
+static const int CONTROL_TOUCHES = 1000000;
+static const int PUSH_FRAME = 3;        // samples per push(), so frames straddle batches
+
+static TouchSample sequenceSample(long long seq)
+{
+    int low = static_cast<int>(seq);
+    return { TouchType::UPDATE, seq, low, { low, low + 1, low + 2, low + 3 }, { low + 4, low + 5 }, low + 6 };
+}
+
+static bool sameSample(const TouchSample& a, const TouchSample& b)
+{
+    return a.type == b.type && a.time == b.time && a.id == b.id && a.rect.left == b.rect.left &&
+        a.rect.top == b.rect.top && a.rect.right == b.rect.right && a.rect.bottom == b.rect.bottom &&
+        a.point.x == b.point.x && a.point.y == b.point.y && a.pressure == b.pressure;
+}
+
+// ======================================================================
+static int testQueue()
+{
+    static GridQueue<TouchSample, 64> queue;
+    std::atomic<bool> pushed_all(false);
+    std::thread producer([&pushed_all] {
+        for (long long seq = 0; seq < QUEUE_ITEMS; seq++) {
+            TouchSample sample = sequenceSample(seq);
+            while (!queue.push(sample)) {
+                std::this_thread::yield();
+            }
+        }
+        pushed_all.store(true);
+    });
+    long long received = 0;
+    long long failures = 0;
+    while (received < QUEUE_ITEMS) {
+        TouchSample sample;
+        if (!queue.pop(sample)) {
+            // with everything pushed, an empty queue means items were lost
+            if (pushed_all.load() && queue.empty()) {
+                std::cerr << "GridQueue: only " << received << " items arrived" << std::endl;
+                failures++;
+                break;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        if (!sameSample(sample, sequenceSample(received)) && failures++ < 10) {
+            std::cerr << "GridQueue: item " << received << " arrived as " << sample.time << std::endl;
+        }
+        received++;
+    }
+    producer.join();
+    if (!queue.empty()) {
+        std::cerr << "GridQueue: items left after the last" << std::endl;
+        failures++;
+    }
+    std::cout << "GridQueue: " << received << " items, " << failures << " failures" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
+
+// ======================================================================
+class GridTest
+{
+    GridStrument& grid_;
+public:
+    explicit GridTest(GridStrument& grid) : grid_(grid) {}
+    int columns() { return grid_.num_grids_x_; }
+    int note(POINT point) { return grid_.pointToMidiNote(point); }
+};
+
+static int testControl()
+{
+    const int GRID_SIZE = 100;
+    GridStrument grid(nullptr);
+    grid.prefHexGridMode(false);
+    grid.prefGridSize(GRID_SIZE);
+    grid.resize(1920, 1080);
+    GridTest test(grid);
+    int columns = test.columns();
+    auto touchPoint = [columns](int seq) {
+        return POINT{ (seq % columns) * GRID_SIZE + GRID_SIZE / 2, 5 * GRID_SIZE + GRID_SIZE / 2 };
+    };
+
+    // a note on, a note off & a modulation reset per touch
+    std::vector<uint32_t> messages(3 * static_cast<size_t>(CONTROL_TOUCHES));
+    GridCaptureSink capture(messages.data(), messages.size());
+    grid.midiOutput()->addSink(&capture);
+    GridControl control(&grid);
+    control.start();
+    std::thread producer([&control, &touchPoint] {
+        std::vector<TouchSample> frame;
+        for (int seq = 0; seq < CONTROL_TOUCHES; seq++) {
+            POINT point = touchPoint(seq);
+            RECT rect = { point.x - 20, point.y - 20, point.x + 20, point.y + 20 };
+            long long time = 2LL * seq + 1;
+            frame.push_back({ TouchType::DOWN, time, seq, rect, point, 512 });
+            frame.push_back({ TouchType::UP, time + 1, seq, rect, point, 512 });
+            if (frame.size() >= PUSH_FRAME) {
+                control.push(frame.data(), static_cast<int>(frame.size()));
+                frame.clear();
+            }
+        }
+        control.push(frame.data(), static_cast<int>(frame.size()));
+    });
+    producer.join();
+    control.stop();
+
+    int seq = 0;
+    long long failures = 0;
+    for (size_t i = 0; i < capture.size(); i++) {
+        uint32_t message = messages[i];
+        if ((message & 0xf0) != MIDI::NOTE_ON || ((message >> 16) & 0x7f) == 0) {
+            continue;
+        }
+        int got = (message >> 8) & 0x7f;
+        int want = test.note(touchPoint(seq));
+        if (got != want && failures++ < 10) {
+            std::cerr << "GridControl: touch " << seq << " played note " << got << ", want " << want << std::endl;
+        }
+        seq++;
+    }
+    if (seq != CONTROL_TOUCHES || capture.count() != capture.size()) {
+        std::cerr << "GridControl: " << seq << " note ons for " << CONTROL_TOUCHES << " touches" << std::endl;
+        failures++;
+    }
+    std::cout << "GridControl: " << CONTROL_TOUCHES << " touches, " << failures << " failures" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
+
+int main()
+{
+    std::wcout.setstate(std::ios::failbit);
+    int failed = testQueue();
+    failed |= testControl();
+    return failed;
+}
@@ -0,0 +1,264 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridRecorder.h"
+#include "GridLatency.h"
+
+#include <cstdio>
+#include <cstring>
+
+// dump file: magic, ticks per second, header length & text, block count,
+// then each block's base time, used length & data.
+static const char RECORDER_MAGIC[8] = { 'G', 'R', 'I', 'D', 'R', 'E', 'C', '1' };
+
+// record tags.  TouchType values come first.
+static const uint8_t TAG_MIDI = 3;
+static const uint8_t TAG_FRAME = 4;
+static const uint8_t TAG_SYNTH_MIDI = 5;     // then the channel, past 15
+
+// largest record: tag, time, id, 6 coordinates & pressure
+static const int MAX_RECORD_SIZE = 1 + 10 + 5 + 6 * 5 + 5;
+
+// ======================================================================
+// LEB128 varints, with zigzag for signed values
+//
+static inline uint8_t* putVarint(uint8_t* p, uint64_t value)
+{
+    while (value >= 0x80) {
+        *p++ = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = static_cast<uint8_t>(value);
+    return p;
+}
+
+static inline uint8_t* putSigned(uint8_t* p, long long value)
+{
+    return putVarint(p, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+static bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        value |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool getSigned(const uint8_t*& p, const uint8_t* end, long long& value)
+{
+    uint64_t u;
+    if (!getVarint(p, end, u)) {
+        return false;
+    }
+    value = static_cast<long long>(u >> 1) ^ -static_cast<long long>(u & 1);
+    return true;
+}
+
+// ======================================================================
+GridRecorder::GridRecorder() : blocks_(NUM_BLOCKS)
+{
+    reset();
+}
+
+void GridRecorder::reset()
+{
+    num_started_ = 0;
+    block_ = nullptr;
+    last_time_ = 0;
+    last_point_ = { 0, 0 };
+}
+
+// ======================================================================
+// room for one record, starting a new block when the current one is full
+//
+uint8_t* GridRecorder::reserve(long long time)
+{
+    if (block_ == nullptr || block_->used + MAX_RECORD_SIZE > BLOCK_SIZE) {
+        block_ = &blocks_[num_started_ % NUM_BLOCKS];
+        num_started_++;
+        block_->base_time = time;
+        block_->used = 0;
+        last_time_ = time;
+        last_point_ = { 0, 0 };
+    }
+    return block_->data + block_->used;
+}
+
+void GridRecorder::touch(const TouchSample& sample)
+{
+    uint8_t* p = reserve(sample.time);
+    *p++ = static_cast<uint8_t>(sample.type);
+    p = putSigned(p, sample.time - last_time_);
+    p = putVarint(p, static_cast<uint32_t>(sample.id));
+    if (sample.type != TouchType::UP) {
+        p = putSigned(p, sample.point.x - last_point_.x);
+        p = putSigned(p, sample.point.y - last_point_.y);
+        p = putSigned(p, sample.rect.left - sample.point.x);
+        p = putSigned(p, sample.rect.top - sample.point.y);
+        p = putSigned(p, sample.rect.right - sample.point.x);
+        p = putSigned(p, sample.rect.bottom - sample.point.y);
+        p = putVarint(p, static_cast<uint32_t>(sample.pressure));
+        last_point_ = sample.point;
+    }
+    last_time_ = sample.time;
+    commit(p);
+}
+
+void GridRecorder::midi(long long time, uint32_t message, int channel)
+{
+    bool wide = channel != static_cast<int>(message & 0x0f);
+    uint8_t* p = reserve(time);
+    *p++ = wide ? TAG_SYNTH_MIDI : TAG_MIDI;
+    p = putSigned(p, time - last_time_);
+    *p++ = static_cast<uint8_t>(message);
+    *p++ = static_cast<uint8_t>(message >> 8);
+    *p++ = static_cast<uint8_t>(message >> 16);
+    if (wide) {
+        *p++ = static_cast<uint8_t>(channel);
+    }
+    last_time_ = time;
+    commit(p);
+}
+
+void GridRecorder::frame(long long time)
+{
+    uint8_t* p = reserve(time);
+    *p++ = TAG_FRAME;
+    p = putSigned(p, time - last_time_);
+    last_time_ = time;
+    commit(p);
+}
+
+// ======================================================================
+// plain stdio so this can run from a crash handler.  Returns false if
+// the file can't be written.
+//
+bool GridRecorder::dump(const char* path, const std::string& header)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == nullptr) {
+        return false;
+    }
+    uint64_t num_blocks = (num_started_ < NUM_BLOCKS) ? num_started_ : NUM_BLOCKS;
+    long long ticks = GridClock::ticksPerSecond();
+    uint32_t header_size = static_cast<uint32_t>(header.size());
+    uint32_t block_count = static_cast<uint32_t>(num_blocks);
+    bool ok = fwrite(RECORDER_MAGIC, sizeof(RECORDER_MAGIC), 1, f) == 1;
+    ok = ok && fwrite(&ticks, sizeof(ticks), 1, f) == 1;
+    ok = ok && fwrite(&header_size, sizeof(header_size), 1, f) == 1;
+    ok = ok && fwrite(header.data(), 1, header_size, f) == header_size;
+    ok = ok && fwrite(&block_count, sizeof(block_count), 1, f) == 1;
+    for (uint64_t i = num_started_ - num_blocks; ok && i < num_started_; i++) {
+        const Block& block = blocks_[i % NUM_BLOCKS];
+        ok = fwrite(&block.base_time, sizeof(block.base_time), 1, f) == 1;
+        ok = ok && fwrite(&block.used, sizeof(block.used), 1, f) == 1;
+        ok = ok && fwrite(block.data, 1, block.used, f) == block.used;
+    }
+    return (fclose(f) == 0) && ok;
+}
+
+// ======================================================================
+// decode a dump() file.  Times are in the recording's GridClock ticks.
+//
+bool GridRecorder::load(const char* path, std::string& header, std::vector<GridRecord>& records)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == nullptr) {
+        return false;
+    }
+    char magic[sizeof(RECORDER_MAGIC)];
+    long long ticks;
+    uint32_t header_size, block_count;
+    bool ok = fread(magic, sizeof(magic), 1, f) == 1 &&
+        memcmp(magic, RECORDER_MAGIC, sizeof(magic)) == 0 &&
+        fread(&ticks, sizeof(ticks), 1, f) == 1 &&
+        fread(&header_size, sizeof(header_size), 1, f) == 1;
+    if (ok) {
+        header.resize(header_size);
+        ok = fread(&header[0], 1, header_size, f) == header_size &&
+            fread(&block_count, sizeof(block_count), 1, f) == 1;
+    }
+    std::vector<uint8_t> data(BLOCK_SIZE);
+    for (uint32_t b = 0; ok && b < block_count; b++) {
+        long long time;
+        uint32_t used;
+        ok = fread(&time, sizeof(time), 1, f) == 1 &&
+            fread(&used, sizeof(used), 1, f) == 1 && used <= BLOCK_SIZE &&
+            fread(data.data(), 1, used, f) == used;
+        POINT point = { 0, 0 };
+        const uint8_t* p = data.data();
+        const uint8_t* end = p + (ok ? used : 0);
+        while (ok && p < end) {
+            GridRecord record{};
+            uint8_t tag = *p++;
+            long long delta = 0;
+            ok = tag <= TAG_SYNTH_MIDI && getSigned(p, end, delta);
+            time += delta;
+            record.sample.time = time;
+            if (ok && tag == TAG_FRAME) {
+                record.type = RecordType::FRAME;
+            }
+            else if (ok && (tag == TAG_MIDI || tag == TAG_SYNTH_MIDI)) {
+                int size = (tag == TAG_MIDI) ? 3 : 4;
+                ok = end - p >= size;
+                if (ok) {
+                    record.type = RecordType::MIDI;
+                    record.message = p[0] | (p[1] << 8) | (p[2] << 16);
+                    record.channel = (tag == TAG_MIDI) ? (p[0] & 0x0f) : p[3];
+                    p += size;
+                }
+            }
+            else if (ok) {
+                uint64_t id = 0;
+                record.type = RecordType::TOUCH;
+                record.sample.type = static_cast<TouchType>(tag);
+                ok = getVarint(p, end, id);
+                record.sample.id = static_cast<int>(id);
+                if (ok && record.sample.type != TouchType::UP) {
+                    long long v[6] = {};
+                    uint64_t pressure = 0;
+                    for (int i = 0; ok && i < 6; i++) {
+                        ok = getSigned(p, end, v[i]);
+                    }
+                    ok = ok && getVarint(p, end, pressure);
+                    if (!ok) {
+                        break;
+                    }
+                    point.x += static_cast<LONG>(v[0]);
+                    point.y += static_cast<LONG>(v[1]);
+                    record.sample.point = point;
+                    record.sample.rect.left = point.x + static_cast<LONG>(v[2]);
+                    record.sample.rect.top = point.y + static_cast<LONG>(v[3]);
+                    record.sample.rect.right = point.x + static_cast<LONG>(v[4]);
+                    record.sample.rect.bottom = point.y + static_cast<LONG>(v[5]);
+                    record.sample.pressure = static_cast<int>(pressure);
+                }
+            }
+            if (ok) {
+                records.push_back(record);
+            }
+        }
+    }
+    fclose(f);
+    return ok;
+}
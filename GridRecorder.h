@@ -0,0 +1,76 @@
+#pragma once
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridPointer.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ======================================================================
+// Always-on flight recorder of the touch samples reaching GridStrument
+// (and where each frame of them starts) and the midi messages leaving
+// GridMidi.  Records are delta & varint encoded into fixed-size blocks
+// kept in a ring, so the oldest block is dropped whole and every block
+// decodes on its own.  Recording only writes a few bytes into memory.
+// Nothing goes to disk until dump().
+//
+// Not thread safe: record from the thread that handles the pointers and
+// dump() while holding it off (or from a crash handler, best effort).
+//
+enum class RecordType { TOUCH, MIDI, FRAME };
+struct GridRecord
+{
+    RecordType type;
+    TouchSample sample;      // sample.time is the time for all types
+    uint32_t message;        // midi message, for MIDI
+    int channel;             // its channel, past 15 for the synth alone
+};
+
+class GridRecorder
+{
+public:
+    static const int BLOCK_SIZE = 4096;
+    static const int NUM_BLOCKS = 256;      // 1 MB, about a minute of busy playing
+private:
+    struct Block {
+        long long base_time;                // time the deltas start from
+        uint32_t used;                      // bytes used in data
+        uint8_t data[BLOCK_SIZE];
+    };
+    std::vector<Block> blocks_;
+    uint64_t num_started_;                  // blocks started since reset
+    Block* block_;                          // current block
+    long long last_time_;                   // previous record in block_
+    POINT last_point_;
+
+    uint8_t* reserve(long long time);
+    void commit(uint8_t* end) { block_->used = static_cast<uint32_t>(end - block_->data); }
+public:
+    GridRecorder();
+    void touch(const TouchSample& sample);
+    // channel is the message's own, or one past midi's 16 for the synth
+    void midi(long long time, uint32_t message, int channel);
+    void frame(long long time);
+    void reset();
+    // write the recording, oldest first.  header is saved as-is, we use
+    // it for the GridReplay session lines (size & prefs).
+    bool dump(const char* path, const std::string& header);
+    // read a dump() back
+    static bool load(const char* path, std::string& header, std::vector<GridRecord>& records);
+};
@@ -0,0 +1,298 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridLatency.h"
+#include "GridRecorder.h"
+#include "GridSynth.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// ======================================================================
+// GridRender - offline FluidSynth benchmark.  Plays the midi in a
+// GridRecorder dump (see GridReplay --record) through GridSynth with no
+// audio driver, rendering blocks with fluid_synth_write_float as fast as
+// it can, and prints JSON: the real time factor, peak voices, render
+// time per block and a checksum of the audio, which only changes when
+// the synth's output does.  Events are applied at the start of the
+// block they fall in, as FluidSynth's own audio drivers do, or with
+// --exact at their frame, as GridSynth's audio callback does.
+//
+// --engine oscillators plays the dump on GridSynth's own oscillator
+// bank instead, for comparing the two on the same touches.  It needs no
+// soundfont; one given is loaded but not played.
+//
+// usage:
+//   GridRender <dump> [<soundfont>] [--block N] [--tail S] [--repeat N]
+//              [--rate HZ] [--cores N] [--shards N] [--exact] [--governor LOAD]
+//              [--engine fluidsynth|oscillators]
+//
+// --block is frames per block (default 64), --tail seconds rendered after
+// the last event (default 2), --repeat renders the whole dump N times
+// with a fresh synth and keeps the fastest.  --rate, --cores & --shards
+// set the synth's sample rate, threads & synths, as GridSynthConfig.  --governor turns on
+// GridSynth's load governor, off here so the audio is repeatable.  Offline
+// a block renders in a small fraction of its time, so a LOAD well below
+// the default 0.8, like 0.002, is what makes it step down & back up.
+// Its steps are logged & counted in the JSON; the audio then depends on
+// timing, so runs may differ.
+//
+
+struct MidiEvent
+{
+    long long frame;      // sample frame the event is due in
+    uint32_t message;
+    int channel;
+};
+
+// the instrument's prefs the oscillators need, from the dump's header,
+// else GridStrument's defaults
+struct DumpPrefs
+{
+    int pitch_bend_range = 12;
+    int modulation_controller = 1;
+};
+
+struct RenderResult
+{
+    double seconds = 0;
+    int peak_voices = 0;
+    uint64_t checksum = 0;
+    GridSynthStats stats;
+};
+
+// ======================================================================
+// midi from the dump, timed in sample frames from the first touch or
+// message.  The clock & prefs come from the dump's header.
+//
+bool readEvents(const char* path, double sample_rate, std::vector<MidiEvent>& events, DumpPrefs& prefs)
+{
+    std::string header;
+    std::vector<GridRecord> records;
+    if (!GridRecorder::load(path, header, records)) {
+        std::cerr << path << ": unable to read flight recorder dump" << std::endl;
+        return false;
+    }
+    long long clock = GridClock::ticksPerSecond();
+    std::istringstream lines(header);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, 6, "clock ") == 0) {
+            clock = std::atoll(line.c_str() + 6);
+        }
+        else if (line.compare(0, 22, "pref pitch_bend_range ") == 0) {
+            prefs.pitch_bend_range = std::atoi(line.c_str() + 22);
+        }
+        else if (line.compare(0, 27, "pref modulation_controller ") == 0) {
+            prefs.modulation_controller = std::atoi(line.c_str() + 27);
+        }
+    }
+    if (records.empty() || clock <= 0) {
+        std::cerr << path << ": nothing to render" << std::endl;
+        return false;
+    }
+    long long start = records[0].sample.time;
+    for (const GridRecord& record : records) {
+        if (record.type == RecordType::MIDI) {
+            double seconds = static_cast<double>(record.sample.time - start) / clock;
+            events.push_back({ static_cast<long long>(seconds * sample_rate), record.message, record.channel });
+        }
+    }
+    // the ring may start mid-frame; keep time order for the block loop
+    std::stable_sort(events.begin(), events.end(),
+        [](const MidiEvent& a, const MidiEvent& b) { return a.frame < b.frame; });
+    return true;
+}
+
+// ======================================================================
+// render all the events plus the tail in blocks, timing each block
+//
+RenderResult render(const GridSynthConfig& config, const char* soundfont,
+    const std::vector<MidiEvent>& events, const DumpPrefs& prefs, int block_frames, double tail_seconds,
+    bool exact, GridHistogram& block_ns)
+{
+    RenderResult result;
+    GridSynth synth(config);
+    synth.expression(prefs.pitch_bend_range, prefs.modulation_controller);
+    if (soundfont != nullptr) {
+        synth.loadSoundfont(soundfont);
+        synth.waitSoundfont();
+    }
+
+    long long last_frame = events.empty() ? 0 : events.back().frame;
+    long long total_frames = last_frame + static_cast<long long>(tail_seconds * synth.sampleRate());
+    std::vector<float> left(block_frames), right(block_frames);
+    uint64_t hash = 14695981039346656037ull;
+    size_t next = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long long frame = 0; frame < total_frames; frame += block_frames) {
+        auto block_start = std::chrono::steady_clock::now();
+        // exact times are in frames
+        for (; next < events.size() && events[next].frame < frame + block_frames; next++) {
+            synth.send(events[next].message, exact ? events[next].frame : 0, events[next].channel);
+        }
+        if (exact) {
+            synth.renderTimed(left.data(), right.data(), block_frames, frame, 1.0);
+        }
+        else {
+            synth.render(left.data(), right.data(), block_frames);
+        }
+        synth.logGovernor();
+        block_ns.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - block_start).count());
+        result.peak_voices = std::max(result.peak_voices, synth.activeVoices());
+        // FNV-1a over the sample bits
+        for (int i = 0; i < block_frames; i++) {
+            uint32_t bits[2];
+            std::memcpy(&bits[0], &left[i], sizeof(float));
+            std::memcpy(&bits[1], &right[i], sizeof(float));
+            for (uint32_t b : bits) {
+                hash = (hash ^ b) * 1099511628211ull;
+            }
+        }
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.checksum = hash;
+    result.stats = synth.stats();
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    const char* dump_path = nullptr;
+    const char* soundfont_path = nullptr;
+    int block_frames = 64;
+    double tail_seconds = 2.0;
+    int repeat = 1;
+    bool exact = false;
+    GridSynthConfig config;
+    config.driver = "null";
+    config.governor_load = 0.0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--block" && has_value) block_frames = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--tail" && has_value) tail_seconds = std::max(0.0, std::atof(argv[++i]));
+        else if (arg == "--repeat" && has_value) repeat = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--rate" && has_value) config.sample_rate = std::atof(argv[++i]);
+        else if (arg == "--cores" && has_value) config.cpu_cores = std::atoi(argv[++i]);
+        else if (arg == "--shards" && has_value) config.shards = std::atoi(argv[++i]);
+        else if (arg == "--exact") exact = true;
+        else if (arg == "--governor" && has_value) config.governor_load = std::max(0.0, std::atof(argv[++i]));
+        else if (arg == "--engine" && has_value && std::strcmp(argv[i + 1], "fluidsynth") == 0) {
+            config.engine = SynthEngine::FLUIDSYNTH;
+            i++;
+        }
+        else if (arg == "--engine" && has_value && std::strcmp(argv[i + 1], "oscillators") == 0) {
+            config.engine = SynthEngine::OSCILLATORS;
+            i++;
+        }
+        else if (arg[0] != '-' && dump_path == nullptr) dump_path = argv[i];
+        else if (arg[0] != '-' && soundfont_path == nullptr) soundfont_path = argv[i];
+        else {
+            dump_path = nullptr;
+            break;
+        }
+    }
+    bool oscillators = (config.engine == SynthEngine::OSCILLATORS);
+    if (dump_path == nullptr || (soundfont_path == nullptr && !oscillators)) {
+        std::cerr << "usage: GridRender <dump> [<soundfont>] [--block N] [--tail S] [--repeat N]"
+            " [--rate HZ] [--cores N] [--shards N] [--exact] [--governor LOAD]"
+            " [--engine fluidsynth|oscillators]" << std::endl;
+        return 2;
+    }
+
+    double sample_rate, load_seconds;
+    long long soundfont_bytes;
+    {
+        GridSynth synth(config);
+        if (soundfont_path != nullptr) {
+            synth.loadSoundfont(soundfont_path);
+            if (!synth.waitSoundfont()) {
+                std::cerr << soundfont_path << ": unable to load soundfont" << std::endl;
+                return 1;
+            }
+        }
+        sample_rate = synth.sampleRate();
+        // as clamped
+        config.cpu_cores = synth.config().cpu_cores;
+        config.shards = synth.config().shards;
+        load_seconds = synth.loadSeconds();
+        soundfont_bytes = synth.loadBytes();
+    }
+    std::vector<MidiEvent> events;
+    DumpPrefs prefs;
+    if (!readEvents(dump_path, sample_rate, events, prefs)) {
+        return 1;
+    }
+
+    RenderResult best;
+    int best_run = 0;
+    std::unique_ptr<GridHistogram[]> block_ns(new GridHistogram[repeat]);
+    for (int r = 0; r < repeat; r++) {
+        RenderResult result = render(config, soundfont_path, events, prefs, block_frames, tail_seconds, exact,
+            block_ns[r]);
+        if (r > 0 && result.checksum != best.checksum && config.governor_load <= 0.0) {
+            std::cerr << "GridRender: audio differs between runs" << std::endl;
+            return 1;
+        }
+        if (r == 0 || result.seconds < best.seconds) {
+            best = result;
+            best_run = r;
+        }
+    }
+    long long total_frames = (events.empty() ? 0 : events.back().frame) +
+        static_cast<long long>(tail_seconds * sample_rate);
+    long long num_blocks = (total_frames + block_frames - 1) / block_frames;
+    double audio_seconds = num_blocks * block_frames / sample_rate;
+    GridHistogram& best_block_ns = block_ns[best_run];
+
+    char json[1024];
+    std::snprintf(json, sizeof(json),
+        "{\"dump\": \"%s\", \"soundfont\": \"%s\", \"engine\": \"%s\", \"simd\": \"%s\", "
+        "\"events\": %zu, \"sample_rate\": %.0f, "
+        "\"cpu_cores\": %d, \"shards\": %d, \"exact\": %s, "
+        "\"block_frames\": %d, \"audio_seconds\": %.3f, \"render_seconds\": %.6f, "
+        "\"realtime_factor\": %.1f, \"peak_voices\": %d, \"block_us_p50\": %.1f, "
+        "\"block_us_p99\": %.1f, \"block_us_max\": %.1f, \"block_us_budget\": %.1f, "
+        "\"soundfont_load_ms\": %.1f, \"soundfont_mb\": %.1f, \"governor_load\": %.4f, "
+        "\"governor_steps_down\": %lld, \"governor_steps_up\": %lld, \"voices_cut\": %lld, "
+        "\"audio_checksum\": %llu}",
+        dump_path, (soundfont_path != nullptr) ? soundfont_path : "",
+        oscillators ? "oscillators" : "fluidsynth", oscillators ? GridOscillatorBank::simd() : "",
+        events.size(), sample_rate,
+        config.cpu_cores, config.shards, exact ? "true" : "false",
+        block_frames, audio_seconds, best.seconds,
+        (best.seconds > 0) ? audio_seconds / best.seconds : 0.0, best.peak_voices,
+        best_block_ns.percentile(50.0) / 1000.0, best_block_ns.percentile(99.0) / 1000.0,
+        best_block_ns.max() / 1000.0, 1e6 * block_frames / sample_rate,
+        load_seconds * 1000.0, soundfont_bytes / (1024.0 * 1024.0), config.governor_load,
+        best.stats.governor_steps_down, best.stats.governor_steps_up, best.stats.voices_cut,
+        static_cast<unsigned long long>(best.checksum));
+    // GridSynth logs to wcout, so stdout is wide by now
+    std::wcout << json << std::endl;
+    return 0;
+}
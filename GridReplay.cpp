@@ -0,0 +1,637 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridRecorder.h"
+#include "GridMidiStream.h"
+#include "GridStrument.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// ======================================================================
+// GridReplay - headless benchmark that replays a recorded touch session
+// through GridStrument as fast as possible and reports the throughput
+// and the MIDI it produced as JSON.
+//
+// Session files are text, one item per line, '#' starts a comment:
+//   clock <ticks per second>   of the sample times, default 1000000
+//   size <width> <height>
+//   pref <name> <value> [<value>]
+//   down <time> <id> <x> <y> <left> <top> <right> <bottom> <pressure>
+//   move <time> <id> <x> <y> <left> <top> <right> <bottom> <pressure>
+//   up   <time> <id>
+//   frame                      the following samples arrive together
+// Without frame lines, samples with the same time are one frame.
+// A GridRecorder flight recorder dump can be used in place of a session
+// file, --print shows it (or any session) as session text.
+//
+// usage:
+//   GridReplay --generate <session> [--events N]
+//   GridReplay --print <session>
+//   GridReplay <session> [--repeat N] [--baseline <json>] [--tolerance F]
+//              [--record <dump>] [--midi-out <file>]
+//
+// --record sends the first pass through pointerFrame() and saves the
+// flight recorder, a handy way to check a dump replays the same.
+// --midi-out writes the first pass's MIDI as a running status byte
+// stream, as a serial port would get it.
+// With --baseline, exits non-zero if events/sec dropped by more than the
+// tolerance (default 0.10) or the MIDI output differs from the baseline.
+//
+
+struct Session
+{
+    long long clock = 1000000;       // sample time ticks per second
+    int width = 1920, height = 1080;
+    std::vector<std::string> prefs;  // "name value..." applied in order
+    std::vector<TouchSample> samples;
+    std::vector<size_t> frames;      // index of the first sample of each
+};
+
+// ======================================================================
+// read session text.  false & a message on any bad line.
+//
+bool readSessionLines(std::istream& in, const char* path, Session& session)
+{
+    std::string line;
+    int line_num = 0;
+    while (std::getline(in, line)) {
+        line_num++;
+        std::istringstream fields(line);
+        std::string kind;
+        if (!(fields >> kind) || kind[0] == '#') {
+            continue;
+        }
+        bool ok = true;
+        if (kind == "clock") {
+            ok = fields >> session.clock && session.clock > 0;
+        }
+        else if (kind == "frame") {
+            session.frames.push_back(session.samples.size());
+        }
+        else if (kind == "size") {
+            ok = static_cast<bool>(fields >> session.width >> session.height);
+        }
+        else if (kind == "pref") {
+            std::string rest;
+            std::getline(fields, rest);
+            session.prefs.push_back(rest);
+        }
+        else if (kind == "down" || kind == "move") {
+            TouchSample sample{};
+            sample.type = (kind == "down") ? TouchType::DOWN : TouchType::UPDATE;
+            ok = static_cast<bool>(fields >> sample.time >> sample.id
+                >> sample.point.x >> sample.point.y
+                >> sample.rect.left >> sample.rect.top >> sample.rect.right >> sample.rect.bottom
+                >> sample.pressure);
+            session.samples.push_back(sample);
+        }
+        else if (kind == "up") {
+            TouchSample sample{};
+            sample.type = TouchType::UP;
+            ok = static_cast<bool>(fields >> sample.time >> sample.id);
+            session.samples.push_back(sample);
+        }
+        else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << path << ":" << line_num << ": bad line: " << line << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// ======================================================================
+// read a session file or flight recorder dump.  Recorded midi is kept
+// in midi (if not nullptr).
+//
+bool readSession(const char* path, Session& session, std::vector<GridRecord>* midi)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "unable to open " << path << std::endl;
+        return false;
+    }
+    char magic[8] = {};
+    in.read(magic, sizeof(magic));
+    if (memcmp(magic, "GRIDREC1", sizeof(magic)) != 0) {
+        in.clear();
+        in.seekg(0);
+        return readSessionLines(in, path, session);
+    }
+    std::string header;
+    std::vector<GridRecord> records;
+    if (!GridRecorder::load(path, header, records)) {
+        std::cerr << path << ": bad flight recorder dump" << std::endl;
+        return false;
+    }
+    std::istringstream header_lines(header);
+    if (!readSessionLines(header_lines, path, session)) {
+        return false;
+    }
+    for (const GridRecord& record : records) {
+        if (record.type == RecordType::TOUCH) {
+            session.samples.push_back(record.sample);
+        }
+        else if (record.type == RecordType::FRAME) {
+            session.frames.push_back(session.samples.size());
+        }
+        else if (midi != nullptr) {
+            midi->push_back(record);
+        }
+    }
+    return true;
+}
+
+// ======================================================================
+// make the session ready to replay: frames for sessions without any &
+// sample times in GridClock ticks.
+//
+void prepareSession(Session& session)
+{
+    if (session.frames.empty()) {
+        for (size_t i = 0; i < session.samples.size(); i++) {
+            if (i == 0 || session.samples[i].time != session.samples[i - 1].time) {
+                session.frames.push_back(i);
+            }
+        }
+    }
+    // a trailing frame line or an empty recorded frame has no samples
+    session.frames.erase(std::unique(session.frames.begin(), session.frames.end()), session.frames.end());
+    while (!session.frames.empty() && session.frames.back() >= session.samples.size()) {
+        session.frames.pop_back();
+    }
+    long long ticks_per_second = GridClock::ticksPerSecond();
+    if (session.clock != ticks_per_second) {
+        double scale = static_cast<double>(ticks_per_second) / session.clock;
+        for (TouchSample& sample : session.samples) {
+            sample.time = static_cast<long long>(sample.time * scale);
+        }
+        session.clock = ticks_per_second;
+    }
+}
+
+// ======================================================================
+// one sample as a session line
+//
+void writeSample(std::ostream& out, const TouchSample& sample)
+{
+    switch (sample.type) {
+    case TouchType::DOWN:
+    case TouchType::UPDATE:
+        out << (sample.type == TouchType::DOWN ? "down " : "move ") << sample.time << " " << sample.id << " "
+            << sample.point.x << " " << sample.point.y << " "
+            << sample.rect.left << " " << sample.rect.top << " "
+            << sample.rect.right << " " << sample.rect.bottom << " " << sample.pressure << "\n";
+        break;
+    case TouchType::UP:
+        out << "up " << sample.time << " " << sample.id << "\n";
+        break;
+    }
+}
+
+// a recorded midi message as a comment, with its channel if past 15
+void writeMidi(std::ostream& out, const GridRecord& record)
+{
+    out << "# midi " << record.sample.time << " " << std::hex << std::setfill('0')
+        << std::setw(6) << record.message << std::dec;
+    if (record.channel >= MIDI::CHANNELS) {
+        out << " channel " << record.channel;
+    }
+    out << "\n";
+}
+
+// ======================================================================
+// print a session as text, with any recorded midi as comments in time
+// order
+//
+void printSession(const Session& session, const std::vector<GridRecord>& midi)
+{
+    std::cout << "clock " << session.clock << "\n";
+    std::cout << "size " << session.width << " " << session.height << "\n";
+    for (const std::string& pref : session.prefs) {
+        std::cout << "pref" << pref << "\n";
+    }
+    size_t m = 0;
+    size_t f = 0;
+    for (size_t i = 0; i < session.samples.size(); i++) {
+        const TouchSample& sample = session.samples[i];
+        for (; m < midi.size() && midi[m].sample.time < sample.time; m++) {
+            writeMidi(std::cout, midi[m]);
+        }
+        if (f < session.frames.size() && session.frames[f] == i) {
+            std::cout << "frame\n";
+            f++;
+        }
+        writeSample(std::cout, sample);
+    }
+    for (; m < midi.size(); m++) {
+        writeMidi(std::cout, midi[m]);
+    }
+    std::cout.flush();
+}
+
+// ======================================================================
+// apply one "name value..." pref line to the instrument
+//
+bool applyPref(GridStrument& grid, const std::string& pref)
+{
+    std::istringstream fields(pref);
+    std::string name;
+    int value = 0, value2 = 0;
+    if (!(fields >> name >> value)) {
+        return false;
+    }
+    if (name == "guitar_mode") grid.prefGuitarMode(value != 0);
+    else if (name == "pitch_bend_range") grid.prefPitchBendRange(value);
+    else if (name == "pitch_bend_mask") grid.prefPitchBendMask(value);
+    else if (name == "modulation_controller") grid.prefModulationController(value);
+    else if (name == "grid_size") grid.prefGridSize(value);
+    else if (name == "channel_per_row_mode") grid.prefChannelPerRowMode(value != 0);
+    else if (name == "hex_grid_mode") grid.prefHexGridMode(value != 0);
+    else if (name == "expression_filter") grid.prefExpressionFilter(value != 0);
+    else if (name == "midi_flush_ms") grid.prefMidiFlushMs(value);
+    else if (name == "midi_channel_range" && (fields >> value2)) grid.prefMidiChannelRange(value, value2);
+    else return false;
+    return true;
+}
+
+// ======================================================================
+// set the instrument up for the session
+//
+bool setupGrid(GridStrument& grid, const Session& session)
+{
+    for (const std::string& pref : session.prefs) {
+        if (!applyPref(grid, pref)) {
+            std::cerr << "GridReplay: bad pref:" << pref << std::endl;
+            return false;
+        }
+    }
+    grid.resize(session.width, session.height);
+    return true;
+}
+
+// ======================================================================
+// write a deterministic synthetic session: groups of 1-5 fingers that
+// press, wander about & lift, like chords with vibrato.  Moves are
+// sampled every ~2ms & arrive in frames of 4, as coalesced pointer
+// history does at 120Hz.
+//
+bool generateSession(const char* path, int num_events)
+{
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "unable to create " << path << std::endl;
+        return false;
+    }
+    const int width = 1920, height = 1080;
+    out << "# synthetic session from GridReplay --generate\n";
+    out << "clock 1000000\n";
+    out << "size " << width << " " << height << "\n";
+    out << "pref grid_size 90\npref hex_grid_mode 0\npref guitar_mode 1\n";
+    out << "pref pitch_bend_range 12\npref midi_channel_range 0 10\n";
+
+    uint32_t seed = 12345;
+    auto rnd = [&seed](int n) {
+        seed = seed * 1664525u + 1013904223u;
+        return static_cast<int>((seed >> 8) % static_cast<uint32_t>(n));
+    };
+    struct Finger { int id, x, y, size; };
+    long long time = 0;
+    int next_id = 1;
+    int events = 0;
+    while (events < num_events) {
+        std::vector<Finger> fingers(1 + rnd(5));
+        for (auto& f : fingers) {
+            f = { next_id++, rnd(width), rnd(height), 40 + rnd(40) };
+        }
+        int steps = 20 + rnd(40);
+        for (int step = -1; step <= steps; step++) {
+            time += 1500 + rnd(1000);
+            if (step < 1 || step % 4 == 1 || step == steps) {
+                out << "frame\n";
+            }
+            for (auto& f : fingers) {
+                TouchSample sample{};
+                sample.time = time;
+                sample.id = f.id;
+                if (step == steps) {
+                    sample.type = TouchType::UP;
+                }
+                else {
+                    if (step >= 0) {
+                        f.x += rnd(7) - 3;
+                        f.y += rnd(7) - 3;
+                        f.size = std::clamp(f.size + rnd(5) - 2, 20, 120);
+                    }
+                    sample.type = (step < 0) ? TouchType::DOWN : TouchType::UPDATE;
+                    sample.point = { f.x, f.y };
+                    sample.rect = { f.x - f.size / 2, f.y - f.size / 2, f.x + f.size / 2, f.y + f.size / 2 };
+                    sample.pressure = 512;
+                }
+                writeSample(out, sample);
+                events++;
+            }
+        }
+    }
+    return true;
+}
+
+// ======================================================================
+// run the session through the instrument once, a frame at a time as the
+// control thread would.  Then send any midi still held back.
+//
+void replay(GridStrument& grid, Session& session)
+{
+    size_t num_frames = session.frames.size();
+    for (size_t f = 0; f < num_frames; f++) {
+        size_t begin = session.frames[f];
+        size_t end = (f + 1 < num_frames) ? session.frames[f + 1] : session.samples.size();
+        grid.pointerFrame(&session.samples[begin], static_cast<int>(end - begin));
+    }
+    grid.midiFlush();
+}
+
+// ======================================================================
+// how many messages the session sends with one more pref applied.
+// "uncoalesced" replays a sample per frame with no flush interval, so
+// every controller change is sent.
+//
+size_t countMessages(Session& session, const char* pref)
+{
+    GridStrument grid(nullptr);
+    setupGrid(grid, session);
+    GridCaptureSink counter(nullptr, 0);
+    grid.midiOutput()->addSink(&counter);
+    if (std::strcmp(pref, "uncoalesced") != 0) {
+        applyPref(grid, std::string(pref));
+        replay(grid, session);
+    }
+    else {
+        grid.prefMidiFlushMs(0);
+        for (TouchSample& sample : session.samples) {
+            grid.pointerFrame(&sample, 1);
+        }
+    }
+    return counter.count();
+}
+
+// ======================================================================
+// encode the messages as a running status byte stream through a small
+// buffer, like a serial output would, & decode them again.  Returns
+// the stream size in bytes, or 0 if the decoded messages don't match.
+//
+size_t streamRoundTrip(const std::vector<uint32_t>& messages, size_t count)
+{
+    GridMidiEncoder encoder;
+    GridMidiDecoder decoder;
+    uint8_t buffer[64];
+    uint32_t decoded[64];
+    size_t total_bytes = 0;
+    size_t num_checked = 0;
+    for (size_t i = 0; i < count; ) {
+        size_t num_messages = count - i;
+        size_t num_bytes = encoder.encode(&messages[i], num_messages, buffer, sizeof(buffer));
+        i += num_messages;
+        total_bytes += num_bytes;
+        // decode in odd sized pieces so messages are split across calls
+        for (size_t pos = 0; pos < num_bytes; ) {
+            size_t piece = std::min<size_t>(5, num_bytes - pos);
+            size_t num_decoded = decoder.decode(buffer + pos, piece, decoded, 64);
+            pos += piece;
+            for (size_t d = 0; d < num_decoded; d++) {
+                if (num_checked >= count || decoded[d] != (messages[num_checked] & 0xffffff)) {
+                    return 0;
+                }
+                num_checked++;
+            }
+        }
+    }
+    return (num_checked == count) ? total_bytes : 0;
+}
+
+// ======================================================================
+// FNV-1a over the message words, so output changes are easy to spot
+//
+uint64_t checksum(const std::vector<uint32_t>& messages, size_t count)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < count; i++) {
+        for (int b = 0; b < 4; b++) {
+            hash ^= (messages[i] >> (8 * b)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+// ======================================================================
+// find "key": in a (flat) json object.  Good enough for our own output.
+//
+bool jsonNumber(const std::string& json, const char* key, double& value)
+{
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t pos = json.find(pattern);
+    if (pos == std::string::npos) {
+        return false;
+    }
+    pos += pattern.size();
+    while (pos < json.size() && json[pos] == ' ') {
+        pos++;
+    }
+    value = std::strtod(json.c_str() + pos, nullptr);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    const char* session_path = nullptr;
+    const char* generate_path = nullptr;
+    const char* baseline_path = nullptr;
+    const char* record_path = nullptr;
+    const char* midi_out_path = nullptr;
+    bool print = false;
+    int repeat = 10;
+    int num_events = 100000;
+    double tolerance = 0.10;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--generate" && has_value) generate_path = argv[++i];
+        else if (arg == "--print") print = true;
+        else if (arg == "--events" && has_value) num_events = std::atoi(argv[++i]);
+        else if (arg == "--repeat" && has_value) repeat = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--baseline" && has_value) baseline_path = argv[++i];
+        else if (arg == "--record" && has_value) record_path = argv[++i];
+        else if (arg == "--midi-out" && has_value) midi_out_path = argv[++i];
+        else if (arg == "--tolerance" && has_value) tolerance = std::atof(argv[++i]);
+        else if (arg[0] != '-' && session_path == nullptr) session_path = argv[i];
+        else {
+            std::cerr << "usage: GridReplay --generate <session> [--events N]\n"
+                      << "       GridReplay --print <session>\n"
+                      << "       GridReplay <session> [--repeat N] [--baseline <json>] [--tolerance F]\n"
+                      << "                  [--record <dump>] [--midi-out <file>]" << std::endl;
+            return 2;
+        }
+    }
+    if (generate_path != nullptr) {
+        return generateSession(generate_path, num_events) ? 0 : 1;
+    }
+    if (session_path == nullptr) {
+        std::cerr << "GridReplay: no session file" << std::endl;
+        return 2;
+    }
+
+    Session session;
+    std::vector<GridRecord> recorded_midi;
+    if (!readSession(session_path, session, &recorded_midi)) {
+        return 1;
+    }
+    if (print) {
+        printSession(session, recorded_midi);
+        return 0;
+    }
+    prepareSession(session);
+    // the instrument logs unusual events; keep that out of the timing
+    std::wcout.setstate(std::ios::failbit);
+
+    GridStrument grid(nullptr);
+    if (!setupGrid(grid, session)) {
+        return 1;
+    }
+
+    // the first pass captures the output.  Every message comes from one
+    // sample & no sample sends more than 3.
+    std::vector<uint32_t> messages(3 * session.samples.size() + 1);
+    GridCaptureSink capture(messages.data(), messages.size());
+    grid.midiOutput()->addSink(&capture);
+    FILE* midi_out = nullptr;
+    if (midi_out_path != nullptr && (midi_out = fopen(midi_out_path, "wb")) == nullptr) {
+        std::cerr << "GridReplay: unable to write " << midi_out_path << std::endl;
+        return 1;
+    }
+    std::unique_ptr<GridMidiFileSink> midi_out_sink;
+    if (midi_out != nullptr) {
+        midi_out_sink.reset(new GridMidiFileSink(midi_out));
+        grid.midiOutput()->addSink(midi_out_sink.get());
+    }
+    replay(grid, session);
+    if (midi_out != nullptr) {
+        grid.midiOutput()->removeSink(midi_out_sink.get());
+        midi_out_sink.reset();
+        fclose(midi_out);
+    }
+    if (record_path != nullptr && !grid.saveRecording(record_path)) {
+        std::cerr << "GridReplay: unable to write " << record_path << std::endl;
+        return 1;
+    }
+    size_t num_messages = capture.count();
+    size_t num_captured = capture.size();
+    int channels_max = grid.channels().inUseMax();
+    long long channels_shared = grid.channels().shares();
+    uint64_t midi_checksum = checksum(messages, num_captured);
+
+    // bytes on a serial line, with & without running status
+    size_t stream_bytes = 0, plain_bytes = 0;
+    for (size_t i = 0; i < num_captured; i++) {
+        plain_bytes += midiMessageLength(static_cast<uint8_t>(messages[i]));
+    }
+    if (num_captured > 0 && (stream_bytes = streamRoundTrip(messages, num_captured)) == 0) {
+        std::cerr << "GridReplay: MIDI byte stream round trip failed" << std::endl;
+        return 1;
+    }
+    double stream_reduction = (plain_bytes > 0) ?
+        1.0 - static_cast<double>(stream_bytes) / plain_bytes : 0;
+
+    // count the messages without the expression filter and without
+    // coalescing to show what each saves
+    size_t unfiltered_messages = countMessages(session, "expression_filter 0");
+    size_t uncoalesced_messages = countMessages(session, "uncoalesced");
+    double filter_reduction = (unfiltered_messages > 0) ?
+        1.0 - static_cast<double>(num_messages) / unfiltered_messages : 0;
+    double coalesce_reduction = (uncoalesced_messages > 0) ?
+        1.0 - static_cast<double>(num_messages) / uncoalesced_messages : 0;
+
+    // the timed passes still go to the capture sink, which just counts
+    // now its buffer is full
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; r++) {
+        replay(grid, session);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double events = static_cast<double>(session.samples.size()) * repeat;
+    double events_per_sec = (seconds > 0) ? events / seconds : 0;
+    double ns_per_event = (events > 0) ? 1e9 * seconds / events : 0;
+
+    char json[768];
+    std::snprintf(json, sizeof(json),
+        "{\"session\": \"%s\", \"events\": %zu, \"repeat\": %d, \"seconds\": %.6f, "
+        "\"events_per_sec\": %.0f, \"ns_per_event\": %.2f, \"midi_messages\": %zu, "
+        "\"midi_checksum\": %llu, \"midi_messages_unfiltered\": %zu, \"filter_reduction\": %.3f, "
+        "\"midi_messages_uncoalesced\": %zu, \"coalesce_reduction\": %.3f, "
+        "\"stream_bytes\": %zu, \"stream_reduction\": %.3f, \"channels_max\": %d, \"channels_shared\": %lld}",
+        session_path, session.samples.size(), repeat, seconds,
+        events_per_sec, ns_per_event, num_messages,
+        static_cast<unsigned long long>(midi_checksum), unfiltered_messages, filter_reduction,
+        uncoalesced_messages, coalesce_reduction, stream_bytes, stream_reduction,
+        channels_max, channels_shared);
+    std::cout << json << std::endl;
+
+    if (baseline_path == nullptr) {
+        return 0;
+    }
+    std::ifstream in(baseline_path);
+    std::string baseline((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    double base_rate = 0, base_messages = 0;
+    // compare the checksum as printed; doubles can't hold all 64 bits
+    std::string base_checksum_text;
+    size_t pos = baseline.find("\"midi_checksum\":");
+    if (pos != std::string::npos && (pos = baseline.find_first_of("0123456789", pos)) != std::string::npos) {
+        base_checksum_text = baseline.substr(pos, baseline.find_first_not_of("0123456789", pos) - pos);
+    }
+    if (!jsonNumber(baseline, "events_per_sec", base_rate) ||
+        !jsonNumber(baseline, "midi_messages", base_messages) ||
+        base_checksum_text.empty()) {
+        std::cerr << "GridReplay: unable to read baseline " << baseline_path << std::endl;
+        return 1;
+    }
+    int rc = 0;
+    std::string checksum_text = std::to_string(static_cast<unsigned long long>(midi_checksum));
+    if (static_cast<size_t>(base_messages) != num_messages || base_checksum_text != checksum_text) {
+        std::cerr << "GridReplay: MIDI output changed from baseline" << std::endl;
+        rc = 1;
+    }
+    if (events_per_sec < base_rate * (1.0 - tolerance)) {
+        std::cerr << "GridReplay: throughput regression " << events_per_sec
+                  << " < " << base_rate << " events/sec" << std::endl;
+        rc = 1;
+    }
+    return rc;
+}
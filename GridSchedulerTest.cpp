@@ -0,0 +1,170 @@
+// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridMidiScheduler.h"
+#include "GridMidi.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// ======================================================================
+// GridSchedulerTest - checks GridMidiScheduler in real time.  Exits
+// non-zero on failure.
+//
+// A finger sampled every 1ms arrives in bursts of 2, late by up to
+// another 1ms, as in GridBench's GridMidiScheduler case.  With a 3ms
+// delay, which covers that lateness, every message must come out, in
+// order, none before its due time, and 95% of the gaps between them
+// within JITTER_BOUND_US of the sampling interval.  Sent straight to
+// the sink the same input has gaps of 0 and ~2ms, so a scheduler that
+// does nothing fails.  The scheduler does better than 50us on an idle
+// core, but a time slice lost to another busy thread costs several ms,
+// so the jitter run is tried up to JITTER_TRIES times & passes if any
+// run meets the bound.  Order & early messages fail on any run.  ctest
+// runs it on its own (RUN_SERIAL).
+//
+// Then stop() with messages still far from due must send them all.
+//
+
+static const int EVENTS = 1000;
+static const int INTERVAL_US = 1000;
+static const int BURST = 2;
+static const int LATE_US = 1000;
+static const int DELAY_MS = 3;
+static const double JITTER_BOUND_US = 250;
+static const double JITTER_PERCENTILE = 0.95;
+static const int JITTER_TRIES = 3;
+
+// notes each message & when it was sent, in a buffer allocated up front
+class TimingSink final : public GridMidiSink
+{
+public:
+    std::vector<long long> times;
+    std::vector<uint32_t> messages;
+    size_t count = 0;
+    explicit TimingSink(size_t size) : times(size), messages(size) {}
+    void send(uint32_t message, long long) override {
+        if (count < times.size()) {
+            times[count] = GridClock::now();
+            messages[count++] = message;
+        }
+    }
+};
+
+static uint32_t sequenceMessage(int i)
+{
+    return MidiMessage(MIDI::PITCH_BEND, i & 0x7f, (i >> 7) & 0x7f).data();
+}
+
+// ======================================================================
+// one run of the finger through the scheduler.  Returns 1 for lost,
+// reordered or early messages, & sets within_bound.
+static int testJitter(bool& within_bound)
+{
+    long long ticks_per_us = GridClock::ticksPerSecond() / 1000000;
+    long long delay = DELAY_MS * 1000 * ticks_per_us;
+    TimingSink timing(EVENTS);
+    GridMidiScheduler scheduler(&timing, delay);
+    scheduler.start();
+    uint32_t seed = 2020;
+    long long start = GridClock::now() + 10000 * ticks_per_us;
+    for (int i = 0; i < EVENTS; i += BURST) {
+        // the OS hands over the burst a little after its last sample
+        seed = seed * 1664525u + 1013904223u;
+        long long last_sample = start + (i + BURST - 1) * INTERVAL_US * ticks_per_us;
+        long long arrival = last_sample + ((seed >> 8) % LATE_US) * ticks_per_us;
+        std::this_thread::sleep_for(std::chrono::nanoseconds(
+            GridClock::ticksToNanoseconds(arrival - GridClock::now())));
+        for (int j = i; j < std::min(i + BURST, EVENTS); j++) {
+            scheduler.send(sequenceMessage(j), start + j * INTERVAL_US * ticks_per_us);
+        }
+    }
+    // stop() sends what is left at once, so wait for the last one
+    std::this_thread::sleep_for(std::chrono::milliseconds(DELAY_MS + 5));
+    scheduler.stop();
+
+    int failed = 0;
+    within_bound = false;
+    if (timing.count != EVENTS) {
+        std::cout << "jitter: FAILED, " << timing.count << " messages sent of " << EVENTS << std::endl;
+        return 1;
+    }
+    std::vector<double> errors;
+    for (int i = 0; i < EVENTS; i++) {
+        if (timing.messages[i] != sequenceMessage(i)) {
+            std::cout << "jitter: FAILED, message " << i << " out of order" << std::endl;
+            return 1;
+        }
+        long long due = start + i * INTERVAL_US * ticks_per_us + delay;
+        if (timing.times[i] < due && !failed) {
+            std::cout << "jitter: FAILED, message " << i << " sent "
+                << GridClock::ticksToNanoseconds(due - timing.times[i]) / 1000 << "us early" << std::endl;
+            failed = 1;
+        }
+        if (i > 0) {
+            double gap_us = GridClock::ticksToNanoseconds(timing.times[i] - timing.times[i - 1]) / 1000.0;
+            errors.push_back(std::fabs(gap_us - INTERVAL_US));
+        }
+    }
+    std::sort(errors.begin(), errors.end());
+    double percentile = errors[static_cast<size_t>(JITTER_PERCENTILE * (errors.size() - 1))];
+    std::cout << "jitter: " << JITTER_PERCENTILE * 100 << "% of gaps within " << percentile << "us of "
+        << INTERVAL_US << "us, max " << errors.back() << "us, late " << scheduler.late() << std::endl;
+    within_bound = (percentile <= JITTER_BOUND_US);
+    return failed;
+}
+
+// ======================================================================
+static int testStop()
+{
+    const int MESSAGES = 100;
+    TimingSink timing(MESSAGES);
+    GridMidiScheduler scheduler(&timing, GridClock::ticksPerSecond() * 60);
+    scheduler.start();
+    for (int i = 0; i < MESSAGES; i++) {
+        scheduler.send(sequenceMessage(i), GridClock::now());
+    }
+    scheduler.stop();
+    for (int i = 0; i < MESSAGES; i++) {
+        if (i >= static_cast<int>(timing.count) || timing.messages[i] != sequenceMessage(i)) {
+            std::cout << "stop: FAILED, " << timing.count << " of " << MESSAGES << " messages sent" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// ======================================================================
+int main()
+{
+    int failed = 0;
+    bool within_bound = false;
+    for (int i = 0; i < JITTER_TRIES && !within_bound && !failed; i++) {
+        failed |= testJitter(within_bound);
+    }
+    if (!within_bound) {
+        std::cout << "jitter: FAILED, bound is " << JITTER_BOUND_US << "us" << std::endl;
+        failed = 1;
+    }
+    failed |= testStop();
+    return failed;
+}
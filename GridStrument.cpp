@@ -16,24 +16,37 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 // ======================================================================
 #include "GridStrument.h"
-#include "GridUtils.h"
+#include "GridHex.h"
 #include <cassert>
+#include <cmath>
 #include <iostream>
-#include <set>
+#include <sstream>
 #include <vector>
 
 // ======================================================================
-// forward decl for "public" methods for dealing with hex grids
-// FIXME - refactor this to be more object-oriented instead of functional
-void hexGetNumGrids(int screen_width, int screen_height, int grid_size, int& num_grids_x, int& num_grids_y);
-void hexDrawCell(ID2D1HwndRenderTarget* d2dRenderTarget, ID2D1SolidColorBrush* brush, int grid_size, int num_grids_x, int num_grids_y, int x, int y);
-int hexGridLocToMidiNote(int num_grids_y, int x, int y);
-D2D1_POINT_2F hexGridLocToPoint(int grid_size, int x, int y);
-void pointToHexGridLoc(POINT point, int grid_size, int& x, int& y);
+// expression filter tuning.  Positions & sizes are in pixels.  A One
+// Euro filter at rest lags by about 1 / (2 pi min_cutoff): 160ms at
+// 1Hz, which drags slow bends & vibrato.  At 10Hz, on 125Hz touch
+// samples with +-1 pixel of jitter, it measured:
+//   - a 2 to 20 pixels/sec bend lags 13-16ms, about two touch samples
+//   - a 5Hz, +-2 pixel vibrato lags 13ms and keeps 87% of its depth
+//   - a still finger's jitter drops from 0.81 to 0.37 pixels RMS
+// Faster movement opens the cutoff further by beta per pixel/sec, so a
+// 6Hz, 10 pixel vibrato (~380 pixels/sec) runs at ~30Hz.
+//
+static const GridFilterParams POINT_FILTER = { 10.0f, 0.05f };
+static const GridFilterParams SIZE_FILTER = { 10.0f, 0.02f };
 
 // ======================================================================
-// Main constructor, set defaults and midi output device
-GridStrument::GridStrument(HMIDIOUT midiDevice)
+// Main constructor, set defaults and synth.  gridSynth may be nullptr
+// when there is no internal synth.  There is no midi output device
+// until midiDevice() opens one.
+GridStrument::GridStrument(GridSynth* gridSynth) :
+#ifdef _WIN32
+    midi_out_sink_(&latency_, &midi_errors_),
+    midi_scheduler_(&midi_out_sink_, 0),
+#endif
+    synth_sink_(gridSynth, &latency_)
 {
     // initial preferences.  These get updated by WinGridStrument code
     pref_guitar_mode_ = true;
@@ -48,234 +61,231 @@ GridStrument::GridStrument(HMIDIOUT midiDevice)
     pref_play_midi_ = false;
     pref_play_soundfont_ = false; 
     pref_soundfont_path_ = "";
+    pref_expression_filter_ = true;
+    pref_midi_flush_ms_ = 0;
+    pref_midi_delay_ms_ = 0;
+    pref_soundfont_cache_mb_ = 256;
+    pref_synth_overlay_ = false;
 
-    size_ = D2D1::SizeU(0, 0);
+    width_ = height_ = 0;
     num_grids_x_ = num_grids_y_ = 0;
+    event_time_ = 0;
 
-    grid_synth_ = new GridSynth();
-
-    midi_device_ = new GridMidi(midiDevice, grid_synth_);
-    midi_channel_ = pref_midi_channel_min_;
+    grid_synth_ = gridSynth;
 
+    midi_device_ = new GridMidi(&recorder_);
+    updateChannels();
 }
 
 GridStrument::~GridStrument()
 {
-    free(midi_device_);
-    free(grid_synth_);
+#ifdef _WIN32
+    midi_scheduler_.stop();
+#endif
+    delete midi_device_;
 }
 
+#ifdef _WIN32
 // ======================================================================
-// update the midi output device
+// open a new midi output device, closing the current one.  Pending midi
+// goes to the old one.
 //
-void GridStrument::midiDevice(HMIDIOUT midiDevice) 
+MMRESULT GridStrument::midiDevice(UINT device_index)
 {
-    free(midi_device_);
-    midi_device_ = new GridMidi(midiDevice, grid_synth_);
+    midi_device_->flush();
+    return midi_out_sink_.open(device_index);
 }
 
+void GridStrument::closeMidiDevice()
+{
+    midi_device_->flush();
+    midi_out_sink_.close();
+}
+#endif
+
 // ======================================================================
-// resize and adjust the num_grids
+// playing midi or the synth is just having its sink
 //
-void GridStrument::resize(D2D1_SIZE_U size)
+void GridStrument::prefPlayMidi(bool mode)
 {
-    size_ = size;
-    if (!pref_hex_grid_mode_) {
-        num_grids_x_ = (int)(size_.width / pref_grid_size_);
-        num_grids_y_ = (int)(size_.height / pref_grid_size_);
+    pref_play_midi_ = mode;
+    updateMidiSinks();
+    updateChannels();
+}
+
+// ======================================================================
+// send midi this many ms after the touch, evening out the gaps between
+// messages that arrive in bursts.  0 sends at once.  The synth plays
+// its audio this long after the touch too.
+//
+void GridStrument::prefMidiDelayMs(int ms)
+{
+    pref_midi_delay_ms_ = std::clamp(ms, 0, 10);
+    if (grid_synth_ != nullptr) {
+        grid_synth_->delay(pref_midi_delay_ms_ * GridClock::ticksPerSecond() / 1000);
+    }
+    updateMidiSinks();
+}
+
+// ======================================================================
+// the midi device gets messages straight away or through the scheduler
+//
+void GridStrument::updateMidiSinks()
+{
+#ifdef _WIN32
+    midi_device_->removeSink(&midi_out_sink_);
+    midi_device_->removeSink(&midi_scheduler_);
+    // the scheduler sends what it has before the device is used directly
+    midi_scheduler_.stop();
+    if (!pref_play_midi_) {
+        return;
+    }
+    if (pref_midi_delay_ms_ > 0) {
+        midi_scheduler_.delay(pref_midi_delay_ms_ * GridClock::ticksPerSecond() / 1000);
+        midi_scheduler_.start();
+        midi_device_->addSink(&midi_scheduler_);
     }
     else {
-        hexGetNumGrids((int)size_.width, (int)size_.height, pref_grid_size_ / 2, num_grids_x_, num_grids_y_);
+        midi_device_->addSink(&midi_out_sink_);
     }
+#endif
+}
 
-#ifndef NDEBUG
-    std::wcout << "screen width = " << size.width << ", height = " << size.height << std::endl;
-    std::wcout << "screen columns = " << num_grids_x_ << ", rows = " << num_grids_y_ << std::endl;
-    std::wcout << "min note = " << gridLocToMidiNote(0, num_grids_y_ - 1) << std::endl;
-    std::wcout << "max note = " << gridLocToMidiNote(num_grids_x_ - 1, 0) << std::endl;
-#endif // !NDEBUG
+void GridStrument::prefPlaySoundfont(bool mode)
+{
+    pref_play_soundfont_ = mode && grid_synth_ != nullptr;
+    if (pref_play_soundfont_) {
+        midi_device_->addSink(&synth_sink_, true);
+    }
+    else {
+        midi_device_->removeSink(&synth_sink_);
+    }
+    updateChannels();
 }
 
 // ======================================================================
-// main drawing routine.  create brushes if necessary & then draw the
-// grid, notes, etc.
+// fingers take channels from the min to max prefs.  The synth has more
+// than midi's 16, so when it plays alone they take any of its channels
+// from the min up.
 //
-void GridStrument::draw(ID2D1HwndRenderTarget* d2dRenderTarget, IDWriteTextFormat* dwriteTextFormat)
+void GridStrument::updateChannels()
 {
-    if (!brushes_.initialized_) {
-        brushes_.init(d2dRenderTarget);
-    }
-    d2dRenderTarget->Clear(brushes_.color_theme_.clearColor());
-    if (pref_guitar_mode_) {
-        drawGuitar(d2dRenderTarget);
+    int max = pref_midi_channel_max_;
+    if (pref_play_soundfont_ && !pref_play_midi_) {
+        max = MIDI::SYNTH_CHANNELS - 1;
     }
-    drawGrid(d2dRenderTarget);
-    drawDots(d2dRenderTarget);
-    drawText(d2dRenderTarget, dwriteTextFormat);
-    drawPointers(d2dRenderTarget);
+    channels_.range(pref_midi_channel_min_, max);
 }
 
 // ======================================================================
-// draw the touch rectangles for each finger
+// soundfonts stay loaded after playing, up to this much memory, so
+// switching back to one is instant
 //
-void GridStrument::drawPointers(ID2D1HwndRenderTarget* d2dRenderTarget)
+void GridStrument::prefSoundfontCacheMb(int mb)
 {
-    // FIXME add pointer brush to brushes_, it isn't dynamic any longer.
-    for (auto p : grid_pointers_) {
-        ID2D1SolidColorBrush* pBrush;
-        HRESULT hr = d2dRenderTarget->CreateSolidColorBrush(brushes_.color_theme_.touchColor(), &pBrush);
-        if (SUCCEEDED(hr)) {
-            RECT rc = p.second.rect();
-            D2D1_RECT_F rcf = D2D1::RectF((float)rc.left, (float)rc.top, (float)rc.right, (float)rc.bottom);
-            d2dRenderTarget->FillRectangle(&rcf, pBrush);
-            SafeRelease(&pBrush);
-        }
+    pref_soundfont_cache_mb_ = std::clamp(mb, 0, 8192);
+    if (grid_synth_ != nullptr) {
+        grid_synth_->soundfontBudget(pref_soundfont_cache_mb_ * 1024LL * 1024);
     }
 }
 
 // ======================================================================
-// draw the dots for each note. C gets a special color.
-// Notes that are currently pressed also get a special color.
+// hold continuous controller messages for up to ms milliseconds so only
+// the latest of each is sent.  0 still coalesces within each frame.
 //
-void GridStrument::drawDots(ID2D1HwndRenderTarget* d2dRenderTarget)
+void GridStrument::prefMidiFlushMs(int ms)
 {
-    std::set<int> active_notes;
-    for (auto p : grid_pointers_) {
-        active_notes.insert(p.second.note());
-    }
-    for (int x = 0; x < num_grids_x_; x++) {
-        for (int y = 0; y < num_grids_y_; y++) {
-            int note;
-            D2D1_POINT_2F center;
-            if (!pref_hex_grid_mode_) {
-                note = gridLocToMidiNote(x, y);
-                center = D2D1::Point2F(x * pref_grid_size_ + pref_grid_size_ / 2.f, y * pref_grid_size_ + pref_grid_size_ / 2.f);
-            }
-            else {
-                note = hexGridLocToMidiNote(num_grids_y_, x, y);
-                center = hexGridLocToPoint(pref_grid_size_ / 2, x, y);
-            }
-            D2D1_ELLIPSE ellipse = D2D1::Ellipse(
-                center,
-                pref_grid_size_ / 5.f,
-                pref_grid_size_ / 5.f
-                );
-            if (active_notes.find(note) != active_notes.end()) {
-                d2dRenderTarget->FillEllipse(ellipse, brushes_.highlight_);
-            }
-            else if (note % 12 == 0) {
-                d2dRenderTarget->FillEllipse(ellipse, brushes_.c_note_);
-            }
-            else if (((note % 12) == 2) || ((note % 12) == 4) || ((note % 12) == 5) ||
-                ((note % 12) == 7) || ((note % 12) == 9) || ((note % 12) == 11)) {
-                d2dRenderTarget->FillEllipse(ellipse, brushes_.note_);
-            }
-        }
+    pref_midi_flush_ms_ = std::clamp(ms, 0, 100);
+    midi_device_->flushInterval(pref_midi_flush_ms_ * GridClock::ticksPerSecond() / 1000);
+}
+
+// ======================================================================
+// resize and adjust the num_grids
+//
+void GridStrument::resize(int width, int height)
+{
+    width_ = width;
+    height_ = height;
+    if (!pref_hex_grid_mode_) {
+        num_grids_x_ = width_ / pref_grid_size_;
+        num_grids_y_ = height_ / pref_grid_size_;
+    }
+    else {
+        hexGetNumGrids(width_, height_, pref_grid_size_ / 2, num_grids_x_, num_grids_y_);
     }
+    buildCells();
 
+#ifndef NDEBUG
+    std::wcout << "screen width = " << width_ << ", height = " << height_ << std::endl;
+    std::wcout << "screen columns = " << num_grids_x_ << ", rows = " << num_grids_y_ << std::endl;
+    std::wcout << "min note = " << gridLocToMidiNote(0, num_grids_y_ - 1) << std::endl;
+    std::wcout << "max note = " << gridLocToMidiNote(num_grids_x_ - 1, 0) << std::endl;
+#endif // !NDEBUG
 }
 
 // ======================================================================
-// draw the text for each note. 
+// (re)build the cells_ table with the note, dot center & label rectangle
+// for every grid location.  Call whenever num_grids, grid size, hex or
+// guitar mode changes.
 //
-void GridStrument::drawText(ID2D1HwndRenderTarget* d2dRenderTarget, IDWriteTextFormat* dwriteTextFormat)
+void GridStrument::buildCells()
 {
-    static const WCHAR note_names[][3] = {
-        // Just in case sharp: ♯ flat: ♭ and a natural: ♮
-        L"C ", L"C♯", L"D ", L"D♯", L"E ", L"F ", L"F♯", L"G ", L"G♯", L"A ", L"A♯", L"B "
-        //L"C ", L"D♭", L"D ", L"E♭", L"E ", L"F ", L"G♭", L"G ", L"A♭", L"A ", L"B♭", L"B "
-    };
-    for (int x = 0; x < num_grids_x_; x++) {
-        for (int y = 0; y < num_grids_y_; y++) {
-            float left, top, right, bottom;
-            int note_index;
+    num_grids_x_ = std::max(num_grids_x_, 0);
+    num_grids_y_ = std::max(num_grids_y_, 0);
+    cells_.resize(static_cast<size_t>(num_grids_x_) * num_grids_y_);
+    for (int y = 0; y < num_grids_y_; y++) {
+        for (int x = 0; x < num_grids_x_; x++) {
+            GridCell& cell = cells_[y * num_grids_x_ + x];
             if (!pref_hex_grid_mode_) {
-                left = 1.0f * x * pref_grid_size_ + 5;
-                // bottom of square
-                // float top = 1.0f * (y + 1) * pref_grid_size_ - 20;
+                cell.note = gridLocToMidiNote(x, y);
+                cell.center_x = x * pref_grid_size_ + pref_grid_size_ / 2.f;
+                cell.center_y = y * pref_grid_size_ + pref_grid_size_ / 2.f;
+                cell.label_left = 1.0f * x * pref_grid_size_ + 5;
                 // top of square
-                top = 1.0f * y * pref_grid_size_ + 5;
-                right = left + 100;
-                bottom = top + 100;
-                int note = gridLocToMidiNote(x, y);
-                note_index = note % 12;
+                cell.label_top = 1.0f * y * pref_grid_size_ + 5;
             }
             else {
-                //int mid_y = num_grids_y_ - 1 - num_grids_y_ / 2;
-                //assert(55 == hexGridLocToMidiNote(num_grids_y_, 0, mid_y));
-                //assert(55+7 == hexGridLocToMidiNote(num_grids_y_, 0, mid_y - 1));
-                D2D1_POINT_2F center = hexGridLocToPoint(pref_grid_size_ / 2, x, y);
-                left = center.x - pref_grid_size_ / 2 + (float)(sqrt(3)*15);
-                top = center.y - pref_grid_size_ / 2 + 10;
-                right = left + 100;
-                bottom = top + 100;
-                int note = hexGridLocToMidiNote(num_grids_y_, x, y);
-                note_index = note % 12;
+                cell.note = hexGridLocToMidiNote(num_grids_y_, x, y);
+                hexGridLocToPoint(pref_grid_size_ / 2, x, y, cell.center_x, cell.center_y);
+                cell.label_left = cell.center_x - pref_grid_size_ / 2 + (float)(sqrt(3) * 15);
+                cell.label_top = cell.center_y - pref_grid_size_ / 2 + 10;
             }
-            d2dRenderTarget->DrawText(
-                note_names[note_index],
-                2,
-                dwriteTextFormat,
-                D2D1::RectF(left, top, right, bottom),
-                brushes_.grid_line_
-                );
+            cell.label_right = cell.label_left + 100;
+            cell.label_bottom = cell.label_top + 100;
         }
     }
-
 }
 
 // ======================================================================
-// draw a background that highlights the six "guitar string" rows when
-// we are in guitar_mode_.
+// copy the current pointers for draw() to use.  Called after handling
+// a batch of pointer events.
 //
-void GridStrument::drawGuitar(ID2D1HwndRenderTarget* d2dRenderTarget)
+void GridStrument::publishPointers()
 {
-    if (pref_hex_grid_mode_)
-        return;
-
-    float left, right, top, bottom;
-    left = 0.0f;
-    right = 1.0f * num_grids_x_ * pref_grid_size_;
-    top = 1.0f * (num_grids_y_ / 2 + 4) * pref_grid_size_;
-    bottom = 1.0f * (num_grids_y_ / 2 - 2) * pref_grid_size_;
-    if (num_grids_y_ % 2 == 0) {
-        top -= 1.0f * pref_grid_size_;
-        bottom -= 1.0f * pref_grid_size_;
-    }
-    D2D1_RECT_F rcf = D2D1::RectF(left, top, right, bottom);
-    d2dRenderTarget->FillRectangle(&rcf, brushes_.guitar_);
+    std::lock_guard<std::mutex> lock(draw_mutex_);
+    draw_pointers_ = grid_pointers_;
 }
 
 // ======================================================================
-// draw the lines making up the grid
+// write the flight recorder to path, with the size & prefs as GridReplay
+// session lines so the file replays with the same note layout.
 //
-void GridStrument::drawGrid(ID2D1HwndRenderTarget* d2dRenderTarget)
-{
-    if (!pref_hex_grid_mode_) {
-        for (int x = 0; x < num_grids_x_ * pref_grid_size_ + 1; x += pref_grid_size_) {
-            d2dRenderTarget->DrawLine(
-                D2D1::Point2F(static_cast<FLOAT>(x), 0.0f),
-                D2D1::Point2F(static_cast<FLOAT>(x), static_cast<FLOAT>(num_grids_y_ * pref_grid_size_)),
-                brushes_.grid_line_,
-                1.5f
-                );
-        }
-        for (int y = 0; y < num_grids_y_ * pref_grid_size_ + 1; y += pref_grid_size_) {
-            d2dRenderTarget->DrawLine(
-                D2D1::Point2F(0.0f, static_cast<FLOAT>(y)),
-                D2D1::Point2F(static_cast<FLOAT>(num_grids_x_ * pref_grid_size_), static_cast<FLOAT>(y)),
-                brushes_.grid_line_,
-                1.5f
-                );
-        }
-    }
-    else {
-        for (int x = 0; x < num_grids_x_; x++) {
-            for (int y = 0; y < num_grids_y_; y++) {
-                hexDrawCell(d2dRenderTarget, brushes_.grid_line_, pref_grid_size_ / 2, num_grids_x_, num_grids_y_, x, y);
-            }
-        }
-    }
+bool GridStrument::saveRecording(const char* path)
+{
+    std::ostringstream header;
+    header << "clock " << GridClock::ticksPerSecond() << "\n"
+        << "size " << width_ << " " << height_ << "\n"
+        << "pref guitar_mode " << pref_guitar_mode_ << "\n"
+        << "pref pitch_bend_range " << pref_pitch_bend_range_ << "\n"
+        << "pref pitch_bend_mask " << pref_pitch_bend_mask_ << "\n"
+        << "pref modulation_controller " << pref_modulation_controller_ << "\n"
+        << "pref midi_channel_range " << pref_midi_channel_min_ << " " << pref_midi_channel_max_ << "\n"
+        << "pref grid_size " << pref_grid_size_ << "\n"
+        << "pref channel_per_row_mode " << pref_channel_per_row_mode_ << "\n"
+        << "pref hex_grid_mode " << pref_hex_grid_mode_ << "\n"
+        << "pref expression_filter " << pref_expression_filter_ << "\n"
+        << "pref midi_flush_ms " << pref_midi_flush_ms_ << "\n";
+    return recorder_.dump(path, header.str());
 }
 
 // ======================================================================
@@ -283,115 +293,169 @@ void GridStrument::drawGrid(ID2D1HwndRenderTarget* d2dRenderTarget)
 // and while we do get pressure, it isn't useful and we use the rectangle
 // area for a "pressure"-like value to store as a modulationZ value.
 //
-// Add a GridPointer to the grid_pointer_ dictionary & index with the ID.
+// Add the pointer to the grid_pointers_ table, indexed by the ID.
 // set all midi values for note, channel & modulationX/Y/Z
 //
 // Finally, if a note is struck, send it to the midi device.
 //
 void GridStrument::pointerDown(int id, RECT rect, POINT point, int pressure)
 {
-#ifndef NDEBUG
-    for (auto pair : grid_pointers_) {
-        assert(pair.first != id);
+    if (grid_pointers_.find(id) >= 0) {
+        // missed the WM_POINTERUP for this id.  End the old note first.
+        std::wcout << "pointerDown id=" << id << " already down" << std::endl;
+        pointerUp(id);
+    }
+    int slot = grid_pointers_.add(id, rect, point, pressure);
+    if (slot < 0) {
+        std::wcout << "pointerDown id=" << id << " dropped, too many pointers" << std::endl;
+        return;
     }
-#endif  
-    grid_pointers_.emplace(id, GridPointer(id, rect, point, pressure));
     int note = pointToMidiNote(point);
-    grid_pointers_[id].note(note);
-    // assume default midi channel mode
-    int channel = midi_channel_;
-    nextMidiChannel();
-    // override in the case of per-row-mode
+    grid_pointers_.note(slot, note);
+    int channel;
     if (pref_channel_per_row_mode_) {
         // use as many channels as you can, given min/max range
         int row = pointToGridRow(point);
         channel = row % (pref_midi_channel_max_ + 1 - pref_midi_channel_min_);
         channel += pref_midi_channel_min_;
-        midi_channel_ = channel;
     }
-    grid_pointers_[id].channel(channel);
+    else {
+        // a channel no other finger holds, if there is one
+        channel = channels_.take();
+    }
+    grid_pointers_.channel(slot, channel);
+    grid_pointers_.channelTaken(slot, !pref_channel_per_row_mode_);
     int midi_pressure = rectToMidiPressure(rect);
-    grid_pointers_[id].modulationZ(midi_pressure);
-    grid_pointers_[id].modulationX(0);
-    grid_pointers_[id].modulationY(0);
+    grid_pointers_.modulationZ(slot, midi_pressure);
+    grid_pointers_.modulationX(slot, 0);
+    grid_pointers_.modulationY(slot, 0);
+    grid_pointers_.time(slot, event_time_);
+    latency_.record(LatencyStage::NOTE_MAPPING, event_time_);
     if (note >= 0) {
         midi_device_->noteOn(channel, note, midi_pressure);
     }
 }
 
 // ======================================================================
-// default way to choose next midi channel.
-//
-void GridStrument::nextMidiChannel() 
-{
-    midi_channel_++;
-    if (midi_channel_ > pref_midi_channel_max_) {
-        midi_channel_ = pref_midi_channel_min_;
-    }
-}
-
-// ======================================================================
-// Handle pointer update event.  Update the GridPointer with new 
+// Handle pointer update event.  Update the pointer table with new 
 // modulationX/Y/Z values and send them to the midi device.
 //
 void GridStrument::pointerUpdate(int id, RECT rect, POINT point, int pressure)
 {
     // NOTE: seems that pressure is always 512 for fingers.
-#ifndef NDEBUG
-    bool found = false;
-    for (auto pair : grid_pointers_) {
-        if (pair.first == id) {
-            found = true;
-        }
+    int slot = grid_pointers_.find(id);
+    if (slot < 0) {
+        // missed the pointerDown or it was dropped.  Nothing to update.
+        return;
     }
-    assert(found);
-#endif
-    auto& cur_ptr = grid_pointers_[id];
-    cur_ptr.update(rect, point, pressure);
-    int channel = cur_ptr.channel();
-    POINT change = cur_ptr.pointChange();
-    int mod_pitch = pointChangeToPitchBend(change);
-    if (mod_pitch != cur_ptr.modulationX()) {
-        cur_ptr.modulationX(mod_pitch);
-        midi_device_->pitchBend(channel, mod_pitch);
+    grid_pointers_.update(slot, rect, point, pressure);
+    int channel = grid_pointers_.channel(slot);
+    POINT change;
+    int midi_pressure;
+    if (pref_expression_filter_) {
+        // smooth out touch jitter so it doesn't become a stream of midi
+        grid_pointers_.filter(slot, sampleInterval(slot), POINT_FILTER, SIZE_FILTER);
+        change = grid_pointers_.filteredPointChange(slot);
+        float size = grid_pointers_.filteredSize(slot);
+        midi_pressure = areaToMidiPressure(size * size);
     }
-    int mod_modulation = pointChangeToMidiModulation(change);
-    if (mod_modulation != cur_ptr.modulationY()) {
-        cur_ptr.modulationY(mod_modulation);
-        midi_device_->controlChange(channel, pref_modulation_controller_, mod_modulation);
+    else {
+        change = grid_pointers_.pointChange(slot);
+        midi_pressure = rectToMidiPressure(rect);
     }
-    int midi_pressure = rectToMidiPressure(rect);
-    if (midi_pressure != cur_ptr.modulationZ()) {
-        cur_ptr.modulationZ(midi_pressure);
-        int note = cur_ptr.note();
-        midi_device_->polyKeyPressure(channel, note, midi_pressure);
+    int mod_pitch = pointChangeToPitchBend(change);
+    int mod_modulation = pointChangeToMidiModulation(change);
+    // the synth applies X & Y to this finger's note alone, so fingers
+    // sharing a channel don't bend each other
+    int note = grid_pointers_.note(slot);
+    latency_.record(LatencyStage::NOTE_MAPPING, event_time_);
+    if (mod_pitch != grid_pointers_.modulationX(slot)) {
+        grid_pointers_.modulationX(slot, mod_pitch);
+        midi_device_->pitchBend(channel, mod_pitch, note);
+    }
+    if (mod_modulation != grid_pointers_.modulationY(slot)) {
+        grid_pointers_.modulationY(slot, mod_modulation);
+        midi_device_->controlChange(channel, pref_modulation_controller_, mod_modulation, note);
+    }
+    if (midi_pressure != grid_pointers_.modulationZ(slot)) {
+        grid_pointers_.modulationZ(slot, midi_pressure);
+        if (note >= 0) {
+            midi_device_->polyKeyPressure(channel, note, midi_pressure);
+        }
     }
 }
 
 // ======================================================================
 // handle when the finger touch goes away.  Shut everything down and
-// remove it from the grid_pointers_ dictionary.
+// remove it from the grid_pointers_ table.
 //
 void GridStrument::pointerUp(int id)
 {
-#ifndef NDEBUG
-    bool found = false;
-    for (auto pair : grid_pointers_) {
-        if (pair.first == id) {
-            found = true;
-        }
+    int slot = grid_pointers_.find(id);
+    if (slot < 0) {
+        return;
     }
-    assert(found);
-#endif
-    int note = grid_pointers_[id].note();
-    int channel = grid_pointers_[id].channel();
-    grid_pointers_.erase(id);
+    int note = grid_pointers_.note(slot);
+    int channel = grid_pointers_.channel(slot);
+    bool taken = grid_pointers_.channelTaken(slot);
+    grid_pointers_.remove(slot);
+    // by how this finger got its channel, as the mode may have changed since
+    if (taken) {
+        channels_.release(channel);
+    }
+    latency_.record(LatencyStage::NOTE_MAPPING, event_time_);
     if (note >= 0) {
         midi_device_->noteOn(channel, note, 0);
     }
     midi_device_->controlChange(channel, pref_modulation_controller_, 0);
 }
 
+// ======================================================================
+// handle all the touch samples from one or more pointer frames in one
+// call.  The samples are put in timestamp order (in place, keeping the
+// order of equal times) and then handled just like individual
+// pointerDown/Update/Up calls, recording latency from each timestamp.
+// Frames are small & nearly sorted, so insertion sort is fast and does
+// not allocate.
+//
+void GridStrument::pointerFrame(TouchSample* samples, int count)
+{
+    for (int i = 1; i < count; i++) {
+        TouchSample sample = samples[i];
+        int j = i - 1;
+        while (j >= 0 && samples[j].time > sample.time) {
+            samples[j + 1] = samples[j];
+            j--;
+        }
+        samples[j + 1] = sample;
+    }
+    midi_device_->beginFrame();
+    recorder_.frame((count > 0) ? samples[0].time : 0);
+    for (int i = 0; i < count; i++) {
+        const TouchSample& sample = samples[i];
+        event_time_ = sample.time;
+        midi_device_->eventTime(event_time_);
+        latency_.record(LatencyStage::INGEST, event_time_);
+        recorder_.touch(sample);
+        switch (sample.type) {
+        case TouchType::DOWN:
+            pointerDown(sample.id, sample.rect, sample.point, sample.pressure);
+            break;
+        case TouchType::UPDATE:
+            pointerUpdate(sample.id, sample.rect, sample.point, sample.pressure);
+            break;
+        case TouchType::UP:
+            pointerUp(sample.id);
+            break;
+        }
+    }
+    // send the frame's coalesced midi, unless it is held a while longer
+    midi_device_->endFrame((count > 0) ? samples[count - 1].time : GridClock::now());
+    // direct pointerDown/Update/Up calls have no timestamp
+    event_time_ = 0;
+    midi_device_->eventTime(0);
+}
+
 // ======================================================================
 // convert window point to grid x.  -1 if not in the grid
 //
@@ -420,24 +484,28 @@ int GridStrument::pointToGridRow(POINT point)
 // convert window point to a midi note value.  return -1 if not in the grid
 int GridStrument::pointToMidiNote(POINT point)
 {
-    int note;
+    int x, y;
     if (!pref_hex_grid_mode_) {
-        int x = pointToGridColumn(point);
+        x = pointToGridColumn(point);
         if (x < 0) {
             return -1;
         }
-        int y = pointToGridRow(point);
+        y = pointToGridRow(point);
         if (y < 0) {
             return -1;
         }
-        note = gridLocToMidiNote(x, y);
     }
     else {
-        int x, y;
         pointToHexGridLoc(point, pref_grid_size_/2, x, y); // updates x,y
-        note = hexGridLocToMidiNote(num_grids_y_, x, y);
     }
-    return note;
+    if ((x >= 0) && (x < num_grids_x_) && (y >= 0) && (y < num_grids_y_)) {
+        return cells_[y * num_grids_x_ + x].note;
+    }
+    // partial cells along the right & bottom edge are not in the table
+    if (!pref_hex_grid_mode_) {
+        return gridLocToMidiNote(x, y);
+    }
+    return hexGridLocToMidiNote(num_grids_y_, x, y);
 }
 
 // ======================================================================
@@ -476,13 +544,32 @@ int GridStrument::rectToMidiPressure(RECT rect)
     int x = (rect.right - rect.left);
     int y = (rect.bottom - rect.top);
     int area = x * y;
-    float ratio = static_cast<float>(area) / (pref_grid_size_ / 2 * pref_grid_size_ / 2);
+    return areaToMidiPressure(static_cast<float>(area));
+}
+
+int GridStrument::areaToMidiPressure(float area)
+{
+    float ratio = area / (pref_grid_size_ / 2 * pref_grid_size_ / 2);
     ratio = sqrtf(ratio) - 0.25f;  // linearize it
     int pressure = static_cast<int>(ratio * 100);
-    if (pressure > 127) {
-        pressure = 127;
+    // a touch smaller than a quarter grid would go negative
+    return std::clamp(pressure, 0, 127);
+}
+
+// ======================================================================
+// seconds since this pointer's previous sample, for the expression
+// filters.  Direct pointerUpdate calls have no timestamp, so assume the
+// usual 120Hz digitizer rate.
+//
+float GridStrument::sampleInterval(int slot)
+{
+    float dt = 1.0f / 120;
+    long long last_time = grid_pointers_.time(slot);
+    if (event_time_ != 0 && last_time != 0) {
+        dt = GridClock::ticksToNanoseconds(event_time_ - last_time) * 1e-9f;
     }
-    return pressure;
+    grid_pointers_.time(slot, event_time_);
+    return std::clamp(dt, 0.0005f, 0.1f);
 }
 
 // ======================================================================
@@ -527,298 +614,3 @@ int GridStrument::pointChangeToMidiModulation(POINT delta)
     }
     return modulation;
 }
-
-// ======================================================================
-// hex notes
-// https://www.redblobgames.com/grids/hexagons/
-// https://www.redblobgames.com/grids/hexagons/implementation.html
-// q (flat top, instead of r pointy top) orientation matches
-//    https://en.wikipedia.org/wiki/Harmonic_table_note_layout
-// odd-q puts 0,0 in upper left corner.  let's use that
-// 
-
-// Code below based on 
-// Generated code -- CC0 -- No Rights Reserved -- http://www.redblobgames.com/grids/hexagons/
-//
-
-struct Point
-{
-    const double x;
-    const double y;
-    Point(double x_, double y_) : x(x_), y(y_) {}
-};
-
-// These are cube coords, our native is offset coords (see below)
-// we need to convert from Offset to Hex 
-struct Hex
-{
-    const int q;
-    const int r;
-    const int s;
-    Hex(int q_, int r_, int s_) : q(q_), r(r_), s(s_) {
-        if (q + r + s != 0) throw "q + r + s must be 0";
-    }
-};
-
-struct FractionalHex
-{
-    const double q;
-    const double r;
-    const double s;
-    FractionalHex(double q_, double r_, double s_) : q(q_), r(r_), s(s_) {
-        if (round(q + r + s) != 0) throw "q + r + s must be 0";
-    }
-};
-
-struct OffsetCoord
-{
-    const int col;
-    const int row;
-    OffsetCoord(int col_, int row_) : col(col_), row(row_) {}
-};
-
-struct FractionalOffsetCoord
-{
-    const double col;
-    const double row;
-    FractionalOffsetCoord(double col_, double row_) : col(col_), row(row_) {}
-};
-
-struct Orientation
-{
-    const double f0;
-    const double f1;
-    const double f2;
-    const double f3;
-    const double b0;
-    const double b1;
-    const double b2;
-    const double b3;
-    const double start_angle;
-    Orientation(double f0_, double f1_, double f2_, double f3_, double b0_, double b1_, double b2_, double b3_, double start_angle_) : f0(f0_), f1(f1_), f2(f2_), f3(f3_), b0(b0_), b1(b1_), b2(b2_), b3(b3_), start_angle(start_angle_) {}
-};
-
-struct Layout
-{
-    const Orientation orientation;
-    const Point size;
-    const Point origin;
-    Layout(Orientation orientation_, Point size_, Point origin_) : orientation(orientation_), size(size_), origin(origin_) {}
-};
-
-const Orientation flat_orientation = Orientation(3.0 / 2.0, 0.0, sqrt(3.0) / 2.0, sqrt(3.0), 2.0 / 3.0, 0.0, -1.0 / 3.0, sqrt(3.0) / 3.0, 0.0);
-
-Point hex_to_pixel(Layout layout, Hex h)
-{
-    Orientation M = layout.orientation;
-    Point size = layout.size;
-    Point origin = layout.origin;
-    double x = (M.f0 * h.q + M.f1 * h.r) * size.x;
-    double y = (M.f2 * h.q + M.f3 * h.r) * size.y;
-    return Point(x + origin.x, y + origin.y);
-}
-
-FractionalHex pixel_to_hex(Layout layout, Point p)
-{
-    Orientation M = layout.orientation;
-    Point size = layout.size;
-    Point origin = layout.origin;
-    Point pt = Point((p.x - origin.x) / size.x, (p.y - origin.y) / size.y);
-    double q = M.b0 * pt.x + M.b1 * pt.y;
-    double r = M.b2 * pt.x + M.b3 * pt.y;
-    return FractionalHex(q, r, -q - r);
-}
-
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
-
-Point hex_corner_offset(Layout layout, int corner) {
-    Point size = layout.size;
-    double angle = 2.0 * M_PI *
-        (layout.orientation.start_angle + corner) / 6;
-    return Point(size.x * cos(angle), size.y * sin(angle));
-}
-
-std::vector<Point> polygon_corners(Layout layout, Hex h) {
-    std::vector<Point> corners = {};
-    Point center = hex_to_pixel(layout, h);
-    for (int i = 0; i < 6; i++) {
-        Point offset = hex_corner_offset(layout, i);
-        corners.push_back(Point(center.x + offset.x,
-            center.y + offset.y));
-    }
-    return corners;
-}
-
-const double EVEN = 1;
-const double ODD = -1;
-OffsetCoord qoffset_from_cube(int offset, Hex h)
-{
-    int col = h.q;
-    int row = h.r + int((h.q + offset * (h.q & 1)) / 2);
-    if (offset != EVEN && offset != ODD)
-    {
-        throw "offset must be EVEN (+1) or ODD (-1)";
-    }
-    return OffsetCoord(col, row);
-}
-FractionalOffsetCoord qoffset_from_cube(double offset, FractionalHex h)
-{
-    double col = h.q;
-    double odd_q = static_cast<int>(h.q) & 1 ? 1 : 0;
-    double row = h.r + int((h.q + offset * odd_q) / 2);
-    if (offset != EVEN && offset != ODD)
-    {
-        throw "offset must be EVEN (+1) or ODD (-1)";
-    }
-    return FractionalOffsetCoord(col, row);
-}
-
-Hex qoffset_to_cube(int offset, OffsetCoord h)
-{
-    int q = h.col;
-    int r = h.row - int((h.col + offset * (h.col & 1)) / 2);
-    int s = -q - r;
-    if (offset != EVEN && offset != ODD)
-    {
-        throw "offset must be EVEN (+1) or ODD (-1)";
-    }
-    return Hex(q, r, s);
-}
-
-Hex hex_round(FractionalHex h)
-{
-    int qi = int(round(h.q));
-    int ri = int(round(h.r));
-    int si = int(round(h.s));
-    double q_diff = abs(qi - h.q);
-    double r_diff = abs(ri - h.r);
-    double s_diff = abs(si - h.s);
-    if (q_diff > r_diff && q_diff > s_diff)
-    {
-        qi = -ri - si;
-    }
-    else
-        if (r_diff > s_diff)
-        {
-            ri = -qi - si;
-        }
-        else
-        {
-            si = -qi - ri;
-        }
-    return Hex(qi, ri, si);
-}
-
-// ======================================================================
-// "public" methods for dealing with hex grids
-// FIXME - refactor this to be more object-oriented instead of functional
-void hexGetNumGrids(int screen_width, int screen_height, int grid_size, int& num_grids_x, int& num_grids_y)
-{
-    Layout l = Layout(flat_orientation, Point(grid_size, grid_size), Point(grid_size, sqrt(3) * grid_size / 2));
-    FractionalHex fh = pixel_to_hex(l, Point(screen_width, screen_height));
-    FractionalOffsetCoord oc = qoffset_from_cube(ODD, fh);
-    num_grids_x = static_cast<int>(oc.col);
-    num_grids_y = static_cast<int>(oc.row);
-}
-
-void hexDrawCell(ID2D1HwndRenderTarget* d2dRenderTarget, ID2D1SolidColorBrush* brush, int grid_size, int num_grids_x, int num_grids_y, int x, int y)
-{
-    OffsetCoord oc = OffsetCoord(x, y);
-    Hex h = qoffset_to_cube((int)ODD, oc);
-    Layout l = Layout(flat_orientation, Point(grid_size, grid_size), Point(grid_size, sqrt(3) * grid_size / 2));
-    std::vector<Point> points = polygon_corners(l, h);
-    // drawing all 6 lines results in lots of overdraw, so we do something a bit more complicated
-    // to avoid the overdraw
-    for (int i = 3; i < 6; i++) {
-        float x0 = static_cast<float>(points[i].x);
-        float y0 = static_cast<float>(points[i].y);
-        float x1 = static_cast<float>(points[(i + 1) % 6].x);
-        float y1 = static_cast<float>(points[(i + 1) % 6].y);
-        d2dRenderTarget->DrawLine(D2D1::Point2F(x0, y0), D2D1::Point2F(x1, y1), brush, 1.5f);
-    }
-    if (x == 0) {
-        int i = 2;
-        float x0 = static_cast<float>(points[i].x);
-        float y0 = static_cast<float>(points[i].y);
-        float x1 = static_cast<float>(points[(i + 1) % 6].x);
-        float y1 = static_cast<float>(points[(i + 1) % 6].y);
-        d2dRenderTarget->DrawLine(D2D1::Point2F(x0, y0), D2D1::Point2F(x1, y1), brush, 1.5f);
-    }
-    else if (x == num_grids_x - 1) {
-        int i = 0;
-        float x0 = static_cast<float>(points[i].x);
-        float y0 = static_cast<float>(points[i].y);
-        float x1 = static_cast<float>(points[(i + 1) % 6].x);
-        float y1 = static_cast<float>(points[(i + 1) % 6].y);
-        d2dRenderTarget->DrawLine(D2D1::Point2F(x0, y0), D2D1::Point2F(x1, y1), brush, 1.5f);
-    }
-    if (y == num_grids_y - 1) {
-        if ((x & 1) == 0) { // even
-            int i = 1;
-            float x0 = static_cast<float>(points[i].x);
-            float y0 = static_cast<float>(points[i].y);
-            float x1 = static_cast<float>(points[(i + 1) % 6].x);
-            float y1 = static_cast<float>(points[(i + 1) % 6].y);
-            d2dRenderTarget->DrawLine(D2D1::Point2F(x0, y0), D2D1::Point2F(x1, y1), brush, 1.5f);
-        }
-        else {
-            for (int i = 0; i < 3; i++) {
-                float x0 = static_cast<float>(points[i].x);
-                float y0 = static_cast<float>(points[i].y);
-                float x1 = static_cast<float>(points[(i + 1) % 6].x);
-                float y1 = static_cast<float>(points[(i + 1) % 6].y);
-                d2dRenderTarget->DrawLine(D2D1::Point2F(x0, y0), D2D1::Point2F(x1, y1), brush, 1.5f);
-            }
-        }
-    }
-}
-
-int hexGridLocToMidiNote(int num_grids_y, int x, int y)
-{
-    // Y-Delta is like the X row size in normal array index math
-    // It is fixed at 7 to match going up by musical *fifths*
-    int Y_DELTA = 7;
-    // Y-invert so up is higher note.  Grid Y ranges from 0..(num-1)
-    y = num_grids_y - 1 - y;
-    int center_y = num_grids_y / 2;
-    int note;
-    if ((x & 1) == 0) {
-        // EVEN: put 55 or guitar's 4th string open G on left in middle
-        int offset = 55 - (0 + center_y * Y_DELTA);
-        x = x / 2;
-        note = offset + x + y * Y_DELTA;
-    }
-    else {
-        // ODD: put E-below-G as left-middle offset for odd strings
-        // (so E + minor third = G)
-        // g f# f e = 55 54 53 52
-        int offset = 52 - (0 + center_y * Y_DELTA);
-        x = (x - 1) / 2;
-        note = offset + x + y * Y_DELTA;
-    }
-    note = std::clamp(note, 0, 127);
-    return note;
-
-}
-
-D2D1_POINT_2F hexGridLocToPoint(int grid_size, int x, int y)
-{
-    OffsetCoord oc = OffsetCoord(x, y);
-    Hex h = qoffset_to_cube((int)ODD, oc);
-    Layout l = Layout(flat_orientation, Point(grid_size, grid_size), Point(grid_size, sqrt(3) * grid_size / 2));
-    Point center = hex_to_pixel(l, h);
-    return  D2D1::Point2F(static_cast<float>(center.x), static_cast<float>(center.y));
-}
-
-void pointToHexGridLoc(POINT point, int grid_size, int& x, int& y)
-{
-    Layout l = Layout(flat_orientation, Point(grid_size, grid_size), Point(grid_size, sqrt(3) * grid_size / 2));
-    FractionalHex fh = pixel_to_hex(l, Point(point.x, point.y));
-    // If you use offset coordinates, use return cube_to_{odd,even}{r,q}(cube_round(Cube(q, -q-r, r))).
-    Hex h = hex_round(fh);
-    OffsetCoord oc = qoffset_from_cube((int)ODD, h);
-    x = static_cast<int>(oc.col);
-    y = static_cast<int>(oc.row);
-}
@@ -16,15 +16,21 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 // ======================================================================
 #pragma once
+#ifdef _WIN32
 #include <d2d1.h>
-#include <mmsystem.h>
+#endif
 #include <algorithm>
-#include <map>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <vector>
 #include <assert.h>
+#include "GridChannels.h"
+#include "GridLatency.h"
 #include "GridPointer.h"
+#include "GridRecorder.h"
 #include "GridMidi.h"
+#include "GridMidiScheduler.h"
 #include "GridSynth.h"
 
 // ======================================================================
@@ -33,6 +39,8 @@
 enum class Theme { DEFAULT = 0, TUFTE, MAXIMUM };
 const std::wstring ThemeNames[] = { L"LinnStrument", L"Tufte" };
 
+#ifdef _WIN32
+
 // ======================================================================
 // helper class for color themes
 //
@@ -160,6 +168,19 @@ struct GridBrushes
         assert(SUCCEEDED(hr));
     }
 };
+#endif // _WIN32
+
+// ======================================================================
+// precomputed per-cell values.  Built when the grid changes size or
+// layout so touch & draw code only need to index into a table.
+//
+struct GridCell
+{
+    int note;                      // midi note for this cell
+    float center_x, center_y;      // center of the cell (note dot)
+    float label_left, label_top;   // note name text rectangle
+    float label_right, label_bottom;
+};
 
 class GridStrument
 {
@@ -175,30 +196,74 @@ class GridStrument
     bool pref_play_midi_;
     bool pref_play_soundfont_;
     std::string pref_soundfont_path_;
+    bool pref_expression_filter_;
+    int pref_midi_flush_ms_;
+    int pref_midi_delay_ms_;
+    int pref_soundfont_cache_mb_;
+    bool pref_synth_overlay_;
 
-    // all of the current finger touches in one dictionary
-    std::map<int, GridPointer> grid_pointers_;
-    D2D1_SIZE_U size_;               // size of the window
+    // all of the current finger touches in one table
+    GridPointers grid_pointers_;
+    // copy of grid_pointers_ for drawing.  The pointer methods may run on
+    // another thread, so they publishPointers() & draw() reads this copy.
+    GridPointers draw_pointers_;
+    std::mutex draw_mutex_;
+    int width_, height_;             // size of the window
     int num_grids_x_, num_grids_y_;  // number of boxes for notes
-    GridMidi* midi_device_;          // the current midi output
-    int midi_channel_;               // next midi channel to use
+    std::vector<GridCell> cells_;    // num_grids_y_ rows of num_grids_x_ cells
+    GridMidi* midi_device_;          // midi output to the sinks below
+    GridChannels channels_;          // for new fingers, unless channel per row mode
+#ifdef _WIN32
     GridBrushes brushes_;            // all of our brushes
-    // Synth var
+#endif
+    // Synth var, owned by caller & may be nullptr
     GridSynth* grid_synth_;
+    GridLatency latency_;            // touch-to-sound latency by stage
+    GridMidiErrors midi_errors_;     // midi output failures & recoveries
+#ifdef _WIN32
+    GridMidiOutSink midi_out_sink_;  // added to midi_device_ to play midi
+    GridMidiScheduler midi_scheduler_;  // or this, in front of it, with a delay
+#endif
+    GridSynthSink synth_sink_;       // added to midi_device_ to play the synth
+    long long event_time_;           // OS timestamp of the sample being handled
+    GridRecorder recorder_;          // recent touches & midi, for post-mortems
 
 public:
-    GridStrument(HMIDIOUT midiDevice);
+    explicit GridStrument(GridSynth* gridSynth);
     ~GridStrument();
 
-    void midiDevice(HMIDIOUT midiDevice);
-    void resize(D2D1_SIZE_U size);
+#ifdef _WIN32
+    MMRESULT midiDevice(UINT device_index);
+    void closeMidiDevice();
+#endif
+    void resize(int width, int height);
+#ifdef _WIN32
     void draw(ID2D1HwndRenderTarget* d2dRenderTarget, IDWriteTextFormat* dwriteTextFormat);
+#endif
     void pointerDown(int id, RECT rect, POINT point, int pressure);
     void pointerUpdate(int id, RECT rect, POINT point, int pressure);
     void pointerUp(int id);
+    void pointerFrame(TouchSample* samples, int count);
+    void publishPointers();
+    GridLatency& latency() { return latency_; }
+    GridMidiErrors& midiErrors() { return midi_errors_; }
+    GridChannels& channels() { return channels_; }
+    GridMidi* midiOutput() { return midi_device_; }
+    // coalesced midi output, for the control thread
+    void midiTick(long long now) { midi_device_->tick(now); }
+    long long midiFlushTime() { return midi_device_->flushTime(); }
+    void midiFlush() { midi_device_->flush(); }
+    bool saveRecording(const char* path);
+    friend class GridBench;
+    friend class GridTest;          // each test program has its own
     // get/set preferences
     bool prefGuitarMode() { return pref_guitar_mode_; }
-    void prefGuitarMode(bool mode) { pref_guitar_mode_ = mode; }
+    void prefGuitarMode(bool mode) {
+        if (mode != pref_guitar_mode_) {
+            pref_guitar_mode_ = mode;
+            buildCells();
+        }
+    }
     int prefPitchBendRange() { return pref_pitch_bend_range_; }
     void prefPitchBendRange(int value) {
         pref_pitch_bend_range_ = std::clamp(value, 1, 12);
@@ -221,57 +286,74 @@ public:
             std::wcout << "Forcing Midi Channel min == max == " << pref_midi_channel_max_ << std::endl;
             pref_midi_channel_min_ = pref_midi_channel_max_;
         }
+        updateChannels();
     }
     int prefGridSize() { return pref_grid_size_; }
     void prefGridSize(int value) {
         value = std::clamp(value, 40, 400);
         if (value != pref_grid_size_) {
             pref_grid_size_ = value;
-            resize(size_);
+            resize(width_, height_);
         }
     }
     bool prefChannelPerRowMode() { return pref_channel_per_row_mode_; }
     void prefChannelPerRowMode(bool mode) { pref_channel_per_row_mode_ = mode; }
+#ifdef _WIN32
     Theme prefColorTheme() { return brushes_.curTheme(); }
     void prefColorTheme(Theme t) { brushes_.curTheme(t); }
+#endif
     bool prefHexGridMode() { return pref_hex_grid_mode_; }
     void prefHexGridMode(bool mode) { 
         if (mode != pref_hex_grid_mode_) {
             pref_hex_grid_mode_ = mode;
-            resize(size_);
+            resize(width_, height_);
         }
     }
     bool prefPlayMidi() { return pref_play_midi_; }
-    void prefPlayMidi(bool mode) { 
-        pref_play_midi_ = mode; 
-        midi_device_->playMidi(pref_play_midi_);
-    }
+    void prefPlayMidi(bool mode);
     bool prefPlaySoundfont() { return pref_play_soundfont_; }
-    void prefPlaySoundfont(bool mode) { 
-        pref_play_soundfont_ = mode;
-        midi_device_->playSynth(pref_play_soundfont_);
-    }
+    void prefPlaySoundfont(bool mode);
+    bool prefExpressionFilter() { return pref_expression_filter_; }
+    void prefExpressionFilter(bool mode) { pref_expression_filter_ = mode; }
+    int prefMidiFlushMs() { return pref_midi_flush_ms_; }
+    void prefMidiFlushMs(int ms);
+    int prefMidiDelayMs() { return pref_midi_delay_ms_; }
+    void prefMidiDelayMs(int ms);
+    int prefSoundfontCacheMb() { return pref_soundfont_cache_mb_; }
+    void prefSoundfontCacheMb(int mb);
+    bool prefSynthOverlay() { return pref_synth_overlay_; }
+    void prefSynthOverlay(bool mode) { pref_synth_overlay_ = mode; }
     std::string prefSoundfontPath() { return pref_soundfont_path_; }
     void prefSoundfontPath(std::string s) {
-        // don't reload the soundfont unnecessarily
+        // don't reload the soundfont unnecessarily.  It loads in the
+        // background & plays from the next note on.
         if (s != pref_soundfont_path_) {
             pref_soundfont_path_ = s;
-            grid_synth_->loadSoundfont(pref_soundfont_path_);
+            if (grid_synth_ != nullptr) {
+                grid_synth_->loadSoundfont(pref_soundfont_path_);
+            }
         }
     }
 
 private:
-    void drawPointers(ID2D1HwndRenderTarget* d2dRenderTarget);
-    void drawDots(ID2D1HwndRenderTarget* d2dRenderTarget);
+#ifdef _WIN32
+    void drawPointers(ID2D1HwndRenderTarget* d2dRenderTarget, GridPointers& pointers);
+    void drawDots(ID2D1HwndRenderTarget* d2dRenderTarget, GridPointers& pointers);
     void drawText(ID2D1HwndRenderTarget* d2dRenderTarget, IDWriteTextFormat* dwriteTextFormat);
+    void drawSynthStats(ID2D1HwndRenderTarget* d2dRenderTarget, IDWriteTextFormat* dwriteTextFormat);
     void drawGuitar(ID2D1HwndRenderTarget* d2dRenderTarget);
     void drawGrid(ID2D1HwndRenderTarget* d2dRenderTarget);
-    void nextMidiChannel();
+#endif
+    void buildCells();
+    void updateMidiSinks();
+    void updateChannels();
     int pointToGridColumn(POINT point);
     int pointToGridRow(POINT point);
     int pointToMidiNote(POINT point);
     int gridLocToMidiNote(int x, int y);
     int rectToMidiPressure(RECT rect);
+    int areaToMidiPressure(float area);
+    float sampleInterval(int slot);
     int pointChangeToPitchBend(POINT delta);
     int pointChangeToMidiModulation(POINT delta);
 };
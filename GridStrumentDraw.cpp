@@ -0,0 +1,268 @@
+﻿// ======================================================================
+// WinGridStrument - a Windows touchscreen musical instrument
+// Copyright(C) 2020 Roger Allen
+// 
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "GridStrument.h"
+#include "GridHex.h"
+#include "GridUtils.h"
+
+#include <iomanip>
+#include <sstream>
+
+// ======================================================================
+// All of the Direct2D drawing for GridStrument.  This is the only part of
+// GridStrument that needs Windows, the rest builds portably.
+//
+
+// ======================================================================
+// draw the outline of one hex cell
+//
+static void hexDrawCell(ID2D1HwndRenderTarget* d2dRenderTarget, ID2D1SolidColorBrush* brush, int grid_size, int num_grids_x, int num_grids_y, int x, int y)
+{
+    float corners_x[6], corners_y[6];
+    hexGridLocCorners(grid_size, x, y, corners_x, corners_y);
+    // drawing all 6 lines results in lots of overdraw, so we do something a bit more complicated
+    // to avoid the overdraw
+    for (int i = 3; i < 6; i++) {
+        float x0 = corners_x[i];
+        float y0 = corners_y[i];
+        float x1 = corners_x[(i + 1) % 6];
+        float y1 = corners_y[(i + 1) % 6];
+        d2dRenderTarget->DrawLine(D2D1::Point2F(x0, y0), D2D1::Point2F(x1, y1), brush, 1.5f);
+    }
+    if (x == 0) {
+        int i = 2;
+        float x0 = corners_x[i];
+        float y0 = corners_y[i];
+        float x1 = corners_x[(i + 1) % 6];
+        float y1 = corners_y[(i + 1) % 6];
+        d2dRenderTarget->DrawLine(D2D1::Point2F(x0, y0), D2D1::Point2F(x1, y1), brush, 1.5f);
+    }
+    else if (x == num_grids_x - 1) {
+        int i = 0;
+        float x0 = corners_x[i];
+        float y0 = corners_y[i];
+        float x1 = corners_x[(i + 1) % 6];
+        float y1 = corners_y[(i + 1) % 6];
+        d2dRenderTarget->DrawLine(D2D1::Point2F(x0, y0), D2D1::Point2F(x1, y1), brush, 1.5f);
+    }
+    if (y == num_grids_y - 1) {
+        if ((x & 1) == 0) { // even
+            int i = 1;
+            float x0 = corners_x[i];
+            float y0 = corners_y[i];
+            float x1 = corners_x[(i + 1) % 6];
+            float y1 = corners_y[(i + 1) % 6];
+            d2dRenderTarget->DrawLine(D2D1::Point2F(x0, y0), D2D1::Point2F(x1, y1), brush, 1.5f);
+        }
+        else {
+            for (int i = 0; i < 3; i++) {
+                float x0 = corners_x[i];
+                float y0 = corners_y[i];
+                float x1 = corners_x[(i + 1) % 6];
+                float y1 = corners_y[(i + 1) % 6];
+                d2dRenderTarget->DrawLine(D2D1::Point2F(x0, y0), D2D1::Point2F(x1, y1), brush, 1.5f);
+            }
+        }
+    }
+}
+
+// ======================================================================
+// main drawing routine.  create brushes if necessary & then draw the
+// grid, notes, etc.
+//
+void GridStrument::draw(ID2D1HwndRenderTarget* d2dRenderTarget, IDWriteTextFormat* dwriteTextFormat)
+{
+    if (!brushes_.initialized_) {
+        brushes_.init(d2dRenderTarget);
+    }
+    d2dRenderTarget->Clear(brushes_.color_theme_.clearColor());
+    if (pref_guitar_mode_) {
+        drawGuitar(d2dRenderTarget);
+    }
+    GridPointers pointers;
+    {
+        std::lock_guard<std::mutex> lock(draw_mutex_);
+        pointers = draw_pointers_;
+    }
+    drawGrid(d2dRenderTarget);
+    drawDots(d2dRenderTarget, pointers);
+    drawText(d2dRenderTarget, dwriteTextFormat);
+    drawPointers(d2dRenderTarget, pointers);
+    if (pref_synth_overlay_ && grid_synth_ != nullptr) {
+        drawSynthStats(d2dRenderTarget, dwriteTextFormat);
+    }
+}
+
+// ======================================================================
+// draw the touch rectangles for each finger
+//
+void GridStrument::drawPointers(ID2D1HwndRenderTarget* d2dRenderTarget, GridPointers& pointers)
+{
+    // FIXME add pointer brush to brushes_, it isn't dynamic any longer.
+    for (int i = 0; i < pointers.size(); i++) {
+        ID2D1SolidColorBrush* pBrush;
+        HRESULT hr = d2dRenderTarget->CreateSolidColorBrush(brushes_.color_theme_.touchColor(), &pBrush);
+        if (SUCCEEDED(hr)) {
+            RECT rc = pointers.rect(i);
+            D2D1_RECT_F rcf = D2D1::RectF((float)rc.left, (float)rc.top, (float)rc.right, (float)rc.bottom);
+            d2dRenderTarget->FillRectangle(&rcf, pBrush);
+            SafeRelease(&pBrush);
+        }
+    }
+}
+
+// ======================================================================
+// draw the dots for each note. C gets a special color.
+// Notes that are currently pressed also get a special color.
+//
+void GridStrument::drawDots(ID2D1HwndRenderTarget* d2dRenderTarget, GridPointers& pointers)
+{
+    bool active_notes[128] = {};
+    for (int i = 0; i < pointers.size(); i++) {
+        int note = pointers.note(i);
+        if (note >= 0) {
+            active_notes[note] = true;
+        }
+    }
+    for (const GridCell& cell : cells_) {
+        int note = cell.note;
+        D2D1_POINT_2F center = D2D1::Point2F(cell.center_x, cell.center_y);
+        D2D1_ELLIPSE ellipse = D2D1::Ellipse(
+            center,
+            pref_grid_size_ / 5.f,
+            pref_grid_size_ / 5.f
+            );
+        if (active_notes[note]) {
+            d2dRenderTarget->FillEllipse(ellipse, brushes_.highlight_);
+        }
+        else if (note % 12 == 0) {
+            d2dRenderTarget->FillEllipse(ellipse, brushes_.c_note_);
+        }
+        else if (((note % 12) == 2) || ((note % 12) == 4) || ((note % 12) == 5) ||
+            ((note % 12) == 7) || ((note % 12) == 9) || ((note % 12) == 11)) {
+            d2dRenderTarget->FillEllipse(ellipse, brushes_.note_);
+        }
+    }
+
+}
+
+// ======================================================================
+// draw the text for each note. 
+//
+void GridStrument::drawText(ID2D1HwndRenderTarget* d2dRenderTarget, IDWriteTextFormat* dwriteTextFormat)
+{
+    static const WCHAR note_names[][3] = {
+        // Just in case sharp: ♯ flat: ♭ and a natural: ♮
+        L"C ", L"C♯", L"D ", L"D♯", L"E ", L"F ", L"F♯", L"G ", L"G♯", L"A ", L"A♯", L"B "
+        //L"C ", L"D♭", L"D ", L"E♭", L"E ", L"F ", L"G♭", L"G ", L"A♭", L"A ", L"B♭", L"B "
+    };
+    for (const GridCell& cell : cells_) {
+        d2dRenderTarget->DrawText(
+            note_names[cell.note % 12],
+            2,
+            dwriteTextFormat,
+            D2D1::RectF(cell.label_left, cell.label_top, cell.label_right, cell.label_bottom),
+            brushes_.grid_line_
+            );
+    }
+
+}
+
+// ======================================================================
+// a line of synth health in the top left corner
+//
+void GridStrument::drawSynthStats(ID2D1HwndRenderTarget* d2dRenderTarget, IDWriteTextFormat* dwriteTextFormat)
+{
+    GridSynthStats stats = grid_synth_->stats();
+    std::wostringstream text;
+    text << std::fixed << std::setprecision(0);
+    if (stats.engine == static_cast<int>(SynthEngine::OSCILLATORS)) {
+        // FluidSynth's estimate doesn't cover them, so our own
+        text << "oscillators " << 100.0 * stats.render_load << "% load, ";
+    }
+    else {
+        text << "synth " << stats.cpu_load << "% cpu, ";
+    }
+    text << stats.voices << "/" << stats.polyphony << " voices, " << stats.polyphony_hits << " stolen, "
+        << stats.late_callbacks << " late, " << stats.overloads << " overloads";
+    if (stats.governor_level > 0) {
+        text << ", cut back to level " << stats.governor_level;
+    }
+    std::wstring str = text.str();
+    D2D1_SIZE_F size = d2dRenderTarget->GetSize();
+    d2dRenderTarget->DrawText(
+        str.c_str(),
+        static_cast<UINT32>(str.size()),
+        dwriteTextFormat,
+        D2D1::RectF(8.0f, 8.0f, size.width - 8.0f, 8.0f + pref_grid_size_),
+        brushes_.grid_line_
+        );
+}
+
+// ======================================================================
+// draw a background that highlights the six "guitar string" rows when
+// we are in guitar_mode_.
+//
+void GridStrument::drawGuitar(ID2D1HwndRenderTarget* d2dRenderTarget)
+{
+    if (pref_hex_grid_mode_)
+        return;
+
+    float left, right, top, bottom;
+    left = 0.0f;
+    right = 1.0f * num_grids_x_ * pref_grid_size_;
+    top = 1.0f * (num_grids_y_ / 2 + 4) * pref_grid_size_;
+    bottom = 1.0f * (num_grids_y_ / 2 - 2) * pref_grid_size_;
+    if (num_grids_y_ % 2 == 0) {
+        top -= 1.0f * pref_grid_size_;
+        bottom -= 1.0f * pref_grid_size_;
+    }
+    D2D1_RECT_F rcf = D2D1::RectF(left, top, right, bottom);
+    d2dRenderTarget->FillRectangle(&rcf, brushes_.guitar_);
+}
+
+// ======================================================================
+// draw the lines making up the grid
+//
+void GridStrument::drawGrid(ID2D1HwndRenderTarget* d2dRenderTarget)
+{
+    if (!pref_hex_grid_mode_) {
+        for (int x = 0; x < num_grids_x_ * pref_grid_size_ + 1; x += pref_grid_size_) {
+            d2dRenderTarget->DrawLine(
+                D2D1::Point2F(static_cast<FLOAT>(x), 0.0f),
+                D2D1::Point2F(static_cast<FLOAT>(x), static_cast<FLOAT>(num_grids_y_ * pref_grid_size_)),
+                brushes_.grid_line_,
+                1.5f
+                );
+        }
+        for (int y = 0; y < num_grids_y_ * pref_grid_size_ + 1; y += pref_grid_size_) {
+            d2dRenderTarget->DrawLine(
+                D2D1::Point2F(0.0f, static_cast<FLOAT>(y)),
+                D2D1::Point2F(static_cast<FLOAT>(num_grids_x_ * pref_grid_size_), static_cast<FLOAT>(y)),
+                brushes_.grid_line_,
+                1.5f
+                );
+        }
+    }
+    else {
+        for (int x = 0; x < num_grids_x_; x++) {
+            for (int y = 0; y < num_grids_y_; y++) {
+                hexDrawCell(d2dRenderTarget, brushes_.grid_line_, pref_grid_size_ / 2, num_grids_x_, num_grids_y_, x, y);
+            }
+        }
+    }
+}
@@ -16,36 +16,270 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 // ======================================================================
 #include "GridSynth.h"
-#include "GridUtils.h"
+#include "GridLatency.h"
+#include "GridMidi.h"
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+
+// more shards than midi channels would leave some silent
+static const int MAX_SHARDS = 16;
+// memory for soundfonts kept loaded after playing, until changed
+static const long long DEFAULT_SOUNDFONT_BUDGET = 256LL * 1024 * 1024;
+// the governor steps back up below this share of its load
+static const double GOVERNOR_LOW = 0.6;
+// release, in timecents, of voices the governor cuts short.  About 15 ms,
+// quick but not a click.
+static const float CUT_RELEASE = -7200.0f;
+// how far a note's full modulation opens its filter, cents.  As far as
+// SF2's default velocity modulator closes it.
+static const float NOTE_FILTER_CENTS = 2400.0f;
+// pressure can make a note this much quieter than its velocity did, or
+// a quarter of that louder, centibels
+static const float NOTE_ATTENUATION_MAX = 960.0f;
+// send() queue slots only note ons & offs may take, so a rendering thread
+// that falls behind loses expression, which is soon sent again, rather
+// than making the sender wait or a note stick
+static const size_t NOTE_RESERVE = 256;
+// the rendering thread spins this long for the shard workers to finish a
+// block, then waits
+static const long long WORKER_SPIN_US = 200;
+
+static const char* const GOVERNOR_LEVELS[] = {
+    "full", "fewer voices", "cutting released voices", "no reverb or chorus"
+};
+static_assert(sizeof(GOVERNOR_LEVELS) / sizeof(GOVERNOR_LEVELS[0]) == static_cast<int>(GovernorLevel::MAXIMUM),
+    "a name for each governor level");
+
+static const char* const ENGINES[] = { "fluidsynth", "oscillators" };
+
+// a note on that starts a note, not a note on with 0 pressure
+static bool isNoteOn(uint32_t message)
+{
+    return (message & 0xf0) == MIDI::NOTE_ON && ((message >> 16) & 0x7f) > 0;
+}
+
+// a note on or off, as against expression
+static bool isNote(uint32_t message)
+{
+    return (message & 0xf0) == MIDI::NOTE_ON || (message & 0xf0) == MIDI::NOTE_OFF;
+}
+
+// ======================================================================
+// the audio drivers we offer.  ASIO devices are reached through
+// PortAudio, when FluidSynth is built with it.  "null" has no driver.
+//
+static const char* const AUDIO_DRIVERS[] = {
+#ifdef _WIN32
+    "wasapi", "dsound", "waveout", "portaudio",
+#else
+    "alsa", "pulseaudio", "jack", "file",
+#endif
+    "null"
+};
 
 // ======================================================================
-void checkAlertExit(int rc, std::wstring errStr) {
-    if (rc == FLUID_FAILED) {
-        std::wostringstream text;
-        text << "fluid fail (" << rc << "): " << errStr;
-        AlertExit(NULL, text.str().c_str());
+// set a FluidSynth setting, clamped into the range it allows
+//
+static int settingInt(fluid_settings_t* settings, const char* name, int value)
+{
+    int min_value = 0, max_value = 0;
+    if (fluid_settings_getint_range(settings, name, &min_value, &max_value) == FLUID_OK) {
+        int clamped = std::clamp(value, min_value, max_value);
+        if (clamped != value) {
+            std::wcout << name << " " << value << " is out of range, using " << clamped << std::endl;
+            value = clamped;
+        }
+    }
+    fluid_settings_setint(settings, name, value);
+    return value;
+}
+
+static double settingNum(fluid_settings_t* settings, const char* name, double value)
+{
+    double min_value = 0.0, max_value = 0.0;
+    if (fluid_settings_getnum_range(settings, name, &min_value, &max_value) == FLUID_OK) {
+        double clamped = std::clamp(value, min_value, max_value);
+        if (clamped != value) {
+            std::wcout << name << " " << value << " is out of range, using " << clamped << std::endl;
+            value = clamped;
+        }
     }
+    fluid_settings_setnum(settings, name, value);
+    return value;
 }
 
 // ======================================================================
-GridSynth::GridSynth() 
+// With the "null" driver nothing is heard; render() makes the audio,
+// as fast as it can, for benchmarks & tests.
+//
+GridSynth::GridSynth(const GridSynthConfig& config) :
+    config_(config), soundfont_ids_(SoundfontIds{ -1, -1 }),
+    queue_events_(true), next_event_{ 0, 0 }, has_next_event_(false), stream_time_(0),
+    delay_(0), late_(0), work_generation_(0), work_frames_(0), work_running_(true), work_left_(0),
+    polyphony_(0), last_callback_(0), callbacks_(0),
+    late_callbacks_(0), overloads_(0), polyphony_hits_(0), render_load_(0.0),
+    render_load_max_(0.0), voices_(0), voices_max_(0),
+    governor_(config.governor_load, config.governor_load * GOVERNOR_LOW), reverb_on_(true), chorus_on_(true),
+    voice_limit_(0), governor_level_(0), governor_steps_down_(0), governor_steps_up_(0), voices_cut_(0),
+    engine_(SynthEngine::FLUIDSYNTH), wanted_engine_(SynthEngine::FLUIDSYNTH), pitch_bend_range_(2),
+    modulation_controller_(1),
+    load_seconds_(0.0), load_bytes_(0),
+    load_pending_(false), loading_(false), running_(true), stats_seconds_(0),
+    budget_bytes_(DEFAULT_SOUNDFONT_BUDGET),
+    hits_(0), misses_(0), evictions_(0)
 {
+    // the synths take their rate & threads when made, the driver its
+    // buffering when started.  FluidSynth's file driver renders one synth
+    // itself.
     settings_ = new_fluid_settings();
-    synth_ = new_fluid_synth(settings_);
+    config_.sample_rate = settingNum(settings_, "synth.sample-rate", config_.sample_rate);
+    config_.cpu_cores = settingInt(settings_, "synth.cpu-cores", config_.cpu_cores);
+    config_.period_size = settingInt(settings_, "audio.period-size", config_.period_size);
+    config_.periods = settingInt(settings_, "audio.periods", config_.periods);
+    settingInt(settings_, "synth.midi-channels", MIDI::SYNTH_CHANNELS);
+    int shards = std::clamp(config_.shards, 1, MAX_SHARDS);
+    if (config_.driver == "file") {
+        shards = 1;
+        config_.engine = SynthEngine::FLUIDSYNTH;
+    }
+    if (shards != config_.shards) {
+        std::wcout << config_.shards << " synth shards is out of range, using " << shards << std::endl;
+        config_.shards = shards;
+    }
+    oscillators_.reset(new GridOscillatorBank(config_.sample_rate));
+    engine_.store(config_.engine);
+    wanted_engine_.store(config_.engine);
+    shards_.resize(shards);
+    for (Shard& shard : shards_) {
+        shard.synth = new_fluid_synth(settings_);
+        shard.left.resize(config_.period_size);
+        shard.right.resize(config_.period_size);
+        shard.events.reserve(SHARD_EVENTS);
+        shard.notes.reserve(SHARD_NOTES);
+        shard.channel_fonts.assign(fluid_synth_count_midi_channels(shard.synth), -1);
+    }
+    polyphony_ = fluid_synth_get_polyphony(shards_[0].synth);
+    voice_limit_.store(polyphony_);
+    for (Shard& shard : shards_) {
+        // room for the NULL that ends a short list
+        shard.voice_list.resize(polyphony_ + 1);
+    }
+    int active = 1;
+    fluid_settings_getint(settings_, "synth.reverb.active", &active);
+    reverb_on_ = (active != 0);
+    active = 1;
+    fluid_settings_getint(settings_, "synth.chorus.active", &active);
+    chorus_on_ = (active != 0);
+
+    // staging only loads soundfonts, it doesn't need the threads
+    staging_settings_ = new_fluid_settings();
+    staging_ = new_fluid_synth(staging_settings_);
+
+    // the workers' blocks hold up the audio thread's, so on Windows they
+    // run at its priority.  Elsewhere that needs privileges, so they run
+    // at normal priority & a preempted one costs the rendering thread a
+    // wait rather than a spin.
+    for (int index = 1; index < shards; index++) {
+        workers_.emplace_back(&GridSynth::worker, this, index);
+#ifdef _WIN32
+        SetThreadPriority(workers_.back().native_handle(), THREAD_PRIORITY_TIME_CRITICAL);
+#endif
+    }
 
-    int rc = fluid_settings_setstr(settings_, "audio.driver", "dsound");
-    checkAlertExit(rc, L"fluid_settings_setstr-dsound");
-    adriver_ = new_fluid_audio_driver(settings_, synth_);
+    adriver_ = nullptr;
+    startAudio();
 
-    soundfont_id_ = -1;
+    loader_ = std::thread(&GridSynth::loader, this);
 }
 
 // ======================================================================
 GridSynth::~GridSynth() 
 {
-    delete_fluid_synth(synth_);
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        running_ = false;
+    }
+    wake_.notify_one();
+    loader_.join();
+    // fonts in the synths go with them
+    delete_fluid_synth(staging_);
+    delete_fluid_settings(staging_settings_);
+
+    // the driver calls into the synths & workers, so it has to go first
+    if (adriver_ != nullptr) {
+        delete_fluid_audio_driver(adriver_);
+    }
+    {
+        std::lock_guard<std::mutex> lk(work_mutex_);
+        work_running_ = false;
+    }
+    work_wake_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+    for (Shard& shard : shards_) {
+        delete_fluid_synth(shard.synth);
+    }
     delete_fluid_settings(settings_);
-    delete_fluid_audio_driver(adriver_);
+}
+
+// ======================================================================
+// start the configured driver, falling back to the platform's default
+// driver & then to none.  Logs how much audio the driver buffers, the
+// latency it adds.  FluidSynth's file driver can't take our callback so
+// renders itself, playing messages as they are sent.
+//
+void GridSynth::startAudio()
+{
+    const std::string default_driver = GridSynthConfig().driver;
+    if (std::find(std::begin(AUDIO_DRIVERS), std::end(AUDIO_DRIVERS), config_.driver) == std::end(AUDIO_DRIVERS)) {
+        std::wcout << "unknown audio driver " << config_.driver.c_str() << ", using "
+            << default_driver.c_str() << std::endl;
+        config_.driver = default_driver;
+    }
+    while (config_.driver != "null") {
+        if (config_.driver == "file") {
+            fluid_settings_setstr(settings_, "audio.file.name", config_.file_name.c_str());
+        }
+        queue_events_ = (config_.driver != "file");
+        if (fluid_settings_setstr(settings_, "audio.driver", config_.driver.c_str()) == FLUID_OK) {
+            adriver_ = queue_events_ ? new_fluid_audio_driver2(settings_, audioCallback, this)
+                : new_fluid_audio_driver(settings_, shards_[0].synth);
+        }
+        if (adriver_ != nullptr) {
+            break;
+        }
+        std::wcout << "unable to start " << config_.driver.c_str() << " audio" << std::endl;
+        config_.driver = (config_.driver == default_driver) ? "null" : default_driver;
+    }
+
+    if (adriver_ == nullptr) {
+        queue_events_ = true;
+        std::wcout << "no audio driver, " << config_.sample_rate << " Hz, "
+            << config_.cpu_cores << " cpu cores, " << config_.shards << " shards, "
+            << ENGINES[static_cast<int>(config_.engine)] << std::endl;
+        return;
+    }
+    std::wcout << "audio " << config_.driver.c_str() << ": " << config_.periods << " periods of "
+        << config_.period_size << " frames at " << config_.sample_rate << " Hz, "
+        << bufferSeconds() * 1000.0 << " ms buffered, " << config_.cpu_cores << " cpu cores, "
+        << config_.shards << " shards, " << ENGINES[static_cast<int>(config_.engine)] << std::endl;
+}
+
+double GridSynth::bufferSeconds()
+{
+    if (adriver_ == nullptr) {
+        return 0.0;
+    }
+    return config_.periods * config_.period_size / config_.sample_rate;
 }
 
 // ======================================================================
@@ -58,35 +292,885 @@ void GridSynth::loadSoundfont(std::string soundfont_path_)
     // "/Users/rallen/Documents/Devel/Cpp/WinGridStrument/SoundFonts/fenderjazz.sf2"
     // "/Users/rallen/Documents/Devel/Cpp/WinGridStrument/SoundFonts/60s_Rock_Guitar.sf2"
     // "/Users/rallen/Documents/Devel/Cpp/WinGridStrument/SoundFonts/Electric_guitar.sf2"
-    soundfont_id_ = fluid_synth_sfload(synth_, soundfont_path_.c_str(), TRUE);
-    // FLUID_FAILED is -1, so we will not play if the id is < 0
+    std::lock_guard<std::mutex> lk(mutex_);
+    wanted_path_ = soundfont_path_;
+    for (auto it = resident_.begin(); it != resident_.end(); ++it) {
+        if (it->path == soundfont_path_) {
+            hits_++;
+            load_pending_ = false;
+            resident_.splice(resident_.begin(), resident_, it);
+            setReady(it->id);
+            evictSoundfonts();
+            return;
+        }
+    }
+    // a load in progress is kept if wanted again
+    load_pending_ = !(loading_ && loading_path_ == soundfont_path_);
+    load_path_ = soundfont_path_;
+    wake_.notify_one();
+}
+
+bool GridSynth::waitSoundfont()
+{
+    std::unique_lock<std::mutex> lk(mutex_);
+    loaded_.wait(lk, [this] { return !load_pending_ && !loading_; });
+    SoundfontIds ids = soundfont_ids_.load();
+    return ids.ready >= 0 || ids.playing >= 0;
+}
+
+// ======================================================================
+// loader thread, which also dumps the stats every stats_seconds_.  A
+// font that is no longer wanted by the time it has loaded is thrown
+// away, else it is added to the shards & made ready.
+//
+void GridSynth::loader()
+{
+    std::unique_lock<std::mutex> lk(mutex_);
+    while (true) {
+        int seconds = stats_seconds_;
+        auto woken = [this, seconds] { return !running_ || load_pending_ || stats_seconds_ != seconds; };
+        if (seconds <= 0) {
+            wake_.wait(lk, woken);
+        }
+        else if (!wake_.wait_for(lk, std::chrono::seconds(seconds), woken)) {
+            lk.unlock();
+            dumpStats();
+            lk.lock();
+            continue;
+        }
+        if (!running_) {
+            break;
+        }
+        if (!load_pending_) {
+            continue;
+        }
+        loading_path_ = load_path_;
+        load_pending_ = false;
+        loading_ = true;
+        misses_++;
+        lk.unlock();
+        std::vector<fluid_sfont_t*> sfonts = stageSoundfont(loading_path_);
+        lk.lock();
+        if (!sfonts.empty() && loading_path_ == wanted_path_) {
+            int id = addSoundfont(loading_path_, sfonts);
+            if (id >= 0) {
+                resident_.push_front({ loading_path_, id, load_bytes_.load() });
+                setReady(id);
+                evictSoundfonts();
+            }
+        }
+        else {
+            for (fluid_sfont_t* sfont : sfonts) {
+                delete_fluid_sfont(sfont);
+            }
+        }
+        loading_ = false;
+        loaded_.notify_all();
+    }
+}
+
+// ======================================================================
+// load a soundfont into staging_ once for each shard & take the copies
+// back off its stack, leaving them ours to add to the shards.  FluidSynth
+// loads all the samples up front, so the file size is a fair measure of
+// the memory it takes.  Its sample cache shares them between the copies.
+//
+std::vector<fluid_sfont_t*> GridSynth::stageSoundfont(const std::string& soundfont_path)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::vector<fluid_sfont_t*> sfonts;
+    while (sfonts.size() < shards_.size()) {
+        int id = fluid_synth_sfload(staging_, soundfont_path.c_str(), /*reset_presets=*/0);
+        fluid_sfont_t* sfont = (id == FLUID_FAILED) ? nullptr : fluid_synth_get_sfont_by_id(staging_, id);
+        if (sfont == nullptr) {
+            std::wcout << "unable to load soundfont " << soundfont_path.c_str() << std::endl;
+            for (fluid_sfont_t* loaded : sfonts) {
+                delete_fluid_sfont(loaded);
+            }
+            return {};
+        }
+        fluid_synth_remove_sfont(staging_, sfont);
+        sfonts.push_back(sfont);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::error_code ec;
+    long long bytes = static_cast<long long>(std::filesystem::file_size(soundfont_path, ec));
+    load_seconds_.store(seconds);
+    load_bytes_.store(ec ? 0 : bytes);
+    std::wcout << "soundfont " << soundfont_path.c_str() << " loaded in " << seconds * 1000.0
+        << " ms, " << (ec ? 0 : bytes) / (1024.0 * 1024.0) << " MB" << std::endl;
+    return sfonts;
+}
+
+// ======================================================================
+// add a newly loaded font's copies to the shards, returning its id or -1
+// if they couldn't all take it.  Every shard adds & unloads the same
+// fonts in turn, always holding mutex_, so each gives a font the same
+// id.  The caller holds mutex_.
+//
+int GridSynth::addSoundfont(const std::string& soundfont_path, const std::vector<fluid_sfont_t*>& sfonts)
+{
+    std::vector<int> ids;
+    while (ids.size() < shards_.size()) {
+        int id = fluid_synth_add_sfont(shards_[ids.size()].synth, sfonts[ids.size()]);
+        if (id == FLUID_FAILED) {
+            break;
+        }
+        ids.push_back(id);
+    }
+    bool added = (ids.size() == shards_.size()) &&
+        std::all_of(ids.begin(), ids.end(), [&ids](int id) { return id == ids[0]; });
+    if (added) {
+        return ids[0];
+    }
+    std::wcout << "unable to add soundfont " << soundfont_path.c_str() << std::endl;
+    for (size_t i = 0; i < sfonts.size(); i++) {
+        if (i < ids.size()) {
+            fluid_synth_sfunload(shards_[i].synth, ids[i], /*reset_presets=*/0);
+        }
+        else {
+            delete_fluid_sfont(sfonts[i]);
+        }
+    }
+    return -1;
+}
+
+// play this resident font from the next note on, replacing any font
+// still waiting.  The caller holds mutex_.
+void GridSynth::setReady(int soundfont_id)
+{
+    SoundfontIds ids = soundfont_ids_.load();
+    while (!soundfont_ids_.compare_exchange_weak(ids, SoundfontIds{ ids.playing, soundfont_id })) {
+    }
+}
+
+// ======================================================================
+// at a note on, on the rendering thread, play the ready soundfont.  It
+// is already in the shards, so this only takes its id, never waiting: if
+// setReady() changes it meanwhile, the next note on takes that one.
+//
+void GridSynth::swapSoundfont()
+{
+    SoundfontIds ids = soundfont_ids_.load(std::memory_order_acquire);
+    if (ids.ready >= 0) {
+        soundfont_ids_.compare_exchange_strong(ids, SoundfontIds{ ids.ready, -1 }, std::memory_order_acq_rel);
+    }
+}
+
+// at a note on, on the channel's thread, when the channel hasn't yet
+// selected the playing font.  Keeps its bank & program, falling back to
+// the first preset.
+void GridSynth::selectSoundfont(Shard& shard, int channel, int soundfont_id)
+{
+    int old_id = 0, bank = 0, program = 0;
+    fluid_synth_get_program(shard.synth, channel, &old_id, &bank, &program);
+    if (fluid_synth_program_select(shard.synth, channel, soundfont_id, bank, program) == FLUID_FAILED) {
+        fluid_synth_program_select(shard.synth, channel, soundfont_id, 0, 0);
+    }
+    shard.channel_fonts[channel] = soundfont_id;
+}
+
+// ======================================================================
+// unload the least recently wanted fonts until within budget, never the
+// playing one or one waiting to play.  Channels that still have one of
+// those selected lose their preset, & select the playing font at their
+// next note on.  The caller holds mutex_.
+//
+void GridSynth::evictSoundfonts()
+{
+    SoundfontIds ids = soundfont_ids_.load();
+    long long total = 0;
+    for (const Resident& resident : resident_) {
+        total += resident.bytes;
+    }
+    auto it = resident_.end();
+    while (total > budget_bytes_ && it != resident_.begin()) {
+        --it;
+        if (it->id == ids.playing || it->id == ids.ready) {
+            continue;
+        }
+        for (Shard& shard : shards_) {
+            fluid_synth_sfunload(shard.synth, it->id, /*reset_presets=*/0);
+        }
+        total -= it->bytes;
+        evictions_++;
+        it = resident_.erase(it);
+    }
+}
+
+long long GridSynth::soundfontBudget()
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    return budget_bytes_;
+}
+
+void GridSynth::soundfontBudget(long long bytes)
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    budget_bytes_ = bytes;
+    evictSoundfonts();
+}
+
+long long GridSynth::residentBytes()
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    long long total = 0;
+    for (const Resident& resident : resident_) {
+        total += resident.bytes;
+    }
+    return total;
+}
+
+// ======================================================================
+void GridSynth::dumpSoundfonts()
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    long long total = 0;
+    for (const Resident& resident : resident_) {
+        total += resident.bytes;
+    }
+    long long asked = hits_ + misses_;
+    std::wcout << "soundfonts: " << resident_.size() << " resident, " << total / (1024.0 * 1024.0)
+        << " of " << budget_bytes_ / (1024.0 * 1024.0) << " MB, " << hits_ << " hits ("
+        << ((asked > 0) ? 100.0 * hits_ / asked : 0.0) << "%), " << misses_ << " misses, "
+        << evictions_ << " evictions" << std::endl;
+    for (const Resident& resident : resident_) {
+        std::wcout << ((resident.id == playingSoundfont()) ? "  * " : "    ") << resident.path.c_str()
+            << " " << resident.bytes / (1024.0 * 1024.0) << " MB" << std::endl;
+    }
+}
+
+// ======================================================================
+// the audio driver's callback, on its thread
+//
+int GridSynth::audioCallback(void* data, int len, int nfx, float* fx[], int nout, float* out[])
+{
+    (void)nfx;
+    (void)fx;
+    if (nout < 2) {
+        return FLUID_FAILED;
+    }
+    static_cast<GridSynth*>(data)->renderStream(out[0], out[1], len);
+    return FLUID_OK;
+}
+
+// ======================================================================
+// Each callback block plays the touches from delay_ plus a block before
+// it, so messages land at the same spacing as their touches.  Block
+// start times follow the audio clock, only jumping back to GridClock
+// when they drift more than a block apart (after an underrun or a
+// delay change).  A callback over 1.5 blocks after the last is late, a
+// likely underrun.
+//
+void GridSynth::renderStream(float* left, float* right, int frames)
+{
+    double ticks_per_frame = GridClock::ticksPerSecond() / config_.sample_rate;
+    long long block_ticks = std::llround(frames * ticks_per_frame);
+    long long now = GridClock::now();
+    if (last_callback_ != 0 && now - last_callback_ > block_ticks * 3 / 2) {
+        late_callbacks_.fetch_add(1, std::memory_order_relaxed);
+    }
+    last_callback_ = now;
+    long long start_time = now - delay_.load(std::memory_order_relaxed) - block_ticks;
+    if (stream_time_ == 0 || std::llabs(start_time - stream_time_) > block_ticks) {
+        stream_time_ = start_time;
+    }
+    renderBlock(left, right, frames, stream_time_, ticks_per_frame);
+    stream_time_ += block_ticks;
+    updateStats(now, block_ticks);
+}
+
+// ======================================================================
+// after each block, given when its rendering started & how long it
+// plays for.  Lone writer, so plain loads & stores.
+//
+void GridSynth::updateStats(long long start_time, long long block_ticks)
+{
+    callbacks_.fetch_add(1, std::memory_order_relaxed);
+
+    double load = static_cast<double>(GridClock::now() - start_time) / block_ticks;
+    render_load_.store(load, std::memory_order_relaxed);
+    if (load > render_load_max_.load(std::memory_order_relaxed)) {
+        render_load_max_.store(load, std::memory_order_relaxed);
+    }
+    if (load > 1.0) {
+        overloads_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    int voices = activeVoices();
+    voices_.store(voices, std::memory_order_relaxed);
+    if (voices > voices_max_.load(std::memory_order_relaxed)) {
+        voices_max_.store(voices, std::memory_order_relaxed);
+    }
+    govern(load, static_cast<double>(block_ticks) / GridClock::ticksPerSecond());
+}
+
+// ======================================================================
+// apply the governor's level after a block that changed it.  A lower
+// voice limit only refuses note ons past it (noteOn()), leaving held
+// voices be: fluid_synth_set_polyphony would kill every voice above the
+// new limit at once.  Stepping down to RELEASED or past it cuts the
+// released voices there are then, once.  The steps go to logGovernor()
+// through governor_steps_, as the rendering thread mustn't block on a
+// log.
+//
+void GridSynth::govern(double load, double seconds)
+{
+    if (config_.governor_load <= 0.0) {
+        return;
+    }
+    if (governor_.update(load, seconds)) {
+        GovernorLevel level = governor_.level();
+        int voice_limit = (level >= GovernorLevel::POLYPHONY) ? std::max(1, polyphony_ / 2) : polyphony_;
+        bool effects = (level < GovernorLevel::NO_EFFECTS);
+        bool cut = (level >= GovernorLevel::RELEASED) &&
+            static_cast<int>(level) > governor_level_.load(std::memory_order_relaxed) &&
+            engine_.load(std::memory_order_relaxed) == SynthEngine::FLUIDSYNTH;
+        for (Shard& shard : shards_) {
+            if (cut) {
+                cutReleasedVoices(shard);
+            }
+            fluid_synth_reverb_on(shard.synth, -1, effects && reverb_on_);
+            fluid_synth_chorus_on(shard.synth, -1, effects && chorus_on_);
+        }
+        voice_limit_.store(voice_limit, std::memory_order_relaxed);
+        governor_level_.store(static_cast<int>(level), std::memory_order_relaxed);
+        governor_steps_down_.store(governor_.stepsDown(), std::memory_order_relaxed);
+        governor_steps_up_.store(governor_.stepsUp(), std::memory_order_relaxed);
+        governor_steps_.push({ level, governor_.load(), voice_limit * static_cast<int>(shards_.size()) });
+    }
+}
+
+// ======================================================================
+// fade out the quieter half of the released voices over CUT_RELEASE, in
+// place of their own release.  FluidSynth doesn't say how loud a voice
+// is now, so the velocity it started with stands in.  Sustained voices
+// still sound as held, so they are left alone.
+//
+void GridSynth::cutReleasedVoices(Shard& shard)
+{
+    std::vector<fluid_voice_t*>& voice_list = shard.voice_list;
+    fluid_synth_get_voicelist(shard.synth, voice_list.data(), static_cast<int>(voice_list.size()), -1);
+    auto end = std::find(voice_list.begin(), voice_list.end(), nullptr);
+    auto released_end = std::partition(voice_list.begin(), end, [](fluid_voice_t* voice) {
+        return fluid_voice_is_playing(voice) && !fluid_voice_is_on(voice) &&
+            !fluid_voice_is_sustained(voice) && !fluid_voice_is_sostenuto(voice) &&
+            fluid_voice_gen_get(voice, GEN_VOLENVRELEASE) > CUT_RELEASE;
+    });
+    auto cut_end = voice_list.begin() + (released_end - voice_list.begin() + 1) / 2;
+    std::nth_element(voice_list.begin(), cut_end, released_end, [](fluid_voice_t* a, fluid_voice_t* b) {
+        return fluid_voice_get_actual_velocity(a) < fluid_voice_get_actual_velocity(b);
+    });
+    for (auto it = voice_list.begin(); it != cut_end; ++it) {
+        fluid_voice_gen_set(*it, GEN_VOLENVRELEASE, CUT_RELEASE);
+        fluid_voice_update_param(*it, GEN_VOLENVRELEASE);
+    }
+    voices_cut_.fetch_add(cut_end - voice_list.begin(), std::memory_order_relaxed);
+}
+
+GridSynthStats GridSynth::stats()
+{
+    GridSynthStats stats;
+    stats.engine = static_cast<int>(engine_.load(std::memory_order_relaxed));
+    if (stats.engine == static_cast<int>(SynthEngine::FLUIDSYNTH)) {
+        for (Shard& shard : shards_) {
+            stats.cpu_load += fluid_synth_get_cpu_load(shard.synth);
+        }
+    }
+    stats.render_load = render_load_.load(std::memory_order_relaxed);
+    stats.render_load_max = render_load_max_.load(std::memory_order_relaxed);
+    stats.voices = voices_.load(std::memory_order_relaxed);
+    stats.voices_max = voices_max_.load(std::memory_order_relaxed);
+    stats.polyphony = (stats.engine == static_cast<int>(SynthEngine::OSCILLATORS)) ? GridOscillatorBank::VOICES :
+        voice_limit_.load(std::memory_order_relaxed) * static_cast<int>(shards_.size());
+    stats.polyphony_hits = polyphony_hits_.load(std::memory_order_relaxed);
+    stats.callbacks = callbacks_.load(std::memory_order_relaxed);
+    stats.late_callbacks = late_callbacks_.load(std::memory_order_relaxed);
+    stats.overloads = overloads_.load(std::memory_order_relaxed);
+    stats.late_events = late_.load(std::memory_order_relaxed);
+    stats.governor_level = governor_level_.load(std::memory_order_relaxed);
+    stats.governor_steps_down = governor_steps_down_.load(std::memory_order_relaxed);
+    stats.governor_steps_up = governor_steps_up_.load(std::memory_order_relaxed);
+    stats.voices_cut = voices_cut_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void GridSynth::resetStats()
+{
+    render_load_max_.store(0.0, std::memory_order_relaxed);
+    voices_max_.store(0, std::memory_order_relaxed);
+}
+
+void GridSynth::dumpStats()
+{
+    GridSynthStats s = stats();
+    std::wcout << "synth " << ENGINES[s.engine] << ": " << s.cpu_load << "% cpu, render load " << 100.0 * s.render_load << "% (max "
+        << 100.0 * s.render_load_max << "%), " << s.voices << " voices (max " << s.voices_max << ") of "
+        << s.polyphony << ", " << s.polyphony_hits << " polyphony hits, " << s.callbacks << " callbacks, "
+        << s.late_callbacks << " late, " << s.overloads << " overloads, " << s.late_events << " late events, "
+        << "governor " << GOVERNOR_LEVELS[s.governor_level] << " (" << s.governor_steps_down << " steps down, "
+        << s.governor_steps_up << " up, " << s.voices_cut << " voices cut)" << std::endl;
+}
+
+void GridSynth::logGovernor()
+{
+    GovernorStep step;
+    while (governor_steps_.pop(step)) {
+        std::wcout << "synth governor: " << GOVERNOR_LEVELS[static_cast<int>(step.level)] << " at "
+            << 100.0 * step.load << "% load, " << step.voice_limit << " voices, "
+            << governor_steps_down_.load(std::memory_order_relaxed) << " steps down, "
+            << governor_steps_up_.load(std::memory_order_relaxed) << " up, "
+            << voices_cut_.load(std::memory_order_relaxed) << " voices cut" << std::endl;
+    }
+}
+
+// ======================================================================
+void GridSynth::engine(SynthEngine engine)
+{
+    if (!queue_events_ && engine != SynthEngine::FLUIDSYNTH) {
+        std::wcout << "the " << config_.driver.c_str() << " audio driver can't play "
+            << ENGINES[static_cast<int>(engine)] << std::endl;
+        return;
+    }
+    wanted_engine_.store(engine);
+}
+
+void GridSynth::expression(int pitch_bend_range, int modulation_controller)
+{
+    pitch_bend_range_.store(pitch_bend_range);
+    modulation_controller_.store(modulation_controller);
+}
+
+// at the start of each block, on the rendering thread
+void GridSynth::updateEngine()
+{
+    oscillators_->pitchBendRange(pitch_bend_range_.load(std::memory_order_relaxed));
+    oscillators_->brightnessController(modulation_controller_.load(std::memory_order_relaxed));
+    SynthEngine engine = wanted_engine_.load(std::memory_order_relaxed);
+    if (engine == engine_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (engine == SynthEngine::OSCILLATORS) {
+        for (Shard& shard : shards_) {
+            fluid_synth_all_sounds_off(shard.synth, -1);
+            shard.notes.clear();
+        }
+    }
+    else {
+        oscillators_->reset();
+    }
+    engine_.store(engine, std::memory_order_relaxed);
+}
+
+void GridSynth::statsInterval(int seconds)
+{
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        stats_seconds_ = seconds;
+    }
+    wake_.notify_one();
+}
+
+// ======================================================================
+// Only the rendering thread may touch the voices & oscillators, so a
+// full queue waits for it to make room rather than playing here, or
+// losing a note off.  Expression doesn't take the last NOTE_RESERVE
+// slots, it is counted late & lost.  With no driver the caller renders,
+// so nothing would make room: a message that finds the queue full is
+// lost too.  FluidSynth's file driver renders itself, so messages play
+// here through its locked API, without per-note expression (dispatch()).
+//
+void GridSynth::send(uint32_t message, long long event_time, int channel)
+{
+    if (!queue_events_) {
+        play(message, channel);
+        return;
+    }
+    if (!isNote(message) && events_.space() <= NOTE_RESERVE) {
+        late_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    while (!events_.push({ message, channel, event_time })) {
+        if (adriver_ == nullptr) {
+            late_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::this_thread::yield();
+    }
+}
+
+void GridSynth::render(float* left, float* right, int frames)
+{
+    long long start_time = GridClock::now();
+    updateEngine();
+    if (has_next_event_) {
+        play(next_event_.message, next_event_.channel);
+        has_next_event_ = false;
+    }
+    SynthEvent event;
+    while (events_.pop(event)) {
+        play(event.message, event.channel);
+    }
+    renderShards(left, right, frames);
+    updateStats(start_time, std::llround(frames * GridClock::ticksPerSecond() / config_.sample_rate));
+}
+
+void GridSynth::renderTimed(float* left, float* right, int frames, long long start_time, double time_per_frame)
+{
+    long long render_time = GridClock::now();
+    renderBlock(left, right, frames, start_time, time_per_frame);
+    updateStats(render_time, std::llround(frames * GridClock::ticksPerSecond() / config_.sample_rate));
 }
 
+// ======================================================================
+// give each message due in this block to its channel's shard, at its
+// frame, then render the shards.  Messages for later frames wait for a
+// later call, those already past (or with no time) play at the start.
+// FluidSynth still only starts a note at its next internal 64 frame
+// block, but that is much finer than a driver period.  A new soundfont
+// switches in here, before the shards render.  The oscillators take
+// every message on shard 0, at the frame it is due.
+//
+void GridSynth::renderBlock(float* left, float* right, int frames, long long start_time, double time_per_frame)
+{
+    updateEngine();
+    bool oscillators = (engine_.load(std::memory_order_relaxed) == SynthEngine::OSCILLATORS);
+    while (has_next_event_ || events_.pop(next_event_)) {
+        has_next_event_ = true;
+        long long offset = 0;
+        if (next_event_.time != 0) {
+            offset = static_cast<long long>(std::floor((next_event_.time - start_time) / time_per_frame));
+        }
+        if (offset >= frames) {
+            break;
+        }
+        Shard& shard = oscillators ? shards_[0] : shards_[next_event_.channel % shards_.size()];
+        if (shard.events.size() == SHARD_EVENTS) {
+            break;
+        }
+        if (offset < 0) {
+            late_.fetch_add(1, std::memory_order_relaxed);
+            offset = 0;
+        }
+        if (isNoteOn(next_event_.message)) {
+            swapSoundfont();
+        }
+        shard.events.push_back({ static_cast<int>(offset), next_event_.message, next_event_.channel });
+        has_next_event_ = false;
+    }
+    renderShards(left, right, frames);
+}
+
+// ======================================================================
+// render every shard & mix them into left & right.  The workers only
+// block on work_mutex_ between blocks, so this holds it just long enough
+// to hand them one.  Waiting for them spins for WORKER_SPIN_US, as they
+// usually finish about when shard 0 does, then waits on work_done_ in
+// case one was preempted.
+//
+void GridSynth::renderShards(float* left, float* right, int frames)
+{
+    if (shards_.size() == 1 || engine_.load(std::memory_order_relaxed) == SynthEngine::OSCILLATORS) {
+        renderShard(shards_[0], left, right, frames);
+        return;
+    }
+    for (size_t index = 1; index < shards_.size(); index++) {
+        if (static_cast<int>(shards_[index].left.size()) < frames) {
+            shards_[index].left.resize(frames);
+            shards_[index].right.resize(frames);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lk(work_mutex_);
+        work_frames_ = frames;
+        work_left_.store(static_cast<int>(shards_.size()) - 1, std::memory_order_relaxed);
+        work_generation_++;
+    }
+    work_wake_.notify_all();
+    renderShard(shards_[0], left, right, frames);
+    long long spin_end = GridClock::now() + GridClock::ticksPerSecond() * WORKER_SPIN_US / 1000000;
+    while (work_left_.load(std::memory_order_acquire) > 0 && GridClock::now() < spin_end) {
+        std::this_thread::yield();
+    }
+    if (work_left_.load(std::memory_order_acquire) > 0) {
+        std::unique_lock<std::mutex> lk(work_mutex_);
+        work_done_.wait(lk, [this] { return work_left_.load(std::memory_order_acquire) == 0; });
+    }
+    for (size_t index = 1; index < shards_.size(); index++) {
+        const float* shard_left = shards_[index].left.data();
+        const float* shard_right = shards_[index].right.data();
+        for (int i = 0; i < frames; i++) {
+            left[i] += shard_left[i];
+            right[i] += shard_right[i];
+        }
+    }
+}
+
+// render up to each of the shard's messages, then play it
+void GridSynth::renderShard(Shard& shard, float* left, float* right, int frames)
+{
+    int done = 0;
+    for (const ShardEvent& event : shard.events) {
+        if (event.frame > done) {
+            write(shard, left, right, done, event.frame - done);
+            done = event.frame;
+        }
+        dispatch(event.message, event.channel);
+    }
+    if (done < frames) {
+        write(shard, left, right, done, frames - done);
+    }
+    shard.events.clear();
+}
+
+// frames of the shard's audio, from the offset
+void GridSynth::write(Shard& shard, float* left, float* right, int offset, int frames)
+{
+    if (engine_.load(std::memory_order_relaxed) == SynthEngine::OSCILLATORS) {
+        oscillators_->render(left + offset, right + offset, frames);
+    }
+    else {
+        fluid_synth_write_float(shard.synth, frames, left, offset, 1, right, offset, 1);
+    }
+}
+
+// a worker thread, rendering shards_[index] into its own buffers
+void GridSynth::worker(int index)
+{
+    long long generation = 0;
+    std::unique_lock<std::mutex> lk(work_mutex_);
+    while (true) {
+        work_wake_.wait(lk, [this, generation] { return !work_running_ || work_generation_ != generation; });
+        if (!work_running_) {
+            break;
+        }
+        generation = work_generation_;
+        int frames = work_frames_;
+        lk.unlock();
+        Shard& shard = shards_[index];
+        renderShard(shard, shard.left.data(), shard.right.data(), frames);
+        bool last = (work_left_.fetch_sub(1, std::memory_order_acq_rel) == 1);
+        lk.lock();
+        if (last) {
+            work_done_.notify_one();
+        }
+    }
+}
+
+// ======================================================================
+// a midi message sent with no time, to play at once.  A note on plays
+// any new soundfont first.
+//
+void GridSynth::play(uint32_t message, int channel)
+{
+    if (isNoteOn(message)) {
+        swapSoundfont();
+    }
+    dispatch(message, channel);
+}
+
+// a midi message as the synth calls, with the note it is for if any.
+// Per-note expression changes voices, which only the rendering thread
+// may do, so with FluidSynth's file driver X & Y act on the channel.
+void GridSynth::dispatch(uint32_t message, int channel)
+{
+    int data1 = (message >> 8) & 0x7f;
+    int data2 = (message >> 16) & 0x7f;
+    int note = queue_events_ ? MidiMessage::note(message) : -1;
+    switch (message & 0xf0) {
+    case MIDI::NOTE_ON:
+        noteOn(channel, data1, data2);
+        break;
+    case MIDI::PITCH_BEND:
+        pitchBend(channel, data1 | (data2 << 7), note);
+        break;
+    case MIDI::CONTROL_CHANGE:
+        controlChange(channel, data1, data2, note);
+        break;
+    case MIDI::POLY_KEY_PRESSURE:
+        polyKeyPressure(channel, data1, data2);
+        break;
+    }
+}
+
+int GridSynth::activeVoices()
+{
+    if (engine_.load(std::memory_order_relaxed) == SynthEngine::OSCILLATORS) {
+        return oscillators_->activeVoices();
+    }
+    int voices = 0;
+    for (Shard& shard : shards_) {
+        voices += fluid_synth_get_active_voice_count(shard.synth);
+    }
+    return voices;
+}
+
+double GridSynth::sampleRate()
+{
+    return config_.sample_rate;
+}
 
 // ======================================================================
 void GridSynth::noteOn(int channel, int note, int midi_pressure)
 {
-    if (soundfont_id_ < 0) return;
-    fluid_synth_noteon(synth_, channel, note, midi_pressure);
+    if (engine_.load(std::memory_order_relaxed) == SynthEngine::OSCILLATORS) {
+        if (oscillators_->noteOn(channel, note, midi_pressure)) {
+            polyphony_hits_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+    int soundfont_id = playingSoundfont();
+    if (soundfont_id < 0) return;
+    Shard& shard = channelShard(channel);
+    if (shard.channel_fonts[channel] != soundfont_id) {
+        selectSoundfont(shard, channel, soundfont_id);
+    }
+    int voice_limit = voice_limit_.load(std::memory_order_relaxed);
+    if (midi_pressure > 0 && fluid_synth_get_active_voice_count(shard.synth) >= voice_limit) {
+        polyphony_hits_.fetch_add(1, std::memory_order_relaxed);
+        if (voice_limit < polyphony_) {
+            return;     // governed, see govern()
+        }
+    }
+    fluid_synth_noteon(shard.synth, channel, note, midi_pressure);
+    trackNote(shard, channel, note, midi_pressure);
 }
 
 // ======================================================================
-void GridSynth::pitchBend(int channel, int mod_pitch)
+void GridSynth::pitchBend(int channel, int mod_pitch, int note)
 {
-    if (soundfont_id_ < 0) return;
-    fluid_synth_pitch_bend(synth_, channel, mod_pitch);
+    if (engine_.load(std::memory_order_relaxed) == SynthEngine::OSCILLATORS) {
+        oscillators_->pitchBend(channel, mod_pitch, note);
+        return;
+    }
+    if (playingSoundfont() < 0) return;
+    Shard& shard = channelShard(channel);
+    if (note < 0) {
+        fluid_synth_pitch_bend(shard.synth, channel, mod_pitch);
+        return;
+    }
+    NoteVoices* held = findNote(shard, channel, note);
+    if (held != nullptr) {
+        float cents = (mod_pitch - 0x2000) / 8192.0f * 100.0f * pitch_bend_range_.load(std::memory_order_relaxed);
+        noteGen(*held, GEN_FINETUNE, held->pitch, cents);
+    }
 }
 
 // ======================================================================
-void GridSynth::controlChange(int channel, int controller, int mod_modulation)
+void GridSynth::controlChange(int channel, int controller, int mod_modulation, int note)
 {
-    if (soundfont_id_ < 0) return;
-    fluid_synth_cc(synth_, channel, controller, mod_modulation);
+    if (engine_.load(std::memory_order_relaxed) == SynthEngine::OSCILLATORS) {
+        oscillators_->controlChange(channel, controller, mod_modulation, note);
+        return;
+    }
+    if (playingSoundfont() < 0) return;
+    Shard& shard = channelShard(channel);
+    if (note < 0 || controller != modulation_controller_.load(std::memory_order_relaxed)) {
+        fluid_synth_cc(shard.synth, channel, controller, mod_modulation);
+        return;
+    }
+    NoteVoices* held = findNote(shard, channel, note);
+    if (held != nullptr) {
+        noteGen(*held, GEN_FILTERFC, held->filter, NOTE_FILTER_CENTS * mod_modulation / 127.0f);
+    }
 }
 
 // ======================================================================
+// pressure relative to the note's velocity, so the note starts as loud
+// as FluidSynth made it
+//
 void GridSynth::polyKeyPressure(int channel, int key, int pressure)
 {
-    if (soundfont_id_ < 0) return;
-    fluid_synth_key_pressure(synth_, channel, key, pressure);
-}
\ No newline at end of file
+    if (engine_.load(std::memory_order_relaxed) == SynthEngine::OSCILLATORS) {
+        oscillators_->polyKeyPressure(channel, key, pressure);
+        return;
+    }
+    if (playingSoundfont() < 0) return;
+    Shard& shard = channelShard(channel);
+    NoteVoices* held = findNote(shard, channel, key);
+    if (held == nullptr) {
+        fluid_synth_key_pressure(shard.synth, channel, key, pressure);
+        return;
+    }
+    float attenuation = NOTE_ATTENUATION_MAX;
+    if (pressure > 0) {
+        attenuation = std::clamp(200.0f * std::log10(static_cast<float>(held->velocity) / pressure),
+            -NOTE_ATTENUATION_MAX / 4, NOTE_ATTENUATION_MAX);
+    }
+    noteGen(*held, GEN_ATTENUATION, held->attenuation, attenuation);
+}
+
+// ======================================================================
+// after a note on, note the voices it started: the newest of those
+// playing the key on the channel.  A note off or a new note on the same
+// key forgets the old ones, which keep the expression they had.
+//
+void GridSynth::trackNote(Shard& shard, int channel, int key, int velocity)
+{
+    if (!queue_events_) {
+        return;     // FluidSynth's file driver is rendering the voices
+    }
+    NoteVoices* old = findNote(shard, channel, key);
+    if (old != nullptr) {
+        *old = shard.notes.back();
+        shard.notes.pop_back();
+    }
+    if (velocity == 0 || shard.notes.size() == SHARD_NOTES) {
+        return;
+    }
+    NoteVoices held = { channel, key, velocity, 0, 0, {}, 0.0f, 0.0f, 0.0f };
+    std::vector<fluid_voice_t*>& voice_list = shard.voice_list;
+    fluid_synth_get_voicelist(shard.synth, voice_list.data(), static_cast<int>(voice_list.size()), -1);
+    for (fluid_voice_t* voice : voice_list) {
+        if (voice == nullptr) {
+            break;
+        }
+        if (fluid_voice_get_channel(voice) != channel || fluid_voice_get_key(voice) != key ||
+            !fluid_voice_is_on(voice)) {
+            continue;
+        }
+        unsigned int id = fluid_voice_get_id(voice);
+        if (held.count == 0 || id > held.id) {
+            held.id = id;
+            held.count = 0;
+        }
+        if (id == held.id && held.count < static_cast<int>(std::size(held.voices))) {
+            held.voices[held.count++] = voice;
+        }
+    }
+    if (held.count > 0) {
+        shard.notes.push_back(held);
+    }
+}
+
+GridSynth::NoteVoices* GridSynth::findNote(Shard& shard, int channel, int key)
+{
+    for (NoteVoices& held : shard.notes) {
+        if (held.key == key && held.channel == channel) {
+            return &held;
+        }
+    }
+    return nullptr;
+}
+
+// ======================================================================
+// move a generator of the note's voices from applied to value.  Adding
+// the change keeps what the font & its modulators set.  Voices since
+// taken for another note have a new id & are left alone.
+//
+void GridSynth::noteGen(NoteVoices& note, int gen, float& applied, float value)
+{
+    float change = value - applied;
+    if (change == 0.0f) {
+        return;
+    }
+    applied = value;
+    for (int i = 0; i < note.count; i++) {
+        fluid_voice_t* voice = note.voices[i];
+        if (fluid_voice_get_id(voice) == note.id && fluid_voice_is_playing(voice)) {
+            fluid_voice_gen_incr(voice, gen, change);
+            fluid_voice_update_param(voice, gen);
+        }
+    }
+}
@@ -17,25 +17,378 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 // ======================================================================
 
+#ifndef GRIDSTRUMENT_NO_SYNTH
 #include <fluidsynth.h>
+#endif
+#include "GridGovernor.h"
+#include "GridOscillator.h"
+#include "GridQueue.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
+// ======================================================================
+// what makes the sound: FluidSynth's soundfont voices or our own bank
+// of additive voices, GridOscillatorBank
+//
+enum class SynthEngine {
+    FLUIDSYNTH = 0,
+    OSCILLATORS
+};
+
+// ======================================================================
+// how GridSynth plays audio, fixed when it is made.  The driver buffers
+// periods * period_size frames, which is most of the synth's latency.
+// "null" plays no audio (render() makes it instead), "file" writes it to
+// file_name.  Values out of FluidSynth's range are clamped.  The synth
+// cuts back when rendering takes over governor_load of the time it plays
+// for, 0 to never.  shards splits the midi channels across that many
+// synths, rendered in parallel, each with cpu_cores threads of its own.
+// engine is the one to start with, engine() switches.
+//
+struct GridSynthConfig {
+#ifdef _WIN32
+    std::string driver = "dsound";
+    int period_size = 512;
+    int periods = 16;
+#else
+    std::string driver = "alsa";
+    int period_size = 64;
+    int periods = 8;
+#endif
+    double sample_rate = 44100.0;
+    int cpu_cores = 1;
+    int shards = 1;
+    std::string file_name = "gridsynth.wav";
+    double governor_load = 0.8;
+    SynthEngine engine = SynthEngine::FLUIDSYNTH;
+};
+
+// ======================================================================
+// synth health, kept by the audio callback.  Loads are the fraction of
+// real time spent rendering.
+//
+struct GridSynthStats {
+    double cpu_load = 0;            // FluidSynth's estimate, percent, 0 for the oscillators
+    double render_load = 0;         // ours, the latest block
+    double render_load_max = 0;
+    int voices = 0;
+    int voices_max = 0;
+    int polyphony = 0;              // voice limit, of all the shards
+    long long polyphony_hits = 0;   // note ons at the limit, stealing a voice (refused while governed)
+    long long callbacks = 0;
+    long long late_callbacks = 0;   // over 1.5 blocks after the last, an underrun
+    long long overloads = 0;        // blocks slower to render than to play
+    long long late_events = 0;      // messages played after their time
+    int governor_level = 0;         // GovernorLevel
+    long long governor_steps_down = 0;
+    long long governor_steps_up = 0;
+    long long voices_cut = 0;       // released voices cut short
+    int engine = 0;                 // SynthEngine
+};
+
+#ifdef GRIDSTRUMENT_NO_SYNTH
+// ======================================================================
+// builds without FluidSynth (the headless bench) get a silent synth
+//
 class GridSynth
 {
+public:
+    void loadSoundfont(std::string) {}
+    void soundfontBudget(long long) {}
+
+    void send(uint32_t, long long) {}
+    void send(uint32_t, long long, int) {}
+    void delay(long long) {}
+    GridSynthStats stats() { return GridSynthStats(); }
+};
+#else
+// ======================================================================
+// Soundfonts load on a background thread into a private staging synth,
+// so parsing a large .sf2 neither blocks the caller nor holds a synth's
+// lock.  The loader adds the loaded font to the shards & makes it the
+// ready one, which the rendering thread takes at the next note on,
+// without a lock.  Each channel then selects it at its own next note on.
+// Notes already held keep sounding on the old font until released.
+//
+// With an audio driver we render in our own callback, which plays the
+// midi messages queued by send() at their offset within the block, a
+// fixed delay after their touch.  Only that thread calls into the synths
+// for them, so sending never waits on FluidSynth's lock.
+//
+// Fonts stay loaded after being played, up to a memory budget, least
+// recently wanted unloaded first, by the loader or the caller.  The font
+// a switch replaces goes at the next load or change of budget.
+// Switching back to one of those is just a program select on each
+// channel.
+//
+// It has MIDI::SYNTH_CHANNELS channels, those past 15 sent with the
+// channel beside the message.  With more than one shard, channel c plays
+// on shard c % shards.  As fingers take channels in turn, their voices
+// spread evenly.  Workers render shards 1 and up while the rendering
+// thread renders shard 0, then it mixes them.  Each shard has its own
+// copy of every font, but FluidSynth's sample cache shares the sample
+// data between them.  Each also has its own reverb & chorus.  Those are
+// linear, so the mix sounds as one would, for the cost of running them
+// per shard.
+//
+// X & Y sent for a note (MidiMessage::forNote) change only the voices
+// that note started, as poly key pressure does: X the pitch, Y the
+// filter cutoff & pressure the attenuation, each on top of the font's
+// own.  So fingers sharing a channel don't bend each other, and playing
+// here doesn't need a channel per finger.
+//
+// The oscillator engine plays every channel on shard 0's thread, writing
+// oscillators_ in place of its synth.  A switch of engine takes effect at
+// the next block, silencing the old one.  It needs our own callback, so
+// FluidSynth's file driver only plays soundfonts, & without per-note
+// expression.
+//
+class GridSynth
+{
+    // a midi message, its channel & the GridClock time of its touch
+    struct SynthEvent {
+        uint32_t message;
+        int channel;
+        long long time;
+    };
+
+    // a change of governor level, for logGovernor()
+    struct GovernorStep {
+        GovernorLevel level;
+        double load;
+        int voice_limit;
+    };
+
+    // a message for a shard, at a frame of the block being rendered
+    struct ShardEvent {
+        int frame;
+        uint32_t message;
+        int channel;
+    };
+
+    // the voices a held note started, for expression of that note alone.
+    // FluidSynth gives all the voices of one note on the same id, and a
+    // voice reused for another note gets a new one.
+    struct NoteVoices {
+        int channel;
+        int key;
+        int velocity;
+        unsigned int id;
+        int count;
+        fluid_voice_t* voices[8];
+        float pitch;            // applied on top of the font's, cents
+        float filter;           // cents
+        float attenuation;      // centibels
+    };
+
+    static const int SHARD_EVENTS = 4096;
+    static const int SHARD_NOTES = 256;
+
+    struct Shard {
+        fluid_synth_t    *synth;
+        std::vector<float> left;            // its part of the mix, but shard 0's
+        std::vector<float> right;
+        std::vector<ShardEvent> events;     // for the block, never grown past SHARD_EVENTS
+        std::vector<NoteVoices> notes;      // held, never grown past SHARD_NOTES
+        std::vector<fluid_voice_t*> voice_list;
+        std::vector<int> channel_fonts;     // soundfont each channel has selected
+    };
+
+    // the playing & ready soundfont ids, -1 for none.  One atomic, so the
+    // rendering thread takes the ready one without a lock, and evicting
+    // sees both at once: the playing id only ever changes to the ready one.
+    struct SoundfontIds {
+        int playing;
+        int ready;
+    };
+
+    // a soundfont loaded into every shard, with the same id in each
+    struct Resident {
+        std::string path;
+        int id;
+        long long bytes;
+    };
+
+    GridSynthConfig       config_;          // as used, after any fixes
     fluid_settings_t     *settings_;
-    fluid_synth_t        *synth_;
+    std::vector<Shard>    shards_;
     fluid_audio_driver_t *adriver_;
-    int                   soundfont_id_;
+    std::atomic<SoundfontIds> soundfont_ids_;   // changed at a note on & by setReady()
+
+    // send() to the thread rendering
+    GridQueue<SynthEvent, 4096> events_;
+    bool                  queue_events_;    // else send() plays at once
+    SynthEvent            next_event_;      // popped but not yet due
+    bool                  has_next_event_;
+    long long             stream_time_;     // touch time the next callback block starts at
+    std::atomic<long long> delay_;
+    std::atomic<long long> late_;
+
+    // workers render shards 1 & up, one each, while the rendering thread
+    // renders shard 0
+    std::vector<std::thread> workers_;
+    std::mutex            work_mutex_;      // the three below
+    std::condition_variable work_wake_;
+    std::condition_variable work_done_;     // the last worker finished the block
+    long long             work_generation_; // a block to render when changed
+    int                   work_frames_;
+    bool                  work_running_;
+    std::atomic<int>      work_left_;       // workers still rendering the block
+
+    // stats, all but polyphony_ & last_callback_ read from other threads
+    int                   polyphony_;       // of each shard
+    long long             last_callback_;   // GridClock time, of the driver's last
+    std::atomic<long long> callbacks_;
+    std::atomic<long long> late_callbacks_;
+    std::atomic<long long> overloads_;
+    std::atomic<long long> polyphony_hits_;
+    std::atomic<double>   render_load_;
+    std::atomic<double>   render_load_max_;
+    std::atomic<int>      voices_;
+    std::atomic<int>      voices_max_;
+
+    // the governor, all but the atomics & governor_steps_ only used by
+    // the rendering thread
+    GridGovernor          governor_;
+    bool                  reverb_on_;       // as configured
+    bool                  chorus_on_;
+    std::atomic<int>      voice_limit_;     // of each shard, polyphony_ or less
+    std::atomic<int>      governor_level_;
+    std::atomic<long long> governor_steps_down_;
+    std::atomic<long long> governor_steps_up_;
+    std::atomic<long long> voices_cut_;
+    GridQueue<GovernorStep, 64> governor_steps_;
+
+    // the oscillator engine, only used by the rendering thread
+    std::unique_ptr<GridOscillatorBank> oscillators_;
+    std::atomic<SynthEngine> engine_;         // playing, changed by the rendering thread
+    std::atomic<SynthEngine> wanted_engine_;
+    std::atomic<int>      pitch_bend_range_;
+    std::atomic<int>      modulation_controller_;
+
+    fluid_settings_t     *staging_settings_;
+    fluid_synth_t        *staging_;         // only used by loader_
+    std::atomic<double>   load_seconds_;
+    std::atomic<long long> load_bytes_;
+    std::mutex            mutex_;           // everything below
+    std::condition_variable wake_;          // to loader_
+    std::condition_variable loaded_;        // from loader_
+    std::string           wanted_path_;     // last asked for
+    std::string           load_path_;       // next for loader_ to load
+    std::string           loading_path_;
+    bool                  load_pending_;
+    bool                  loading_;
+    bool                  running_;
+    int                   stats_seconds_;   // between loader_'s dumps, 0 for none
+    std::list<Resident>   resident_;        // most recently wanted first
+    long long             budget_bytes_;
+    long long             hits_;            // asked for when resident
+    long long             misses_;          // loads started
+    long long             evictions_;
+    std::thread           loader_;
+
+    void startAudio();
+    static int audioCallback(void* data, int len, int nfx, float* fx[], int nout, float* out[]);
+    void renderStream(float* left, float* right, int frames);
+    void renderBlock(float* left, float* right, int frames, long long start_time, double time_per_frame);
+    void renderShards(float* left, float* right, int frames);
+    void renderShard(Shard& shard, float* left, float* right, int frames);
+    void write(Shard& shard, float* left, float* right, int offset, int frames);
+    void updateEngine();
+    void worker(int index);
+    void updateStats(long long start_time, long long block_ticks);
+    void govern(double load, double seconds);
+    void cutReleasedVoices(Shard& shard);
+    void play(uint32_t message, int channel);
+    void dispatch(uint32_t message, int channel);
+    Shard& channelShard(int channel) { return shards_[channel % shards_.size()]; }
+    void loader();
+    std::vector<fluid_sfont_t*> stageSoundfont(const std::string& soundfont_path);
+    int addSoundfont(const std::string& soundfont_path, const std::vector<fluid_sfont_t*>& sfonts);
+    void setReady(int soundfont_id);
+    void swapSoundfont();
+    int playingSoundfont() { return soundfont_ids_.load(std::memory_order_relaxed).playing; }
+    void selectSoundfont(Shard& shard, int channel, int soundfont_id);
+    void evictSoundfonts();
+
+    // these act at once on the channel's shard, for the thread rendering
+    // it.  They don't switch soundfonts, play() does that.  A note given
+    // for X & Y changes just that note's voices.
+    void noteOn(int channel, int note, int midi_pressure);
+    void pitchBend(int channel, int mod_pitch, int note);
+    void controlChange(int channel, int controller, int mod_modulation, int note);
+    void polyKeyPressure(int channel, int key, int pressure);
+    void trackNote(Shard& shard, int channel, int key, int velocity);
+    NoteVoices* findNote(Shard& shard, int channel, int key);
+    void noteGen(NoteVoices& note, int gen, float& applied, float value);
 
 public:
-    GridSynth();
+    explicit GridSynth(const GridSynthConfig& config = GridSynthConfig());
     ~GridSynth();
 
+    const GridSynthConfig& config() { return config_; }
+    // audio the driver holds, 0 with none
+    double bufferSeconds();
+
+    // play a soundfont from the next note on, loading it in the
+    // background if it isn't resident.  A later call replaces a load that
+    // hasn't started.
     void loadSoundfont(std::string soundfont_path_);
+    // wait for any loading to finish, true if there is a soundfont
+    bool waitSoundfont();
+    // time the last load took & the size of that soundfont
+    double loadSeconds() { return load_seconds_.load(); }
+    long long loadBytes() { return load_bytes_.load(); }
 
-    void noteOn(int channel, int note, int midi_pressure);
-    void pitchBend(int channel, int mod_pitch);
-    void controlChange(int channel, int controller, int mod_modulation);
-    void polyKeyPressure(int channel, int key, int pressure);
+    // memory the resident soundfonts may use.  The playing one stays
+    // even when it is bigger.
+    long long soundfontBudget();
+    void soundfontBudget(long long bytes);
+    long long residentBytes();
+    void dumpSoundfonts();
+
+    // queue a midi message to play at the next render, or at once with
+    // FluidSynth's own file driver.  One thread at a time.  Waits while
+    // the queue is full.  channel may be past the message's own 4 bits.
+    void send(uint32_t message, long long event_time, int channel);
+    void send(uint32_t message, long long event_time) { send(message, event_time, message & 0x0f); }
+    // play send()s this many GridClock ticks after their event_time.  It
+    // should cover the time from touch to send(), or they play late.
+    void delay(long long ticks) { delay_.store(ticks); }
+    long long late() { return late_.load(); }
+
+    GridSynthStats stats();
+    // zero the maximums
+    void resetStats();
+    void dumpStats();
+    // also dump them this often, 0 to stop
+    void statsInterval(int seconds);
+    // play with this engine from the next block.  The oscillators take
+    // the instrument's pitch bend range & modulation controller, to read
+    // its X & Y as it means them.
+    void engine(SynthEngine engine);
+    SynthEngine engine() { return wanted_engine_.load(); }
+    void expression(int pitch_bend_range, int modulation_controller);
+    // log the governor's steps since the last call.  One thread at a
+    // time, never the one rendering.
+    void logGovernor();
+
+    // the next frames of stereo audio, with no audio driver.  render()
+    // plays all that was sent at the start.  renderTimed() plays each at
+    // its time, given the start time of these frames & time per frame.
+    // Both feed the stats & the governor, timing themselves against the
+    // audio they make.
+    void render(float* left, float* right, int frames);
+    void renderTimed(float* left, float* right, int frames, long long start_time, double time_per_frame);
+    int activeVoices();
+    double sampleRate();
 };
+#endif
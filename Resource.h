@@ -28,8 +28,22 @@
 #define IDC_PLAY_MIDI                   1011
 #define IDC_SOUNDFONT_PATH              1012
 #define IDC_PLAY_SOUNDFONT              1013
+#define IDC_EXPRESSION_FILTER           1014
+#define IDC_MIDI_FLUSH_MS               1015
+#define IDC_MIDI_DELAY_MS               1016
+#define IDC_SOUNDFONT_CACHE_MB          1017
+#define IDC_AUDIO_DRIVER                1018
+#define IDC_AUDIO_PERIOD_SIZE           1019
+#define IDC_AUDIO_PERIODS               1020
+#define IDC_SAMPLE_RATE                 1021
+#define IDC_CPU_CORES                   1022
+#define IDC_SYNTH_OVERLAY               1023
+#define IDC_SYNTH_SHARDS                1024
+#define IDC_SYNTH_OSCILLATORS           1025
 #define ID_FILE_PREFERENCES             32771
 #define IDM_PREFS                       32772
+#define IDM_STATS                       32773
+#define IDM_RECORDING                   32774
 #define IDC_STATIC                      -1
 
 // Next default values for new objects
@@ -38,7 +52,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NO_MFC                     1
 #define _APS_NEXT_RESOURCE_VALUE        131
-#define _APS_NEXT_COMMAND_VALUE         32773
+#define _APS_NEXT_COMMAND_VALUE         32775
 #define _APS_NEXT_CONTROL_VALUE         1008
 #define _APS_NEXT_SYMED_VALUE           110
 #endif
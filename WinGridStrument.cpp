@@ -33,6 +33,7 @@
 // resources
 #include "resource.h"
 
+#include "GridControl.h"
 #include "GridStrument.h"
 #include "GridUtils.h"
 
@@ -54,11 +55,16 @@
 #pragma comment(lib, "Dwrite")
 
 const static int MAX_LOADSTRING = 100;
+const static int MAX_POINTER_HISTORY = 8;  // coalesced samples per pointer we keep
+const static UINT_PTR SYNTH_TIMER = 1;  // logs the synth governor & redraws its stats overlay
+const static int SYNTH_STATS_SECONDS = 60;  // between synth stats in the log
 enum class Pref {
     MIDI_DEVICE_INDEX, GUITAR_MODE, PITCH_BEND_RANGE, PITCH_BEND_MASK,
     MODULATION_CONTROLLER, MIDI_CHANNEL_MIN, MIDI_CHANNEL_MAX,
     GRID_SIZE, CHANNEL_PER_ROW_MODE, COLOR_THEME, HEX_GRID_MODE,
-    PLAY_MIDI, PLAY_SOUNDFONT, SOUNDFONT_PATH
+    PLAY_MIDI, PLAY_SOUNDFONT, SOUNDFONT_PATH, EXPRESSION_FILTER, MIDI_FLUSH_MS, MIDI_DELAY_MS,
+    SOUNDFONT_CACHE_MB, AUDIO_DRIVER, AUDIO_PERIOD_SIZE, AUDIO_PERIODS, SAMPLE_RATE, CPU_CORES,
+    SYNTH_OVERLAY, SYNTH_SHARDS, SYNTH_OSCILLATORS
 };
 
 // Global Variables:
@@ -73,12 +79,13 @@ IDWriteFactory* g_dwriteFactory;
 IDWriteTextFormat* g_textFormat;
 
 // MIDI vars
-HMIDIOUT g_midiDevice;
 int g_midiDeviceIndex;
 std::vector<std::wstring> g_midiDeviceNames;
 
 // Instrument Class Vars
+GridSynth* g_gridSynth;
 GridStrument* g_gridStrument;
+GridControl* g_gridControl;
 
 // FIXME - must be a better way to do this
 bool g_dirty_main_window = false;
@@ -103,10 +110,9 @@ void DiscardGraphicsResources();
 void OnResize(HWND hWnd);
 void OnPaint(HWND hWnd);
 
-void OnPointerDownHandler(HWND hWnd, const POINTER_TOUCH_INFO& pti);
-void OnPointerUpdateHandler(HWND hWnd, const POINTER_TOUCH_INFO& pti);
+void OnPointerFrameHandler(HWND hWnd, UINT32 pointerId);
 //void OnPointerUpdateHandler(HWND hWnd, const POINTER_PEN_INFO& ppi);
-void OnPointerUpHandler(HWND hWnd, const POINTER_TOUCH_INFO& pti);
+TouchSample TouchSampleFromInfo(HWND hWnd, const POINTER_TOUCH_INFO& pti, TouchType type);
 
 void ScreenToClient(HWND hWnd, RECT* r);
 
@@ -123,6 +129,7 @@ std::wstring PrefGetString(Pref key);
 void PrefSetString(Pref key, std::wstring value);
 
 void AlertExit(HWND hWnd, LPCTSTR text);
+LONG WINAPI OnUnhandledException(EXCEPTION_POINTERS* exceptionInfo);
 
 std::wstring string2wstring(const std::string &str);
 std::string wstring2string(const std::wstring &wstr);
@@ -143,13 +150,27 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     //std::wstreambuf* old_wcout = std::wcout.rdbuf(); // save old buf
     std::wcout.rdbuf(logstream.rdbuf());                 // redirect std::wcout
 
+    // save the flight recorder if we crash
+    SetUnhandledExceptionFilter(OnUnhandledException);
+
+    // audio settings only take effect here
+    GridSynthConfig synth_config;
+    synth_config.driver = wstring2string(PrefGetString(Pref::AUDIO_DRIVER));
+    synth_config.period_size = PrefGetInt(Pref::AUDIO_PERIOD_SIZE);
+    synth_config.periods = PrefGetInt(Pref::AUDIO_PERIODS);
+    synth_config.sample_rate = PrefGetInt(Pref::SAMPLE_RATE);
+    synth_config.cpu_cores = PrefGetInt(Pref::CPU_CORES);
+    synth_config.shards = PrefGetInt(Pref::SYNTH_SHARDS);
+    synth_config.engine = PrefGetInt(Pref::SYNTH_OSCILLATORS) ? SynthEngine::OSCILLATORS : SynthEngine::FLUIDSYNTH;
+    g_gridSynth = new GridSynth(synth_config);
+    g_gridSynth->statsInterval(SYNTH_STATS_SECONDS);
+    g_gridStrument = new GridStrument(g_gridSynth);
+
     g_midiDeviceIndex = PrefGetInt(Pref::MIDI_DEVICE_INDEX);
     MMRESULT rc = StartMidi();
     if (rc != MMSYSERR_NOERROR) {
         AlertExit(NULL, L"Error opening MIDI Output.");
     }
-
-    g_gridStrument = new GridStrument(g_midiDevice);
     g_gridStrument->prefGuitarMode(PrefGetInt(Pref::GUITAR_MODE));
     g_gridStrument->prefPitchBendRange(PrefGetInt(Pref::PITCH_BEND_RANGE));
     g_gridStrument->prefPitchBendMask(PrefGetInt(Pref::PITCH_BEND_MASK));
@@ -161,7 +182,17 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     g_gridStrument->prefHexGridMode(PrefGetInt(Pref::HEX_GRID_MODE));
     g_gridStrument->prefPlayMidi(PrefGetInt(Pref::PLAY_MIDI));
     g_gridStrument->prefPlaySoundfont(PrefGetInt(Pref::PLAY_SOUNDFONT));
+    g_gridStrument->prefSoundfontCacheMb(PrefGetInt(Pref::SOUNDFONT_CACHE_MB));
     g_gridStrument->prefSoundfontPath(wstring2string(PrefGetString(Pref::SOUNDFONT_PATH)));
+    g_gridStrument->prefMidiDelayMs(PrefGetInt(Pref::MIDI_DELAY_MS));
+    g_gridStrument->prefMidiFlushMs(PrefGetInt(Pref::MIDI_FLUSH_MS));
+    g_gridStrument->prefExpressionFilter(PrefGetInt(Pref::EXPRESSION_FILTER));
+    g_gridStrument->prefSynthOverlay(PrefGetInt(Pref::SYNTH_OVERLAY));
+    g_gridSynth->expression(g_gridStrument->prefPitchBendRange(), g_gridStrument->prefModulationController());
+
+    // touch events are handled on their own thread
+    g_gridControl = new GridControl(g_gridStrument);
+    g_gridControl->start();
 
     WCHAR title[MAX_LOADSTRING];       // The title bar textfP
     WCHAR windowClass[MAX_LOADSTRING]; // the main window class name
@@ -187,9 +218,18 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
         }
     }
 
+    g_gridControl->stop();
+    g_gridStrument->latency().dump();
+    g_gridStrument->midiErrors().dump();
+    g_gridStrument->channels().dump();
+    g_gridSynth->dumpSoundfonts();
+    g_gridSynth->logGovernor();
+    g_gridSynth->dumpStats();
     StopMidi();
 
+    delete g_gridControl;
     delete g_gridStrument;
+    delete g_gridSynth;
 
     return (int)msg.wParam;
 }
@@ -247,26 +287,17 @@ void InitInstance(HINSTANCE hInstance, int nCmdShow, WCHAR* windowClass, WCHAR*
 LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 {
     switch (message) {
-    case WM_POINTERDOWN: {
-        POINTER_INPUT_TYPE pointer_type;
-        GetPointerType(GET_POINTERID_WPARAM(wParam), &pointer_type);
-        if (pointer_type == PT_TOUCH) {
-            POINTER_TOUCH_INFO pti;
-            GetPointerTouchInfo(GET_POINTERID_WPARAM(wParam), &pti);
-            OnPointerDownHandler(hWnd, pti);
-        } // we do not get (pointer_type == PT_PEN) 
-        break;
-    }
-    case WM_POINTERUPDATE: {
+    case WM_POINTERDOWN:
+    case WM_POINTERUPDATE:
+    case WM_POINTERUP: {
+        // handle every contact in this pointer's frame at once
         POINTER_INPUT_TYPE pointer_type;
         GetPointerType(GET_POINTERID_WPARAM(wParam), &pointer_type);
         if (pointer_type == PT_TOUCH) {
-            POINTER_TOUCH_INFO pti;
-            GetPointerTouchInfo(GET_POINTERID_WPARAM(wParam), &pti);
-            OnPointerUpdateHandler(hWnd, pti);
+            OnPointerFrameHandler(hWnd, GET_POINTERID_WPARAM(wParam));
         }
 #if 0
-        else if (pointer_type == PT_PEN) {
+        else if (message == WM_POINTERUPDATE && pointer_type == PT_PEN) {
             // all the events for PEN go through here
             POINTER_PEN_INFO ppi;
             GetPointerPenInfo(GET_POINTERID_WPARAM(wParam), &ppi);
@@ -275,16 +306,6 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 #endif
         break;
     }
-    case WM_POINTERUP: {
-        POINTER_INPUT_TYPE pointer_type;
-        GetPointerType(GET_POINTERID_WPARAM(wParam), &pointer_type);
-        if (pointer_type == PT_TOUCH) {
-            POINTER_TOUCH_INFO pti;
-            GetPointerTouchInfo(GET_POINTERID_WPARAM(wParam), &pti);
-            OnPointerUpHandler(hWnd, pti);
-        } // don't get these (pointer_type == PT_PEN)
-        break;
-    }
     case WM_COMMAND: {
         int wmId = LOWORD(wParam);
         // Parse the menu selections:
@@ -295,6 +316,20 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         case IDM_PREFS:
             DialogBox(g_instance, MAKEINTRESOURCE(IDD_PREFS_DIALOG), hWnd, PrefsCallback);
             break;
+        case IDM_STATS:
+            g_gridStrument->latency().dump();
+            g_gridStrument->midiErrors().dump();
+            g_gridStrument->channels().dump();
+            g_gridSynth->dumpSoundfonts();
+            g_gridSynth->dumpStats();
+            break;
+        case IDM_RECORDING: {
+            auto lock = g_gridControl->lock();
+            if (!g_gridStrument->saveRecording("recording.grec")) {
+                std::wcout << "unable to save recording.grec" << std::endl;
+            }
+            break;
+        }
         case IDM_EXIT:
             DestroyWindow(hWnd);
             break;
@@ -317,8 +352,18 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             reinterpret_cast<IUnknown**>(&g_dwriteFactory)))) {
             return -1;  // Fail CreateWindowEx.
         }
+        SetTimer(hWnd, SYNTH_TIMER, 500, NULL);
+        break;
+    case WM_TIMER:
+        if (wParam == SYNTH_TIMER) {
+            g_gridSynth->logGovernor();
+            if (g_gridStrument->prefSynthOverlay()) {
+                InvalidateRect(hWnd, NULL, FALSE);
+            }
+        }
         break;
     case WM_DESTROY:
+        KillTimer(hWnd, SYNTH_TIMER);
         DiscardGraphicsResources();
         SafeRelease(&g_d2dFactory);
         PostQuitMessage(0);
@@ -426,6 +471,48 @@ void InitPrefsDialog(const HWND& hDlg)
     tmp_str = string2wstring(g_gridStrument->prefSoundfontPath());
     SetDlgItemText(hDlg, IDC_SOUNDFONT_PATH, tmp_str.c_str());
 
+    value = g_gridStrument->prefSoundfontCacheMb();
+    tmp_str = std::to_wstring(value);
+    SetDlgItemText(hDlg, IDC_SOUNDFONT_CACHE_MB, tmp_str.c_str());
+
+    value = g_gridStrument->prefMidiDelayMs();
+    tmp_str = std::to_wstring(value);
+    SetDlgItemText(hDlg, IDC_MIDI_DELAY_MS, tmp_str.c_str());
+
+    // audio prefs are saved for the next start, so show those
+    tmp_str = PrefGetString(Pref::AUDIO_DRIVER);
+    SetDlgItemText(hDlg, IDC_AUDIO_DRIVER, tmp_str.c_str());
+
+    value = PrefGetInt(Pref::AUDIO_PERIOD_SIZE);
+    tmp_str = std::to_wstring(value);
+    SetDlgItemText(hDlg, IDC_AUDIO_PERIOD_SIZE, tmp_str.c_str());
+
+    value = PrefGetInt(Pref::AUDIO_PERIODS);
+    tmp_str = std::to_wstring(value);
+    SetDlgItemText(hDlg, IDC_AUDIO_PERIODS, tmp_str.c_str());
+
+    value = PrefGetInt(Pref::SAMPLE_RATE);
+    tmp_str = std::to_wstring(value);
+    SetDlgItemText(hDlg, IDC_SAMPLE_RATE, tmp_str.c_str());
+
+    value = PrefGetInt(Pref::CPU_CORES);
+    tmp_str = std::to_wstring(value);
+    SetDlgItemText(hDlg, IDC_CPU_CORES, tmp_str.c_str());
+
+    value = PrefGetInt(Pref::SYNTH_SHARDS);
+    tmp_str = std::to_wstring(value);
+    SetDlgItemText(hDlg, IDC_SYNTH_SHARDS, tmp_str.c_str());
+
+    value = g_gridStrument->prefMidiFlushMs();
+    tmp_str = std::to_wstring(value);
+    SetDlgItemText(hDlg, IDC_MIDI_FLUSH_MS, tmp_str.c_str());
+
+    CheckDlgButton(hDlg, IDC_EXPRESSION_FILTER, g_gridStrument->prefExpressionFilter());
+
+    CheckDlgButton(hDlg, IDC_SYNTH_OVERLAY, g_gridStrument->prefSynthOverlay());
+
+    CheckDlgButton(hDlg, IDC_SYNTH_OSCILLATORS, g_gridSynth->engine() == SynthEngine::OSCILLATORS);
+
 }
 
 // ======================================================================
@@ -434,6 +521,9 @@ void InitPrefsDialog(const HWND& hDlg)
 //
 void OkUpdatePrefsDialog(const HWND& hDlg)
 {
+    // keep the control thread out of g_gridStrument while we change it
+    auto lock = g_gridControl->lock();
+
     bool guitar_mode = IsDlgButtonChecked(hDlg, IDC_GUITAR_MODE);
     g_gridStrument->prefGuitarMode(guitar_mode);
     PrefSetInt(Pref::GUITAR_MODE, guitar_mode);
@@ -495,15 +585,75 @@ void OkUpdatePrefsDialog(const HWND& hDlg)
     g_gridStrument->prefSoundfontPath(wstring2string(soundfont_path_text));
     PrefSetString(Pref::SOUNDFONT_PATH, soundfont_path_text);
 
+    wchar_t soundfont_cache_mb_text[32];
+    GetDlgItemText(hDlg, IDC_SOUNDFONT_CACHE_MB, soundfont_cache_mb_text, 32);
+    value = static_cast<int>(wcstol(soundfont_cache_mb_text, &end_ptr, 10));
+    g_gridStrument->prefSoundfontCacheMb(value);
+    PrefSetInt(Pref::SOUNDFONT_CACHE_MB, value);
+
+    wchar_t midi_delay_ms_text[32];
+    GetDlgItemText(hDlg, IDC_MIDI_DELAY_MS, midi_delay_ms_text, 32);
+    value = static_cast<int>(wcstol(midi_delay_ms_text, &end_ptr, 10));
+    g_gridStrument->prefMidiDelayMs(value);
+    PrefSetInt(Pref::MIDI_DELAY_MS, value);
+
+    // GridSynth checks these when it starts
+    wchar_t audio_driver_text[32];
+    GetDlgItemText(hDlg, IDC_AUDIO_DRIVER, audio_driver_text, 32);
+    PrefSetString(Pref::AUDIO_DRIVER, audio_driver_text);
+
+    wchar_t audio_period_size_text[32];
+    GetDlgItemText(hDlg, IDC_AUDIO_PERIOD_SIZE, audio_period_size_text, 32);
+    value = static_cast<int>(wcstol(audio_period_size_text, &end_ptr, 10));
+    PrefSetInt(Pref::AUDIO_PERIOD_SIZE, value);
+
+    wchar_t audio_periods_text[32];
+    GetDlgItemText(hDlg, IDC_AUDIO_PERIODS, audio_periods_text, 32);
+    value = static_cast<int>(wcstol(audio_periods_text, &end_ptr, 10));
+    PrefSetInt(Pref::AUDIO_PERIODS, value);
+
+    wchar_t sample_rate_text[32];
+    GetDlgItemText(hDlg, IDC_SAMPLE_RATE, sample_rate_text, 32);
+    value = static_cast<int>(wcstol(sample_rate_text, &end_ptr, 10));
+    PrefSetInt(Pref::SAMPLE_RATE, value);
+
+    wchar_t cpu_cores_text[32];
+    GetDlgItemText(hDlg, IDC_CPU_CORES, cpu_cores_text, 32);
+    value = static_cast<int>(wcstol(cpu_cores_text, &end_ptr, 10));
+    PrefSetInt(Pref::CPU_CORES, value);
+
+    wchar_t synth_shards_text[32];
+    GetDlgItemText(hDlg, IDC_SYNTH_SHARDS, synth_shards_text, 32);
+    value = static_cast<int>(wcstol(synth_shards_text, &end_ptr, 10));
+    PrefSetInt(Pref::SYNTH_SHARDS, value);
+
+    wchar_t midi_flush_ms_text[32];
+    GetDlgItemText(hDlg, IDC_MIDI_FLUSH_MS, midi_flush_ms_text, 32);
+    value = static_cast<int>(wcstol(midi_flush_ms_text, &end_ptr, 10));
+    g_gridStrument->prefMidiFlushMs(value);
+    PrefSetInt(Pref::MIDI_FLUSH_MS, value);
+
+    bool expression_filter = IsDlgButtonChecked(hDlg, IDC_EXPRESSION_FILTER);
+    g_gridStrument->prefExpressionFilter(expression_filter);
+    PrefSetInt(Pref::EXPRESSION_FILTER, expression_filter);
+
+    bool synth_overlay = IsDlgButtonChecked(hDlg, IDC_SYNTH_OVERLAY);
+    g_gridStrument->prefSynthOverlay(synth_overlay);
+    PrefSetInt(Pref::SYNTH_OVERLAY, synth_overlay);
+
+    // the synth switches engine at once
+    bool synth_oscillators = IsDlgButtonChecked(hDlg, IDC_SYNTH_OSCILLATORS);
+    g_gridSynth->engine(synth_oscillators ? SynthEngine::OSCILLATORS : SynthEngine::FLUIDSYNTH);
+    g_gridSynth->expression(g_gridStrument->prefPitchBendRange(), g_gridStrument->prefModulationController());
+    PrefSetInt(Pref::SYNTH_OSCILLATORS, synth_oscillators);
+
     HWND midiDeviceComboBox = GetDlgItem(hDlg, IDC_MIDI_DEV_COMBO);
     int midi_device = static_cast<int>(SendMessage(midiDeviceComboBox, CB_GETCURSEL, (WPARAM)0, (LPARAM)0));
     if (g_midiDeviceIndex != midi_device) {
         assert(static_cast<unsigned int>(midi_device) < g_midiDeviceNames.size());
         // close current, open new midi device
-        StopMidi();
         g_midiDeviceIndex = midi_device;
         StartMidi();
-        g_gridStrument->midiDevice(g_midiDevice);
     }
     PrefSetInt(Pref::MIDI_DEVICE_INDEX, g_midiDeviceIndex);
 
@@ -569,6 +719,19 @@ void DiscardGraphicsResources()
     SafeRelease(&g_d2dRenderTarget);
 }
 
+// ======================================================================
+// on a crash, save what was played leading up to it.  No locking, the
+// control thread may be stopped anywhere, so this is best effort.
+//
+LONG WINAPI OnUnhandledException(EXCEPTION_POINTERS* exceptionInfo)
+{
+    UNREFERENCED_PARAMETER(exceptionInfo);
+    if (g_gridStrument != NULL) {
+        g_gridStrument->saveRecording("crash.grec");
+    }
+    return EXCEPTION_CONTINUE_SEARCH;
+}
+
 // ======================================================================
 // resize window, so adjust the gridStrument
 //
@@ -576,7 +739,10 @@ void OnResize(HWND hWnd) {
     RECT rc;
     GetClientRect(hWnd, &rc);
     D2D1_SIZE_U size = D2D1::SizeU(rc.right, rc.bottom);
-    g_gridStrument->resize(size);
+    {
+        auto lock = g_gridControl->lock();
+        g_gridStrument->resize(rc.right, rc.bottom);
+    }
     if (g_d2dRenderTarget != NULL) {
         g_d2dRenderTarget->Resize(size);
         InvalidateRect(hWnd, NULL, FALSE);
@@ -605,32 +771,72 @@ void OnPaint(HWND hWnd) {
 }
 
 // ======================================================================
-// user's finger touched screen for first time.  Gather
-// the id, location, contact rectangle & pressure and tell gridStrument.
+// a finger touched, moved or lifted.  Gather all contacts in this pointer
+// frame, including any samples Windows coalesced since the last frame,
+// with one call and queue them for the control thread, oldest first.
+// Then skip the messages for the other contacts in the same frame.
 //
-void OnPointerDownHandler(HWND hWnd, const POINTER_TOUCH_INFO& pti)
+void OnPointerFrameHandler(HWND hWnd, UINT32 pointerId)
 {
-    int id = pti.pointerInfo.pointerId;
-    POINT xy = pti.pointerInfo.ptPixelLocation;
-    RECT r = pti.rcContact;
-    ScreenToClient(hWnd, &xy);
-    ScreenToClient(hWnd, &r);
-    g_gridStrument->pointerDown(id, r, xy, pti.pressure);
+    static POINTER_TOUCH_INFO frame[MAX_POINTER_HISTORY * GridPointers::MAX_POINTERS];
+    static TouchSample samples[MAX_POINTER_HISTORY * GridPointers::MAX_POINTERS];
+    UINT32 entries = MAX_POINTER_HISTORY;
+    UINT32 pointers = GridPointers::MAX_POINTERS;
+    if (!GetPointerFrameTouchInfoHistory(pointerId, &entries, &pointers, frame)) {
+        // more history than we have room for.  Just use the latest frame.
+        entries = 1;
+        pointers = GridPointers::MAX_POINTERS;
+        if (!GetPointerFrameTouchInfo(pointerId, &pointers, frame)) {
+            return;
+        }
+    }
+    int count = 0;
+    // history entries are newest first
+    for (int h = static_cast<int>(entries) - 1; h >= 0; h--) {
+        for (UINT32 p = 0; p < pointers; p++) {
+            const POINTER_TOUCH_INFO& pti = frame[h * pointers + p];
+            POINTER_FLAGS flags = pti.pointerInfo.pointerFlags;
+            TouchType type;
+            if (flags & (POINTER_FLAG_UP | POINTER_FLAG_CANCELED)) {
+                type = TouchType::UP;
+            }
+            else if (flags & POINTER_FLAG_DOWN) {
+                type = TouchType::DOWN;
+            }
+            else if (flags & POINTER_FLAG_UPDATE) {
+                type = TouchType::UPDATE;
+            }
+            else {
+                continue;
+            }
+            // only the current entry can start or end a touch
+            if (h > 0 && type != TouchType::UPDATE) {
+                continue;
+            }
+            samples[count++] = TouchSampleFromInfo(hWnd, pti, type);
+        }
+    }
+    g_gridControl->push(samples, count);
+    SkipPointerFrameMessages(pointerId);
     InvalidateRect(hWnd, NULL, FALSE);
 }
 
 // ======================================================================
-// user's finger has moved/updated.  Gather info & tell gridStrument.
+// Gather the id, timestamp, location, contact rectangle & pressure for
+// one contact.
 //
-void OnPointerUpdateHandler(HWND hWnd, const POINTER_TOUCH_INFO& pti)
+TouchSample TouchSampleFromInfo(HWND hWnd, const POINTER_TOUCH_INFO& pti, TouchType type)
 {
-    int id = pti.pointerInfo.pointerId;
-    POINT xy = pti.pointerInfo.ptPixelLocation;
-    RECT r = pti.rcContact;
-    ScreenToClient(hWnd, &xy);
-    ScreenToClient(hWnd, &r);
-    g_gridStrument->pointerUpdate(id, r, xy, pti.pressure);
-    InvalidateRect(hWnd, NULL, FALSE);
+    TouchSample sample;
+    sample.type = type;
+    sample.time = static_cast<long long>(pti.pointerInfo.PerformanceCount);
+    sample.id = pti.pointerInfo.pointerId;
+    sample.point = pti.pointerInfo.ptPixelLocation;
+    sample.rect = pti.rcContact;
+    sample.pressure = pti.pressure;
+    ScreenToClient(hWnd, &sample.point);
+    ScreenToClient(hWnd, &sample.rect);
+    return sample;
 }
 
 // historical code to handle pen (not finger) events.  Not using for now
@@ -669,16 +875,6 @@ void OnPointerUpdateHandler(HWND hWnd, const POINTER_PEN_INFO& ppi)
 }
 #endif
 
-// ======================================================================
-// user's fingar has lifted, tell gridStrument
-//
-void OnPointerUpHandler(HWND hWnd, const POINTER_TOUCH_INFO& pti)
-{
-    int id = pti.pointerInfo.pointerId;
-    g_gridStrument->pointerUp(id);
-    InvalidateRect(hWnd, NULL, FALSE);
-}
-
 // ======================================================================
 // surprised this doesn't already exist.  Helper function for RECT, using
 // existing POINT function.
@@ -721,8 +917,8 @@ void QueryMidiDevices()
 }
 
 // ======================================================================
-// query devices and open the g_midiDeviceIndex preference, save in
-// g_midiDevice.
+// query devices and open the g_midiDeviceIndex preference for the
+// GridStrument, closing any current device.
 //
 MMRESULT StartMidi()
 {
@@ -730,7 +926,7 @@ MMRESULT StartMidi()
     QueryMidiDevices();
 
     // Open the MIDI output port
-    MMRESULT rc = midiOutOpen(&g_midiDevice, g_midiDeviceIndex, 0, 0, CALLBACK_NULL);
+    MMRESULT rc = g_gridStrument->midiDevice(g_midiDeviceIndex);
     if (rc != MMSYSERR_NOERROR) {
         std::wostringstream text;
         text << "Unable to midiOutOpen index=" << g_midiDeviceIndex << " returned=" << rc;
@@ -741,22 +937,11 @@ MMRESULT StartMidi()
 }
 
 // ======================================================================
-// reset and close the current g_midiDevice
+// reset and close the current midi device.  The device may be gone
+// already, so errors aren't worth stopping for.
 void StopMidi()
 {
-    // turn off any MIDI notes and close down.
-    MMRESULT rc = midiOutReset(g_midiDevice);
-    if (rc != MMSYSERR_NOERROR) {
-        std::wostringstream text;
-        text << "Unable to midiOutReset returned=" << rc;
-        AlertExit(NULL, text.str().c_str());
-    }
-    rc = midiOutClose(g_midiDevice);
-    if (rc != MMSYSERR_NOERROR) {
-        std::wostringstream text;
-        text << "Unable to midiOutClose returned=" << rc;
-        AlertExit(NULL, text.str().c_str());
-    }
+    g_gridStrument->closeMidiDevice();
 }
 
 // ======================================================================
@@ -805,6 +990,39 @@ int PrefGetDefaultInt(Pref key)
     case Pref::PLAY_SOUNDFONT:
         value = 0;
         break;
+    case Pref::MIDI_DELAY_MS:
+        value = 0;
+        break;
+    case Pref::MIDI_FLUSH_MS:
+        value = 0;
+        break;
+    case Pref::SOUNDFONT_CACHE_MB:
+        value = 256;
+        break;
+    case Pref::AUDIO_PERIOD_SIZE:
+        value = GridSynthConfig().period_size;
+        break;
+    case Pref::AUDIO_PERIODS:
+        value = GridSynthConfig().periods;
+        break;
+    case Pref::SAMPLE_RATE:
+        value = static_cast<int>(GridSynthConfig().sample_rate);
+        break;
+    case Pref::CPU_CORES:
+        value = GridSynthConfig().cpu_cores;
+        break;
+    case Pref::EXPRESSION_FILTER:
+        value = 1;
+        break;
+    case Pref::SYNTH_OVERLAY:
+        value = 0;
+        break;
+    case Pref::SYNTH_SHARDS:
+        value = GridSynthConfig().shards;
+        break;
+    case Pref::SYNTH_OSCILLATORS:
+        value = 0;
+        break;
     default:
         std::wostringstream text;
         text << "Unknown Pref::enum=" << int(key);
@@ -820,6 +1038,9 @@ std::wstring PrefGetDefaultString(Pref key)
     case Pref::SOUNDFONT_PATH:
         value = L"";
         break;
+    case Pref::AUDIO_DRIVER:
+        value = string2wstring(GridSynthConfig().driver);
+        break;
     default:
         std::wostringstream text;
         text << "Unknown Pref::enum=" << int(key);
@@ -877,6 +1098,42 @@ std::wstring PrefGetLabel(Pref key)
     case Pref::SOUNDFONT_PATH:
         key_str = L"SOUNDFONT_PATH";
         break;
+    case Pref::MIDI_DELAY_MS:
+        key_str = L"MIDI_DELAY_MS";
+        break;
+    case Pref::MIDI_FLUSH_MS:
+        key_str = L"MIDI_FLUSH_MS";
+        break;
+    case Pref::SOUNDFONT_CACHE_MB:
+        key_str = L"SOUNDFONT_CACHE_MB";
+        break;
+    case Pref::AUDIO_DRIVER:
+        key_str = L"AUDIO_DRIVER";
+        break;
+    case Pref::AUDIO_PERIOD_SIZE:
+        key_str = L"AUDIO_PERIOD_SIZE";
+        break;
+    case Pref::AUDIO_PERIODS:
+        key_str = L"AUDIO_PERIODS";
+        break;
+    case Pref::SAMPLE_RATE:
+        key_str = L"SAMPLE_RATE";
+        break;
+    case Pref::CPU_CORES:
+        key_str = L"CPU_CORES";
+        break;
+    case Pref::EXPRESSION_FILTER:
+        key_str = L"EXPRESSION_FILTER";
+        break;
+    case Pref::SYNTH_OVERLAY:
+        key_str = L"SYNTH_OVERLAY";
+        break;
+    case Pref::SYNTH_SHARDS:
+        key_str = L"SYNTH_SHARDS";
+        break;
+    case Pref::SYNTH_OSCILLATORS:
+        key_str = L"SYNTH_OSCILLATORS";
+        break;
     default:
         std::wostringstream text;
         text << "Unknown Pref::enum=" << int(key);